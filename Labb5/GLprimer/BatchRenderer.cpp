@@ -0,0 +1,263 @@
+/* BatchRenderer.cpp */
+/*
+ * Draw many meshes from a MeshArena with very few OpenGL calls.
+ * See BatchRenderer.hpp for a description of the class.
+ * This code is in the public domain.
+ */
+
+#include "BatchRenderer.hpp"
+#include "TriangleSoup.hpp"
+#include "MeshArena.hpp"
+#include "Utilities.hpp"
+
+/* Constructor: the matrices are bound to texture unit 'textureunit' */
+BatchRenderer::BatchRenderer(int textureunit) {
+
+	this->textureunit = textureunit;
+	allowindirect = true;
+	indirect = -1;
+	matrixbuffer = 0;
+	matrixtexture = 0;
+	commandbuffer = 0;
+	drawidbuffer = 0;
+	drawidcapacity = 0;
+	uniformprogram = 0;
+	matriceslocation = -1;
+	drawbaselocation = -1;
+}
+
+
+/* Destructor: delete the buffers and the texture */
+BatchRenderer::~BatchRenderer() {
+
+	if(glIsBuffer(matrixbuffer)) {
+		glDeleteBuffers(1, &matrixbuffer);
+	}
+	if(glIsTexture(matrixtexture)) {
+		glDeleteTextures(1, &matrixtexture);
+	}
+	if(glIsBuffer(commandbuffer)) {
+		glDeleteBuffers(1, &commandbuffer);
+	}
+	if(glIsBuffer(drawidbuffer)) {
+		glDeleteBuffers(1, &drawidbuffer);
+	}
+}
+
+
+/* Forget the draws of the last frame */
+void BatchRenderer::begin() {
+
+	commands.clear();
+	arenas.clear();
+	matrices.clear();
+}
+
+
+/*
+ * add(TriangleSoup &mesh, float MV[], int level)
+ *
+ * Record one draw. Nothing is sent to OpenGL until flush(), so the
+ * mesh and the matrix may change after this call without effect.
+ */
+bool BatchRenderer::add(TriangleSoup &mesh, float MV[], int level) {
+
+	DrawCommand command;
+	GLsizei count;
+	MeshArena *arena = mesh.arenaDraw(level, &count,
+		&command.firstindex, &command.basevertex);
+
+	if(!arena) {
+		Utilities::printError("BatchRenderer::add()", "The mesh is not in a MeshArena.");
+		return false;
+	}
+	command.count = count;
+	command.instancecount = 1;
+	command.baseinstance = (GLuint)commands.size(); // Index of the matrix
+	commands.push_back(command);
+	arenas.push_back(arena);
+	matrices.insert(matrices.end(), MV, MV + 16);
+	return true;
+}
+
+
+/*
+ * flush()
+ *
+ * Send the matrices, then draw each run of records that are in
+ * the same arena, with a single call if possible.
+ */
+int BatchRenderer::flush() {
+
+	int n = (int)commands.size();
+	int calls = 0;
+	bool useindirect;
+
+	if(n == 0) return 0;
+	if(indirect < 0) {
+		setup();
+	}
+	useindirect = indirect && allowindirect;
+
+	// A new data store every frame, so we never wait for the GPU
+	// to finish drawing with the matrices of the last frame
+	glBindBuffer(GL_TEXTURE_BUFFER, matrixbuffer);
+	glBufferData(GL_TEXTURE_BUFFER, matrices.size()*sizeof(GLfloat),
+		&matrices[0], GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0 + textureunit);
+	glBindTexture(GL_TEXTURE_BUFFER, matrixtexture);
+	glActiveTexture(GL_TEXTURE0);
+	setUniforms();
+
+	if(useindirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commandbuffer);
+		glBufferData(GL_DRAW_INDIRECT_BUFFER, n*sizeof(DrawCommand),
+			&commands[0], GL_STREAM_DRAW);
+	}
+	for(int first=0, end; first<n; first=end) {
+		end = first + 1;
+		while(end < n && arenas[end] == arenas[first]) {
+			end++;
+		}
+		arenas[first]->bind();
+		if(useindirect) {
+			calls += drawIndirect(first, end - first);
+		}
+		else {
+			calls += drawSeparately(first, end - first);
+		}
+	}
+	if(useindirect) {
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	}
+	return calls;
+}
+
+
+/* Allow or forbid glMultiDrawElementsIndirect() */
+void BatchRenderer::setIndirect(bool allow) {
+	allowindirect = allow;
+}
+
+
+/* Number of records since begin() */
+int BatchRenderer::drawCount() {
+	return (int)commands.size();
+}
+
+
+/*
+ * private
+ * setup() - Create the buffers and the texture, and check whether
+ * glMultiDrawElementsIndirect() can be used.
+ */
+void BatchRenderer::setup() {
+
+	GLint major = 0, minor = 0;
+
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+	indirect = 0;
+#ifdef GL_VERSION_4_3
+	if(major > 4 || (major == 4 && minor >= 3)) {
+		indirect = 1;
+	}
+#ifdef __WIN32__
+	if(!glMultiDrawElementsIndirect) {
+		indirect = 0;
+	}
+#endif
+#endif
+
+	glGenBuffers(1, &matrixbuffer);
+	glGenBuffers(1, &commandbuffer);
+	glGenBuffers(1, &drawidbuffer);
+	glGenTextures(1, &matrixtexture);
+
+	// The texture only refers to the buffer, so new data
+	// in the buffer needs no new glTexBuffer() call
+	glBindBuffer(GL_TEXTURE_BUFFER, matrixbuffer);
+	glBufferData(GL_TEXTURE_BUFFER, 16*sizeof(GLfloat), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0 + textureunit);
+	glBindTexture(GL_TEXTURE_BUFFER, matrixtexture);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, matrixbuffer);
+	glBindTexture(GL_TEXTURE_BUFFER, 0);
+	glActiveTexture(GL_TEXTURE0);
+}
+
+
+/*
+ * private
+ * setUniforms() - Point the shader to the matrices. The locations are
+ * looked up again only when another shader program is in use.
+ */
+void BatchRenderer::setUniforms() {
+
+	GLint program = 0;
+
+	glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	if((GLuint)program != uniformprogram) {
+		uniformprogram = (GLuint)program;
+		matriceslocation = glGetUniformLocation(uniformprogram, "drawMatrices");
+		drawbaselocation = glGetUniformLocation(uniformprogram, "drawBase");
+	}
+	glUniform1i(matriceslocation, textureunit);
+	glUniform1i(drawbaselocation, 0);
+}
+
+
+/*
+ * private
+ * drawIndirect() - Draw 'count' records from 'first' with one call.
+ * The draw index attribute has a divisor of 1, so each draw reads the
+ * element of drawidbuffer at its base instance, which is its index.
+ * The attribute is part of the arena VAO, which must be bound.
+ */
+int BatchRenderer::drawIndirect(int first, int count) {
+
+#ifdef GL_VERSION_4_3
+	if(drawidcapacity < (int)commands.size()) {
+		drawidcapacity = 2*drawidcapacity > (int)commands.size()
+			? 2*drawidcapacity : (int)commands.size();
+		GLfloat *drawids = new GLfloat[drawidcapacity];
+		for(int i=0; i<drawidcapacity; i++) {
+			drawids[i] = (GLfloat)i; // Exact up to 2^24 draws
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, drawidbuffer);
+		glBufferData(GL_ARRAY_BUFFER, drawidcapacity*sizeof(GLfloat), drawids, GL_STATIC_DRAW);
+		delete[] drawids;
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, drawidbuffer);
+	glEnableVertexAttribArray(DRAWID_LOCATION);
+	glVertexAttribPointer(DRAWID_LOCATION, 1, GL_FLOAT, GL_FALSE, 0, (void*)0);
+	glVertexAttribDivisor(DRAWID_LOCATION, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT,
+		(void*)((size_t)first*sizeof(DrawCommand)), count, 0);
+	return 1;
+#else
+	return drawSeparately(first, count);
+#endif
+}
+
+
+/*
+ * private
+ * drawSeparately() - Draw 'count' records from 'first', one call each.
+ * A disabled attribute reads as 0, so drawBase alone picks the matrix.
+ */
+int BatchRenderer::drawSeparately(int first, int count) {
+
+	glDisableVertexAttribArray(DRAWID_LOCATION);
+	for(int i=first; i<first+count; i++) {
+		const DrawCommand &command = commands[i];
+		glUniform1i(drawbaselocation, i);
+		glDrawElementsBaseVertex(GL_TRIANGLES, command.count, GL_UNSIGNED_INT,
+			(void*)((size_t)command.firstindex*sizeof(GLuint)), command.basevertex);
+	}
+	glUniform1i(drawbaselocation, 0);
+	return count;
+}
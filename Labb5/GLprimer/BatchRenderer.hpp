@@ -0,0 +1,105 @@
+/* BatchRenderer.hpp */
+/*
+ * Draw many meshes from a MeshArena with very few OpenGL calls.
+ * Usage: call begin() at the start of a frame, add() once for each
+ * object with its mesh and its modelview matrix, then flush() with
+ * a shader like vertex_batch.glsl in use. Meshes must have been put
+ * in an arena with TriangleSoup::setArena().
+ * The modelview matrices go into one texture buffer, which the shader
+ * reads with texelFetch() at 4 texels per matrix. With OpenGL 4.3,
+ * all objects in the same arena are drawn by a single
+ * glMultiDrawElementsIndirect() call, and each draw finds its matrix
+ * through an instanced vertex attribute that counts 0, 1, 2...
+ * and is offset by the base instance of the draw command. With
+ * OpenGL 3.3 there is no way to tell the draws in a multi-draw call
+ * apart, so the objects are drawn one glDrawElementsBaseVertex()
+ * at a time, with the matrix index in a uniform. The arena VAO stays
+ * bound in both cases.
+ * This code is in the public domain.
+ */
+
+#ifndef BATCHRENDERER_HPP // Avoid including this header twice
+#define BATCHRENDERER_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h> // To use OpenGL datatypes
+#include <vector>       // For the draw records
+
+class TriangleSoup;
+class MeshArena;
+
+class BatchRenderer {
+
+public:
+
+/* Attribute location of the draw index in the shader */
+enum { DRAWID_LOCATION = 3 };
+
+/* Constructor: the matrices are bound to texture unit 'textureunit' */
+BatchRenderer(int textureunit = 1);
+
+/* Destructor: delete the buffers and the texture */
+~BatchRenderer();
+
+/* Forget the draws of the last frame */
+void begin();
+
+/* Record one draw of a mesh (level of detail 'level') with the
+ * modelview matrix MV. Returns false if the mesh is not in an arena. */
+bool add(TriangleSoup &mesh, float MV[], int level = 0);
+
+/* Draw everything since begin(), with the shader program in use.
+ * Returns the number of OpenGL draw calls made. */
+int flush();
+
+/* Allow or forbid glMultiDrawElementsIndirect() (allowed by default,
+ * but only used with OpenGL 4.3 or later) */
+void setIndirect(bool allow);
+
+/* Number of records since begin() */
+int drawCount();
+
+private:
+
+/* Same layout as DrawElementsIndirectCommand in OpenGL 4.3 */
+struct DrawCommand {
+	GLuint count;
+	GLuint instancecount;
+	GLuint firstindex;
+	GLint basevertex;
+	GLuint baseinstance;
+};
+
+std::vector<DrawCommand> commands; // One per add()
+std::vector<MeshArena*> arenas;    // Arena of each command
+std::vector<GLfloat> matrices;     // 16 floats per command
+int textureunit;
+bool allowindirect;
+int indirect;            // -1 before the version check, then 0 or 1
+GLuint matrixbuffer;     // GL_TEXTURE_BUFFER with the matrices
+GLuint matrixtexture;    // Texture buffer view of matrixbuffer, RGBA32F
+GLuint commandbuffer;    // GL_DRAW_INDIRECT_BUFFER
+GLuint drawidbuffer;     // 0, 1, 2... as floats, for the instanced draw index
+int drawidcapacity;
+GLuint uniformprogram;   // Shader program that the locations below belong to
+GLint matriceslocation;  // Uniforms drawMatrices and drawBase
+GLint drawbaselocation;
+
+void setup();
+
+void setUniforms();
+
+int drawIndirect(int first, int count);
+
+int drawSeparately(int first, int count);
+
+// The buffers are a unique resource, so copying is not allowed
+BatchRenderer(const BatchRenderer&);
+BatchRenderer& operator=(const BatchRenderer&);
+
+};
+
+#endif // BATCHRENDERER_HPP
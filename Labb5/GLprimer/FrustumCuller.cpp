@@ -0,0 +1,182 @@
+/* FrustumCuller.cpp */
+/*
+ * View frustum culling of whole objects by their bounding spheres.
+ * See FrustumCuller.hpp for a description of the class.
+ * This code is in the public domain.
+ */
+
+#include <cmath>      // For sqrtf()
+#ifdef __SSE__
+#include <xmmintrin.h> // For testing four spheres at a time
+#endif
+
+#include "FrustumCuller.hpp"
+#include "TriangleSoup.hpp"
+#include "Utilities.hpp"
+
+/* Constructor: start with an empty frame */
+FrustumCuller::FrustumCuller() {
+
+	for(int i=0; i<16; i++) {
+		V[i] = (i % 5 == 0) ? 1.0f : 0.0f; // Identity
+	}
+	for(int i=0; i<24; i++) {
+		planes[i] = 0.0f; // Every point is inside
+	}
+	nvisible = 0;
+}
+
+
+/* Start a new frame with the view frustum of P*V */
+void FrustumCuller::begin(float P[], float V[]) {
+
+	float PV[16];
+
+	for(int i=0; i<16; i++) {
+		this->V[i] = V[i];
+	}
+	Utilities::mat4mult(P, V, PV);
+	Utilities::mat4frustumPlanes(PV, planes);
+	meshes.clear();
+	matrices.clear();
+	centerx.clear();
+	centery.clear();
+	centerz.clear();
+	radii.clear();
+	visibleflags.clear();
+	nvisible = 0;
+}
+
+
+/*
+ * add(TriangleSoup *mesh, float M[])
+ *
+ * Move the bounding sphere of the mesh to world space with M. The
+ * radius is scaled by the largest scaling in M, so a non-uniform
+ * scaling gives a sphere that is too large, but never too small.
+ */
+int FrustumCuller::add(TriangleSoup *mesh, float M[]) {
+
+	float center[3], worldcenter[3], radius, scale = 0.0f;
+	int index;
+
+	radius = mesh->boundingSphere(center);
+	for(int k=0; k<3; k++) {
+		worldcenter[k] = M[12+k] + M[k]*center[0] + M[4+k]*center[1] + M[8+k]*center[2];
+		scale = fmaxf(scale, M[4*k]*M[4*k] + M[4*k+1]*M[4*k+1] + M[4*k+2]*M[4*k+2]);
+	}
+	index = addSphere(worldcenter, radius*sqrtf(scale));
+	meshes[index] = mesh;
+	for(int i=0; i<16; i++) {
+		matrices[16*index + i] = M[i];
+	}
+	return index;
+}
+
+
+/* Add a bounding sphere in world space, with no mesh to render */
+int FrustumCuller::addSphere(const float center[3], float radius) {
+
+	meshes.push_back(NULL);
+	matrices.resize(matrices.size() + 16, 0.0f);
+	centerx.push_back(center[0]);
+	centery.push_back(center[1]);
+	centerz.push_back(center[2]);
+	radii.push_back(radius);
+	return (int)meshes.size() - 1;
+}
+
+
+/*
+ * cull()
+ *
+ * A sphere is outside if its center is further than its radius behind
+ * any of the six planes. This is conservative: a sphere near a corner
+ * of the frustum may be outside it and still pass every plane.
+ */
+int FrustumCuller::cull() {
+
+	int n = (int)meshes.size();
+	int i = 0;
+
+	visibleflags.resize(n);
+	nvisible = 0;
+
+#ifdef __SSE__
+	// Pad to a multiple of four, so the loads stay inside the arrays
+	int padded = (n + 3) & ~3;
+	centerx.resize(padded, 0.0f);
+	centery.resize(padded, 0.0f);
+	centerz.resize(padded, 0.0f);
+	radii.resize(padded, 0.0f);
+	for(; i<n; i+=4) {
+		__m128 x = _mm_loadu_ps(&centerx[i]);
+		__m128 y = _mm_loadu_ps(&centery[i]);
+		__m128 z = _mm_loadu_ps(&centerz[i]);
+		__m128 negradius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&radii[i]));
+		__m128 outside = _mm_setzero_ps();
+		for(int k=0; k<6; k++) {
+			const float *plane = &planes[4*k];
+			__m128 distance = _mm_add_ps(
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[0]), x), _mm_mul_ps(_mm_set1_ps(plane[1]), y)),
+				_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane[2]), z), _mm_set1_ps(plane[3])));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negradius));
+		}
+		int mask = _mm_movemask_ps(outside);
+		for(int j=0; j<4 && i+j<n; j++) {
+			visibleflags[i+j] = !((mask >> j) & 1);
+			nvisible += visibleflags[i+j];
+		}
+	}
+	centerx.resize(n);
+	centery.resize(n);
+	centerz.resize(n);
+	radii.resize(n);
+#endif
+	for(; i<n; i++) { // Without SSE, one sphere at a time
+		bool inside = true;
+		for(int k=0; k<6 && inside; k++) {
+			const float *plane = &planes[4*k];
+			if(plane[0]*centerx[i] + plane[1]*centery[i] + plane[2]*centerz[i] + plane[3]
+			   < -radii[i]) {
+				inside = false;
+			}
+		}
+		visibleflags[i] = inside;
+		nvisible += inside;
+	}
+	return nvisible;
+}
+
+
+/* Whether object i may be visible, after cull() */
+bool FrustumCuller::visible(int i) {
+	return i >= 0 && i < (int)visibleflags.size() && visibleflags[i];
+}
+
+
+/* Render the visible objects, each with V*M in the uniform at 'mvlocation' */
+int FrustumCuller::renderVisible(GLint mvlocation) {
+
+	float MV[16];
+	int drawn = 0;
+
+	for(size_t i=0; i<visibleflags.size(); i++) {
+		if(!visibleflags[i] || !meshes[i]) continue;
+		Utilities::mat4mult(V, &matrices[16*i], MV);
+		glUniformMatrix4fv(mvlocation, 1, GL_FALSE, MV);
+		meshes[i]->render();
+		drawn++;
+	}
+	return drawn;
+}
+
+
+/* Number of objects found visible and culled by the last cull() */
+int FrustumCuller::visibleCount() {
+	return nvisible;
+}
+
+int FrustumCuller::culledCount() {
+	return (int)visibleflags.size() - nvisible;
+}
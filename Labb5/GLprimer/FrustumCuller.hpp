@@ -0,0 +1,74 @@
+/* FrustumCuller.hpp */
+/*
+ * View frustum culling of whole objects by their bounding spheres.
+ * Usage: call begin() once per frame with the projection matrix P and
+ * the view matrix V, add() each object with its mesh and model matrix M,
+ * then cull() to test them all, and renderVisible() to draw the ones
+ * that may be in view (or check visible() and draw them yourself).
+ * The frustum planes are taken from P*V, so the bounding spheres are
+ * tested in world space, the space that V transforms from. cull() tests
+ * four spheres at a time against each plane with SSE, which makes the
+ * test cost next to nothing even for tens of thousands of objects.
+ * The counts of visible and culled objects are kept for each frame.
+ * This code is in the public domain.
+ */
+
+#ifndef FRUSTUMCULLER_HPP // Avoid including this header twice
+#define FRUSTUMCULLER_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h> // To use OpenGL datatypes
+#include <vector>       // For the objects of a frame
+
+class TriangleSoup;
+
+class FrustumCuller {
+
+public:
+
+/* Constructor: start with an empty frame */
+FrustumCuller();
+
+/* Start a new frame with the view frustum of P*V, and forget the
+ * objects of the last frame */
+void begin(float P[], float V[]);
+
+/* Add an object with the model matrix M. Returns its index. */
+int add(TriangleSoup *mesh, float M[]);
+
+/* Add a bounding sphere in world space, with no mesh to render */
+int addSphere(const float center[3], float radius);
+
+/* Test all objects against the frustum. Returns the number visible. */
+int cull();
+
+/* Whether object i may be visible, after cull() */
+bool visible(int i);
+
+/* Render the visible objects, each with V*M in the uniform mat4
+ * at 'mvlocation' of the shader in use. Returns the number drawn. */
+int renderVisible(GLint mvlocation);
+
+/* Number of objects found visible and culled by the last cull() */
+int visibleCount();
+int culledCount();
+
+private:
+
+float V[16];                      // View matrix of the frame
+float planes[24];                 // Frustum planes of P*V, normalized
+std::vector<TriangleSoup*> meshes; // Mesh of each object, or NULL
+std::vector<float> matrices;      // Model matrix of each object, 16 floats each
+std::vector<float> centerx;       // World space bounding spheres, as
+std::vector<float> centery;       // separate arrays to load four at
+std::vector<float> centerz;       // a time into SSE registers
+std::vector<float> radii;
+std::vector<unsigned char> visibleflags;
+int nvisible;
+
+};
+
+#endif // FRUSTUMCULLER_HPP
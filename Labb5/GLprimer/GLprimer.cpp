@@ -23,6 +23,8 @@
 #include "Shader.hpp"
 #include "Utilities.hpp"
 #include "TriangleSoup.hpp"
+#include "GeometryRegistry.hpp"
+#include "Scene.hpp"
 #include "Texture.hpp"
 
 
@@ -59,8 +61,8 @@ int main(int argc, char *argv[])
 
     Shader myShader;
 
-    TriangleSoup mySphere;
-    TriangleSoup myMoon;
+    TriangleSoup *mySphere; // Shared unit spheres, scaled in MV
+    TriangleSoup *myMoon;
     TriangleSoup myCube;
     TriangleSoup myTrex;
 
@@ -71,6 +73,10 @@ int main(int argc, char *argv[])
     KeyRotator keyrot;
     MouseRotator mouserot;
 
+    Scene myScene; // Culls and draws the objects each frame
+    int earthobject;
+    int trexobject;
+
     GLint location_earth;
     GLint location_moon;
     GLint location_tex;
@@ -78,6 +84,8 @@ int main(int argc, char *argv[])
     GLfloat MV[16];
     GLint location_MV;
 
+    GLfloat V[16]; // Identity, the objects are placed in view space
+
     GLfloat P[16];
     GLint location_P;
 
@@ -121,9 +129,10 @@ int main(int argc, char *argv[])
     Utilities::loadExtensions();
 
     myShader.createShader("vertex.glsl", "fragment.glsl");
-    mySphere.createSphere(0.5, 50);
-    myMoon.createSphere(0.2, 50);
+    mySphere = GeometryRegistry::acquireSphere(50);
+    myMoon = GeometryRegistry::acquireSphere(50); // The same mesh as mySphere
     myTrex.readOBJ("meshes/trex.obj");
+    myTrex.buildLODs();
 
     // Show some useful information on the GL context
     cout << "GL vendor:       " << glGetString(GL_VENDOR) << endl;
@@ -165,6 +174,12 @@ int main(int argc, char *argv[])
     myMoontex.createTexture("textures/moon.tga");
     myTexture.createTexture("textures/trex.tga");
 
+    // The objects are moved every frame, so any matrix will do here
+    Utilities::mat4identity(MV);
+    Utilities::mat4identity(V);
+    earthobject = myScene.addObject(mySphere, MV, myEarth.texID);
+    trexobject = myScene.addObject(&myTrex, MV, myTexture.texID);
+
     keyrot.init(window);
     mouserot.init(window);
 
@@ -190,7 +205,7 @@ int main(int argc, char *argv[])
 
         /* ---- Rendering code should go here ---- */
         time = (float)glfwGetTime();
-        glUseProgram(myShader.programID);
+        TriangleSoup::useProgram(myShader.programID);
         glUniform1f(location_time, time);
 
 
@@ -198,6 +213,9 @@ int main(int argc, char *argv[])
 /*
         Utilities::mat4identity(MV);
 
+        Utilities::mat4scale(R, 0.2); // Moon radius
+        Utilities::mat4mult(R, MV, MV);
+
         Utilities::mat4roty(R, mouserot.phi);
         Utilities::mat4mult(R, MV, MV);
 
@@ -223,7 +241,7 @@ int main(int argc, char *argv[])
 
         glBindTexture(GL_TEXTURE_2D, myMoontex.texID);
         glUniform1i(location_moon, 0);
-        myMoon.render();
+        myMoon->render();
 
 
         Utilities::mat4identity(MV);
@@ -254,7 +272,7 @@ int main(int argc, char *argv[])
 
         glBindTexture(GL_TEXTURE_2D, myEarth.texID);
         glUniform1i(location_earth, 0);
-        mySphere.render();
+        mySphere->render();
 
 
         //Utilities::mat4perspective(P, pi/3, 1.0, 0.1, 100.0);
@@ -269,6 +287,8 @@ int main(int argc, char *argv[])
         Utilities::mat4identity(MV);
         Utilities::mat4perspective(P, pi/3, 1.0, 0.1, 100.0);
 
+        Utilities::mat4scale(R, 0.5); // Earth radius
+        Utilities::mat4mult(R, MV, MV);
 
         Utilities::mat4roty(R, keyrot.phi);
         Utilities::mat4mult(R, MV, MV);
@@ -292,13 +312,7 @@ int main(int argc, char *argv[])
         //Utilities::mat4translate(T, 0.0, 1.0, 0.0);
         Utilities::mat4roty(T, time*pi/4);
 
-        glUniformMatrix4fv(location_T, 1, GL_FALSE, T);
-        glUniformMatrix4fv(location_P, 1, GL_FALSE, P);
-        glUniformMatrix4fv(location_MV, 1, GL_FALSE, MV);
-
-        glBindTexture(GL_TEXTURE_2D, myEarth.texID);
-        glUniform1i(location_earth, 0);
-        mySphere.render();
+        myScene.setTransform(earthobject, MV);
 
         /* ---- T-rex ----- */
 
@@ -320,17 +334,19 @@ int main(int argc, char *argv[])
         Utilities::mat4translate(R, 0, 0.3 ,-3.0);
         Utilities::mat4mult(R, MV, MV);
 
-        Utilities::mat4perspective(P, pi/3, 1.0, 0.1, 100.0);
-        glUniformMatrix4fv(location_T, 1, GL_FALSE, T);
-//        glUniformMatrix4fv(location_P, 1, GL_FALSE, P);
-        glUniformMatrix4fv(location_MV, 1, GL_FALSE, MV);
+        myScene.setTransform(trexobject, MV);
 
-        glBindTexture(GL_TEXTURE_2D, myTexture.texID);
+        /* ---- Draw the objects in view ----- */
+
+        glUniformMatrix4fv(location_T, 1, GL_FALSE, T);
+        glUniformMatrix4fv(location_P, 1, GL_FALSE, P);
+        glUniform1i(location_earth, 0);
         glUniform1i(location_tex, 0);
-        myTrex.render();
+        myScene.cull(P, V);
+        myScene.render(location_MV, P, height, 1.0f); // At most one pixel of error
 
         glBindTexture(GL_TEXTURE_2D, 0);
-        glUseProgram(0);
+        TriangleSoup::useProgram(0);
 
 
         // Swap buffers, i.e. display the image and prepare for next frame.
@@ -347,6 +363,10 @@ int main(int argc, char *argv[])
 
     }
 
+    // Release the shared meshes while the OpenGL context still exists
+    GeometryRegistry::release(mySphere);
+    GeometryRegistry::release(myMoon);
+
     // Close the OpenGL window and terminate GLFW.
     glfwDestroyWindow(window);
     glfwTerminate();
@@ -0,0 +1,85 @@
+/* GeometryRegistry.cpp */
+/*
+ * Shared, reference counted procedural geometry.
+ * See GeometryRegistry.hpp for a description of each function.
+ * This code is in the public domain.
+ */
+
+#include <map> // For the registry itself
+
+#include "GeometryRegistry.hpp"
+#include "TriangleSoup.hpp"
+#include "Utilities.hpp"
+
+/* What a mesh was created from */
+struct GeometryKey {
+	int generator;  // GENERATOR_SPHERE or GENERATOR_BOX
+	int segments;   // Tessellation (0 for a box)
+	bool operator<(const GeometryKey &other) const {
+		if(generator != other.generator) return generator < other.generator;
+		return segments < other.segments;
+	}
+};
+
+struct GeometryEntry {
+	TriangleSoup *soup;
+	int users;
+};
+
+enum { GENERATOR_SPHERE, GENERATOR_BOX };
+
+static std::map<GeometryKey, GeometryEntry> registry;
+
+/*
+ * Find a mesh in the registry and count one more user, or create it.
+ */
+static TriangleSoup *acquire(int generator, int segments) {
+
+	GeometryKey key = {generator, segments};
+	std::map<GeometryKey, GeometryEntry>::iterator it = registry.find(key);
+	GeometryEntry entry;
+
+	if(it != registry.end()) {
+		it->second.users++;
+		return it->second.soup;
+	}
+
+	entry.soup = new TriangleSoup();
+	entry.users = 1;
+	if(generator == GENERATOR_SPHERE) {
+		entry.soup->createSphere(1.0f, segments);
+	}
+	else {
+		entry.soup->createBox(1.0f, 1.0f, 1.0f);
+	}
+	registry[key] = entry;
+	return entry.soup;
+}
+
+TriangleSoup *GeometryRegistry::acquireSphere(int segments) {
+	return acquire(GENERATOR_SPHERE, segments);
+}
+
+TriangleSoup *GeometryRegistry::acquireBox() {
+	return acquire(GENERATOR_BOX, 0);
+}
+
+void GeometryRegistry::release(TriangleSoup *soup) {
+
+	std::map<GeometryKey, GeometryEntry>::iterator it;
+
+	for(it = registry.begin(); it != registry.end(); ++it) {
+		if(it->second.soup == soup) {
+			if(--it->second.users == 0) {
+				delete it->second.soup;
+				registry.erase(it);
+			}
+			return;
+		}
+	}
+	Utilities::printError("GeometryRegistry::release()", "The mesh is not from the registry.");
+}
+
+int GeometryRegistry::meshCount() {
+	return (int)registry.size();
+}
@@ -0,0 +1,49 @@
+/* GeometryRegistry.hpp */
+/*
+ * Shared, reference counted procedural geometry.
+ * Spheres and boxes that differ only in size have the same topology,
+ * so the registry keeps one TriangleSoup for each generator and
+ * tessellation, with the size normalized to 1. Put the actual size
+ * into the modelview matrix instead, with Utilities::mat4scale().
+ * Usage: get a mesh with acquireSphere() or acquireBox(), render it
+ * as many times as needed, and call release() once for each acquire.
+ * The last release() deletes the mesh, so an OpenGL context must
+ * still be current at that time.
+ * This code is in the public domain.
+ */
+
+#ifndef GEOMETRYREGISTRY_HPP // Avoid including this header twice
+#define GEOMETRYREGISTRY_HPP
+
+class TriangleSoup;
+
+namespace GeometryRegistry {
+
+/*
+ * acquireSphere() - Get a shared sphere of radius 1, the same as
+ * createSphere(1.0, segments). For radius r, scale MV by r.
+ */
+TriangleSoup *acquireSphere(int segments);
+
+/*
+ * acquireBox() - Get a shared box from -1 to 1 along each axis, the same
+ * as createBox(1.0, 1.0, 1.0). For createBox(x, y, z), scale MV by
+ * (x, y, z). The box normals are along the axes, so they stay correct
+ * even with a non-uniform scaling.
+ */
+TriangleSoup *acquireBox();
+
+/*
+ * release() - Give back a mesh from acquireSphere() or acquireBox().
+ * The mesh is deleted when the last user has released it.
+ */
+void release(TriangleSoup *soup);
+
+/*
+ * meshCount() - The number of distinct meshes currently in use.
+ */
+int meshCount();
+
+}
+
+#endif // GEOMETRYREGISTRY_HPP
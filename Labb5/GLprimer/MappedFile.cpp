@@ -0,0 +1,165 @@
+/* MappedFile.cpp */
+/*
+ * Read-only memory mapping of a whole file.
+ * Windows uses CreateFileMapping()/MapViewOfFile(),
+ * other platforms use POSIX mmap().
+ * This code is in the public domain.
+ */
+
+#include "MappedFile.hpp"
+
+#ifdef __WIN32__
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+/* Constructor: create an empty mapping */
+MappedFile::MappedFile() {
+	data = NULL;
+	size = 0;
+#ifdef __WIN32__
+	filehandle = INVALID_HANDLE_VALUE;
+	maphandle = NULL;
+#else
+	fd = -1;
+#endif
+}
+
+
+/* Destructor: release the mapping, if any */
+MappedFile::~MappedFile() {
+	close();
+}
+
+
+/*
+ * open(const char *filename, bool copyonwrite)
+ *
+ * Map the named file read-only, or copy-on-write if requested.
+ * An empty file is opened successfully, but yields data = NULL
+ * and size = 0.
+ */
+bool MappedFile::open(const char *filename, bool copyonwrite) {
+
+	close(); // Release any previous mapping
+
+#ifdef __WIN32__
+	LARGE_INTEGER filesize;
+
+	filehandle = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+		OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(filehandle == INVALID_HANDLE_VALUE) {
+		return false;
+	}
+	if(!GetFileSizeEx(filehandle, &filesize)) {
+		close();
+		return false;
+	}
+	size = (size_t)filesize.QuadPart;
+	if(size == 0) {
+		return true; // Nothing to map, but not an error
+	}
+	maphandle = CreateFileMappingA(filehandle, NULL,
+		copyonwrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+	if(maphandle == NULL) {
+		close();
+		return false;
+	}
+	data = (const char*)MapViewOfFile(maphandle,
+		copyonwrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+	if(data == NULL) {
+		close();
+		return false;
+	}
+#else
+	struct stat filestat;
+	void *mapping;
+
+	fd = ::open(filename, O_RDONLY);
+	if(fd < 0) {
+		return false;
+	}
+	if(fstat(fd, &filestat) != 0) {
+		close();
+		return false;
+	}
+	size = (size_t)filestat.st_size;
+	if(size == 0) {
+		return true; // Nothing to map, but not an error
+	}
+	mapping = mmap(NULL, size, copyonwrite ? PROT_READ | PROT_WRITE : PROT_READ,
+		MAP_PRIVATE, fd, 0);
+	if(mapping == MAP_FAILED) {
+		close();
+		return false;
+	}
+	// We read the file front to back, so tell the OS to read ahead
+	madvise(mapping, size, MADV_SEQUENTIAL);
+	data = (const char*)mapping;
+#endif
+	return true;
+}
+
+
+/* Release the mapping */
+void MappedFile::close() {
+
+#ifdef __WIN32__
+	if(data) {
+		UnmapViewOfFile(data);
+	}
+	if(maphandle) {
+		CloseHandle(maphandle);
+	}
+	if(filehandle != INVALID_HANDLE_VALUE) {
+		CloseHandle(filehandle);
+	}
+	maphandle = NULL;
+	filehandle = INVALID_HANDLE_VALUE;
+#else
+	if(data) {
+		munmap((void*)data, size);
+	}
+	if(fd >= 0) {
+		::close(fd);
+	}
+	fd = -1;
+#endif
+	data = NULL;
+	size = 0;
+}
+
+
+/*
+ * stat(const char *filename, long long *filesize, long long *mtime)
+ *
+ * Get the size in bytes and the modification time of a file.
+ * The time is in seconds, but the epoch is platform dependent,
+ * so it should only be compared against other values from stat().
+ */
+bool MappedFile::stat(const char *filename, long long *filesize, long long *mtime) {
+
+#ifdef __WIN32__
+	WIN32_FILE_ATTRIBUTE_DATA attributes;
+
+	if(!GetFileAttributesExA(filename, GetFileExInfoStandard, &attributes)) {
+		return false;
+	}
+	*filesize = ((long long)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+	*mtime = (((long long)attributes.ftLastWriteTime.dwHighDateTime << 32)
+		| attributes.ftLastWriteTime.dwLowDateTime) / 10000000; // 100 ns units
+#else
+	struct stat filestat;
+
+	if(::stat(filename, &filestat) != 0) {
+		return false;
+	}
+	*filesize = filestat.st_size;
+	*mtime = filestat.st_mtime;
+#endif
+	return true;
+}
@@ -0,0 +1,57 @@
+/* MappedFile.hpp */
+/*
+ * A small class to map an entire file read-only into memory.
+ * Usage: call open() with a file name, then read the bytes
+ * through the public members data and size. The mapping is
+ * released by close() or by the destructor.
+ * A copy-on-write mapping may also be written to through data.
+ * The changes are private to the process and never reach the file.
+ * Memory mapping avoids copying the file through a stdio buffer,
+ * which matters for large mesh files.
+ * This code is in the public domain.
+ */
+
+#ifndef MAPPEDFILE_HPP // Avoid including this header twice
+#define MAPPEDFILE_HPP
+
+#include <cstddef> // For size_t
+
+class MappedFile {
+
+public:
+
+const char *data; // First byte of the file contents (NULL if nothing is mapped)
+size_t size;      // Number of bytes in the file
+
+/* Constructor: create an empty mapping */
+MappedFile();
+
+/* Destructor: release the mapping, if any */
+~MappedFile();
+
+/* Map the named file. Returns false if the file could not be opened. */
+bool open(const char *filename, bool copyonwrite = false);
+
+/* Release the mapping */
+void close();
+
+/* Get the size and modification time of a file without opening it.
+ * Returns false if the file does not exist. */
+static bool stat(const char *filename, long long *filesize, long long *mtime);
+
+private:
+
+#ifdef __WIN32__
+void *filehandle; // HANDLE from CreateFile()
+void *maphandle;  // HANDLE from CreateFileMapping()
+#else
+int fd;           // File descriptor from open()
+#endif
+
+// A mapping is a unique resource, so copying is not allowed
+MappedFile(const MappedFile&);
+MappedFile& operator=(const MappedFile&);
+
+};
+
+#endif // MAPPEDFILE_HPP
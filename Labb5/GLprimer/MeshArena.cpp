@@ -0,0 +1,384 @@
+/* MeshArena.cpp */
+/*
+ * One shared vertex buffer and index buffer for many meshes.
+ * See MeshArena.hpp for a description of the class.
+ * This code is in the public domain.
+ */
+
+#include <cstdio>  // For printf()
+#include <climits> // For INT_MAX
+
+#include "MeshArena.hpp"
+#include "Utilities.hpp"
+
+MeshArena *MeshArena::bound = NULL;
+
+/*
+ * private
+ * Find the first free range with room for 'count' items, take them
+ * from its start and return their position, or -1 if none has room.
+ */
+int MeshArena::takeRange(std::vector<ArenaRange> &freelist, int count) {
+
+	for(size_t i=0; i<freelist.size(); i++) {
+		if(freelist[i].count >= count) {
+			int first = freelist[i].first;
+			freelist[i].first += count;
+			freelist[i].count -= count;
+			if(freelist[i].count == 0) {
+				freelist.erase(freelist.begin() + i);
+			}
+			return first;
+		}
+	}
+	return -1;
+}
+
+/*
+ * private
+ * Put a range back in a free list, merged with free neighbours.
+ */
+void MeshArena::giveRange(std::vector<ArenaRange> &freelist, int first, int count) {
+
+	size_t i = 0;
+	ArenaRange range = {first, count};
+
+	if(count == 0) return;
+	while(i < freelist.size() && freelist[i].first < first) {
+		i++;
+	}
+	if(i > 0 && freelist[i-1].first + freelist[i-1].count == first) {
+		i--; // Grow the range before instead
+		freelist[i].count += count;
+	}
+	else {
+		freelist.insert(freelist.begin() + i, range);
+	}
+	if(i+1 < freelist.size()
+	   && freelist[i].first + freelist[i].count == freelist[i+1].first) {
+		freelist[i].count += freelist[i+1].count;
+		freelist.erase(freelist.begin() + i + 1);
+	}
+}
+
+/*
+ * private
+ * Free space between the meshes, which compact() would move to the end.
+ */
+int MeshArena::holeSpace(const std::vector<ArenaRange> &freelist, int capacity) {
+
+	int holes = 0;
+
+	for(size_t i=0; i<freelist.size(); i++) {
+		if(freelist[i].first + freelist[i].count != capacity) {
+			holes += freelist[i].count;
+		}
+	}
+	return holes;
+}
+
+
+/* Constructor: set the initial capacity, in vertices and indices */
+MeshArena::MeshArena(int vertexcapacity, int indexcapacity) {
+
+	vao = 0;
+	vertexbuffer = 0;
+	indexbuffer = 0;
+	this->vertexcapacity = (vertexcapacity > 0) ? vertexcapacity : 1;
+	this->indexcapacity = (indexcapacity > 0) ? indexcapacity : 1;
+	vertexused = 0;
+	indexused = 0;
+	compactions = 0;
+}
+
+
+/* Destructor: delete the buffers and the VAO */
+MeshArena::~MeshArena() {
+
+	if(bound == this) {
+		bound = NULL;
+	}
+	if(glIsVertexArray(vao)) {
+		glDeleteVertexArrays(1, &vao);
+	}
+	if(glIsBuffer(vertexbuffer)) {
+		glDeleteBuffers(1, &vertexbuffer);
+	}
+	if(glIsBuffer(indexbuffer)) {
+		glDeleteBuffers(1, &indexbuffer);
+	}
+}
+
+
+/*
+ * allocate(int nverts, int nindices)
+ *
+ * Reserve room for a mesh in the first free ranges that are large
+ * enough. If there are none, the meshes are moved together, and the
+ * buffers are made larger if that is still not enough.
+ */
+int MeshArena::allocate(int nverts, int nindices) {
+
+	ArenaSlot slot;
+	int index;
+
+	if(nverts <= 0 || nindices < 0) {
+		Utilities::printError("MeshArena::allocate()", "Invalid mesh size.");
+		return -1;
+	}
+	if(vao == 0) { // First use, create the buffers
+		rebuild(vertexcapacity, indexcapacity);
+	}
+
+	slot.vertices.first = takeRange(freevertices, nverts);
+	slot.indices.first = takeRange(freeindices, nindices);
+	if(slot.vertices.first < 0 || slot.indices.first < 0) {
+		long long newvertexcapacity = vertexcapacity; // Doubling may pass INT_MAX
+		long long newindexcapacity = indexcapacity;
+
+		// Undo the half that succeeded, then make one free range at the end
+		if(slot.vertices.first >= 0) giveRange(freevertices, slot.vertices.first, nverts);
+		if(slot.indices.first >= 0) giveRange(freeindices, slot.indices.first, nindices);
+		while(newvertexcapacity - vertexused < nverts) newvertexcapacity *= 2;
+		while(newindexcapacity - indexused < nindices) newindexcapacity *= 2;
+		if(newvertexcapacity > INT_MAX || newindexcapacity > INT_MAX) {
+			Utilities::printError("MeshArena::allocate()", "The arena can not grow that large.");
+			return -1;
+		}
+		rebuild((int)newvertexcapacity, (int)newindexcapacity);
+		slot.vertices.first = takeRange(freevertices, nverts);
+		slot.indices.first = takeRange(freeindices, nindices);
+	}
+	slot.vertices.count = nverts;
+	slot.indices.count = nindices;
+	slot.used = true;
+	vertexused += nverts;
+	indexused += nindices;
+
+	if(freeslots.empty()) {
+		index = (int)slots.size();
+		slots.push_back(slot);
+	}
+	else {
+		index = freeslots.back();
+		freeslots.pop_back();
+		slots[index] = slot;
+	}
+	return index;
+}
+
+
+/*
+ * release(int slot)
+ *
+ * Give back the room of a mesh. If more than half as much space as the
+ * meshes use is then lost in holes between them, compact the buffers.
+ */
+void MeshArena::release(int slot) {
+
+	if(!validSlot(slot)) {
+		Utilities::printError("MeshArena::release()", "Invalid slot.");
+		return;
+	}
+	ArenaSlot &s = slots[slot];
+	giveRange(freevertices, s.vertices.first, s.vertices.count);
+	giveRange(freeindices, s.indices.first, s.indices.count);
+	vertexused -= s.vertices.count;
+	indexused -= s.indices.count;
+	s.used = false;
+	freeslots.push_back(slot);
+
+	if(2*holeSpace(freevertices, vertexcapacity) > vertexused
+	   || 2*holeSpace(freeindices, indexcapacity) > indexused) {
+		compact();
+	}
+}
+
+
+/* Send 'count' vertices from 'first' (8 floats each) to a slot */
+void MeshArena::sendVertices(int slot, int first, int count, const GLfloat *vertices) {
+
+	if(!validSlot(slot) || first < 0 || count < 0
+	   || first + count > slots[slot].vertices.count) {
+		Utilities::printError("MeshArena::sendVertices()", "Vertex range out of bounds.");
+		return;
+	}
+	// GL_COPY_WRITE_BUFFER is not part of any VAO state, so whatever
+	// VAO happens to be bound is not disturbed
+	glBindBuffer(GL_COPY_WRITE_BUFFER, vertexbuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER,
+		(size_t)(slots[slot].vertices.first + first)*8*sizeof(GLfloat),
+		(size_t)count*8*sizeof(GLfloat), vertices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+
+/* Send 'count' indices from 'first', relative to the first vertex, to a slot */
+void MeshArena::sendIndices(int slot, int first, int count, const GLuint *indices) {
+
+	if(!validSlot(slot) || first < 0 || count < 0
+	   || first + count > slots[slot].indices.count) {
+		Utilities::printError("MeshArena::sendIndices()", "Index range out of bounds.");
+		return;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, indexbuffer);
+	glBufferSubData(GL_COPY_WRITE_BUFFER,
+		(size_t)(slots[slot].indices.first + first)*sizeof(GLuint),
+		(size_t)count*sizeof(GLuint), indices);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+
+/* Move all meshes together, to leave all free space at the end */
+void MeshArena::compact() {
+
+	if(vao == 0) return;
+	rebuild(vertexcapacity, indexcapacity);
+}
+
+
+/* Bind the VAO of the arena, unless it is already bound */
+void MeshArena::bind() {
+
+	if(bound != this) {
+		glBindVertexArray(vao);
+		bound = this;
+	}
+}
+
+
+/* Unbind any VAO */
+void MeshArena::unbind() {
+
+	glBindVertexArray(0);
+	bound = NULL;
+}
+
+
+/* Number of vertices and indices in a slot */
+int MeshArena::vertexCount(int slot) {
+	return validSlot(slot) ? slots[slot].vertices.count : 0;
+}
+
+int MeshArena::indexCount(int slot) {
+	return validSlot(slot) ? slots[slot].indices.count : 0;
+}
+
+
+/* Base vertex for glDrawElementsBaseVertex() */
+GLint MeshArena::baseVertex(int slot) {
+	return slots[slot].vertices.first;
+}
+
+
+/* Byte offset of the first index of a slot in the index buffer */
+size_t MeshArena::indexOffset(int slot) {
+	return (size_t)slots[slot].indices.first*sizeof(GLuint);
+}
+
+
+/* Print the use of the buffers */
+void MeshArena::printInfo() {
+
+	printf("MeshArena information:\n");
+	printf("meshes  : %d\n", (int)(slots.size() - freeslots.size()));
+	printf("vertices: %d of %d used (%.1f KB buffer), %d free ranges\n",
+		vertexused, vertexcapacity, vertexcapacity*8*sizeof(GLfloat)/1024.0,
+		(int)freevertices.size());
+	printf("indices : %d of %d used (%.1f KB buffer), %d free ranges\n",
+		indexused, indexcapacity, indexcapacity*sizeof(GLuint)/1024.0,
+		(int)freeindices.size());
+	printf("compacted %d times\n", compactions);
+}
+
+
+/*
+ * private
+ * rebuild() - Create new buffers of the given capacity, copy all
+ * meshes into them without holes, using glCopyBufferSubData() so the
+ * data never leaves the GPU, and point the VAO to the new buffers.
+ */
+void MeshArena::rebuild(int newvertexcapacity, int newindexcapacity) {
+
+	GLuint newvertexbuffer, newindexbuffer;
+	int nextvertex = 0, nextindex = 0;
+	ArenaRange range;
+
+	if(vao == 0) {
+		glGenVertexArrays(1, &vao);
+	}
+	glGenBuffers(1, &newvertexbuffer);
+	glGenBuffers(1, &newindexbuffer);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newvertexbuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, (size_t)newvertexcapacity*8*sizeof(GLfloat),
+		NULL, GL_STATIC_DRAW);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, newindexbuffer);
+	glBufferData(GL_COPY_WRITE_BUFFER, (size_t)newindexcapacity*sizeof(GLuint),
+		NULL, GL_STATIC_DRAW);
+
+	if(vertexbuffer) {
+		glBindBuffer(GL_COPY_READ_BUFFER, vertexbuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newvertexbuffer);
+		for(size_t i=0; i<slots.size(); i++) {
+			if(!slots[i].used) continue;
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				(size_t)slots[i].vertices.first*8*sizeof(GLfloat),
+				(size_t)nextvertex*8*sizeof(GLfloat),
+				(size_t)slots[i].vertices.count*8*sizeof(GLfloat));
+			slots[i].vertices.first = nextvertex;
+			nextvertex += slots[i].vertices.count;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, indexbuffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, newindexbuffer);
+		for(size_t i=0; i<slots.size(); i++) {
+			if(!slots[i].used) continue;
+			glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER,
+				(size_t)slots[i].indices.first*sizeof(GLuint),
+				(size_t)nextindex*sizeof(GLuint),
+				(size_t)slots[i].indices.count*sizeof(GLuint));
+			slots[i].indices.first = nextindex;
+			nextindex += slots[i].indices.count;
+		}
+		glBindBuffer(GL_COPY_READ_BUFFER, 0);
+		glDeleteBuffers(1, &vertexbuffer);
+		glDeleteBuffers(1, &indexbuffer);
+		compactions++;
+	}
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+	vertexbuffer = newvertexbuffer;
+	indexbuffer = newindexbuffer;
+	vertexcapacity = newvertexcapacity;
+	indexcapacity = newindexcapacity;
+
+	freevertices.clear();
+	freeindices.clear();
+	range.first = nextvertex;
+	range.count = vertexcapacity - nextvertex;
+	if(range.count > 0) freevertices.push_back(range);
+	range.first = nextindex;
+	range.count = indexcapacity - nextindex;
+	if(range.count > 0) freeindices.push_back(range);
+
+	// Point the VAO to the new buffers, with the same
+	// attribute layout as TriangleSoup uses for VERTEX_FLOAT
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
+		8*sizeof(GLfloat), (void*)0); // xyz coordinates
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
+		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
+		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+	unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+
+/* Check that a slot number refers to a mesh in the arena */
+bool MeshArena::validSlot(int slot) {
+	return slot >= 0 && slot < (int)slots.size() && slots[slot].used;
+}
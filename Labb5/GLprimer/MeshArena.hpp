@@ -0,0 +1,122 @@
+/* MeshArena.hpp */
+/*
+ * One shared vertex buffer and index buffer for many meshes.
+ * Every TriangleSoup normally has a VAO and two buffers of its own,
+ * so each render() binds a new VAO. Meshes that are put in an arena
+ * with TriangleSoup::setArena() are instead stored as ranges of a few
+ * large buffers with a single VAO, and drawn with
+ * glDrawElementsBaseVertex(), so a whole scene of them can be drawn
+ * with the VAO bound only once. The arena uses the standard layout of
+ * 8 floats per vertex (position, normal, texcoords) and 32-bit indices
+ * that are relative to the first vertex of each mesh.
+ * Free space is kept in sorted lists of ranges. When a mesh is removed,
+ * its ranges are merged with their free neighbours, and when too much
+ * of the free space is in holes between the meshes, the remaining
+ * meshes are moved together on the GPU. The buffers grow as needed.
+ * The OpenGL objects are created on the first allocate(), and the
+ * arena must outlive the meshes that are in it.
+ * This code is in the public domain.
+ */
+
+#ifndef MESHARENA_HPP // Avoid including this header twice
+#define MESHARENA_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h> // To use OpenGL datatypes
+#include <vector>       // For the free lists and the slots
+
+class MeshArena {
+
+public:
+
+/* Constructor: set the initial capacity, in vertices and indices */
+MeshArena(int vertexcapacity = 1 << 18, int indexcapacity = 3 << 18);
+
+/* Destructor: delete the buffers and the VAO */
+~MeshArena();
+
+/* Reserve room for a mesh. Returns a slot number, or -1 on failure. */
+int allocate(int nverts, int nindices);
+
+/* Give back the room of a mesh, and compact the buffers if needed */
+void release(int slot);
+
+/* Send 'count' vertices from 'first' (8 floats each) to a slot */
+void sendVertices(int slot, int first, int count, const GLfloat *vertices);
+
+/* Send 'count' indices from 'first', relative to the first vertex, to a slot */
+void sendIndices(int slot, int first, int count, const GLuint *indices);
+
+/* Move all meshes together, to leave all free space at the end */
+void compact();
+
+/* Bind the VAO of the arena, unless it is already bound */
+void bind();
+
+/* Unbind any VAO. Code that binds a VAO of its own while an arena
+ * may be bound should call this afterwards. */
+static void unbind();
+
+/* Number of vertices and indices in a slot */
+int vertexCount(int slot);
+int indexCount(int slot);
+
+/* Base vertex for glDrawElementsBaseVertex() */
+GLint baseVertex(int slot);
+
+/* Byte offset of the first index of a slot in the index buffer */
+size_t indexOffset(int slot);
+
+/* Print the use of the buffers */
+void printInfo();
+
+private:
+
+/* A range of vertices or indices */
+struct ArenaRange {
+	int first;
+	int count;
+};
+
+/* The ranges of one mesh */
+struct ArenaSlot {
+	ArenaRange vertices;
+	ArenaRange indices;
+	bool used;
+};
+
+GLuint vao;          // Shared by all meshes in the arena
+GLuint vertexbuffer; // 8 floats per vertex
+GLuint indexbuffer;  // GLuint indices, relative to the first vertex of each mesh
+int vertexcapacity;
+int indexcapacity;
+int vertexused;
+int indexused;
+int compactions;     // Times the meshes were moved, for printInfo()
+std::vector<ArenaRange> freevertices; // Sorted by first, never adjacent
+std::vector<ArenaRange> freeindices;
+std::vector<ArenaSlot> slots;
+std::vector<int> freeslots;
+
+static MeshArena *bound; // Arena whose VAO is bound, if any
+
+void rebuild(int newvertexcapacity, int newindexcapacity);
+
+static int takeRange(std::vector<ArenaRange> &freelist, int count);
+
+static void giveRange(std::vector<ArenaRange> &freelist, int first, int count);
+
+static int holeSpace(const std::vector<ArenaRange> &freelist, int capacity);
+
+bool validSlot(int slot);
+
+// The buffers are a unique resource, so copying is not allowed
+MeshArena(const MeshArena&);
+MeshArena& operator=(const MeshArena&);
+
+};
+
+#endif // MESHARENA_HPP
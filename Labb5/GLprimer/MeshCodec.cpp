@@ -0,0 +1,618 @@
+/* MeshCodec.cpp */
+/*
+ * Compression of indexed triangle meshes for storage on disk.
+ * See MeshCodec.hpp for a description of each function.
+ * This code is in the public domain.
+ */
+
+#include <cmath>   // For fabsf(), floorf() and sqrtf()
+#include <cstring> // For memcpy()
+#include <cstdint> // For uint32_t and uint64_t
+
+#include "MeshCodec.hpp"
+
+/*
+ * Helpers for the vertex stream
+ */
+
+/*
+ * octEncode() - Project onto the octahedron |x|+|y|+|z| = 1 and fold
+ * the lower half (z < 0) over the diagonals.
+ */
+void MeshCodec::octEncode(const float *n, float *uv) {
+	float len = fabsf(n[0]) + fabsf(n[1]) + fabsf(n[2]);
+	float x, y;
+
+	if(len == 0.0f) { // Degenerate normal, store something valid
+		uv[0] = uv[1] = 0.0f;
+		return;
+	}
+	x = n[0] / len;
+	y = n[1] / len;
+	if(n[2] < 0.0f) {
+		float fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+		float fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+		x = fx;
+		y = fy;
+	}
+	uv[0] = x;
+	uv[1] = y;
+}
+
+/* Map v in [vmin, vmax] to an integer in [0, 2^bits-1] */
+static uint32_t quantize(float v, float vmin, float vmax, int bits) {
+	uint32_t maxq = (1u << bits) - 1;
+	float t = (vmax > vmin) ? (v - vmin) / (vmax - vmin) : 0.0f;
+	if(!(t > 0.0f)) return 0; // Also catches NaN
+	if(t >= 1.0f) return maxq;
+	return (uint32_t)(t * maxq + 0.5f);
+}
+
+static bool validBits(int bits) {
+	return bits >= 1 && bits <= 24;
+}
+
+/* Bits per vertex in the vertex stream */
+static size_t vertexBits(const MeshCodec::Quantization &q) {
+	return 3*q.positionbits + 2*q.normalbits + 2*q.texcoordbits;
+}
+
+/* Read 'bits' bits (at most 57) from bit position 'bit' */
+static inline uint32_t readBits(const unsigned char *data, size_t bit, uint32_t mask) {
+	uint64_t word;
+	memcpy(&word, data + (bit >> 3), 8);
+	return (uint32_t)(word >> (bit & 7)) & mask;
+}
+
+
+/*
+ * findRanges() - Bounding box of the positions and the texture coordinates.
+ */
+void MeshCodec::findRanges(const float *vertices, size_t nverts, Quantization *q) {
+
+	for(int k=0; k<3; k++) {
+		q->posmin[k] = q->posmax[k] = (nverts > 0) ? vertices[k] : 0.0f;
+	}
+	for(int k=0; k<2; k++) {
+		q->texmin[k] = q->texmax[k] = (nverts > 0) ? vertices[6+k] : 0.0f;
+	}
+	for(size_t i=1; i<nverts; i++) {
+		const float *v = &vertices[8*i];
+		for(int k=0; k<3; k++) {
+			if(v[k] < q->posmin[k]) q->posmin[k] = v[k];
+			if(v[k] > q->posmax[k]) q->posmax[k] = v[k];
+		}
+		for(int k=0; k<2; k++) {
+			if(v[6+k] < q->texmin[k]) q->texmin[k] = v[6+k];
+			if(v[6+k] > q->texmax[k]) q->texmax[k] = v[6+k];
+		}
+	}
+}
+
+
+/*
+ * encodeIndices() - Zigzag coded differences in 1 to 4 bytes each.
+ * Control byte j holds the lengths minus one of differences 4j to 4j+3,
+ * two bits each, starting with the lowest bits. A last group with fewer
+ * than four indices has zero bits for the missing ones.
+ */
+size_t MeshCodec::encodeIndices(const unsigned int *indices, size_t count,
+	std::vector<unsigned char> &out) {
+
+	size_t start = out.size();
+	size_t ncontrol = (count + 3) / 4;
+	size_t control = start;
+	unsigned int previous = 0;
+
+	out.resize(start + ncontrol, 0);
+	for(size_t i=0; i<count; i++) {
+		uint32_t delta = indices[i] - previous;
+		uint32_t zigzag = (delta << 1) ^ (uint32_t)((int32_t)delta >> 31);
+		int length = (zigzag < (1u << 8)) ? 1 : (zigzag < (1u << 16)) ? 2 : (zigzag < (1u << 24)) ? 3 : 4;
+		out[control + i/4] |= (unsigned char)((length - 1) << (2*(i & 3)));
+		for(int b=0; b<length; b++) {
+			out.push_back((unsigned char)(zigzag >> (8*b)));
+		}
+		previous = indices[i];
+	}
+	out.insert(out.end(), 3, 0); // Padding for the four byte loads of the decoder
+	return out.size() - start;
+}
+
+
+/*
+ * For each control byte, the byte offsets and masks of the four
+ * differences in a group, and the length of the whole group.
+ */
+struct IndexGroup {
+	uint32_t mask[4];
+	unsigned char offset[4];
+	unsigned char length;
+};
+
+struct IndexGroupTable {
+	IndexGroup group[256];
+	IndexGroupTable() {
+		for(int c=0; c<256; c++) {
+			int offset = 0;
+			for(int k=0; k<4; k++) {
+				int length = ((c >> (2*k)) & 3) + 1;
+				group[c].mask[k] = (uint32_t)(0xffffffffull >> (32 - 8*length));
+				group[c].offset[k] = offset;
+				offset += length;
+			}
+			group[c].length = offset;
+		}
+	}
+};
+
+static const IndexGroupTable indexgroups;
+
+/* Undo the zigzag coding of a difference */
+static inline uint32_t unzigzag(uint32_t zigzag) {
+	return (zigzag >> 1) ^ (0 - (zigzag & 1));
+}
+
+
+/*
+ * decodeIndices() - Each difference is read with one unaligned four byte
+ * load and a mask, at offsets from a table, so the four loads of a group
+ * do not wait for each other and the loop has no branches on the lengths.
+ * The size of the data is checked from the control bytes before anything
+ * is read.
+ */
+bool MeshCodec::decodeIndices(const unsigned char *data, size_t size, unsigned int *indices,
+	size_t count, unsigned int nverts) {
+
+	size_t ncontrol = (count + 3) / 4;
+	size_t needed = 0;
+	const unsigned char *control = data;
+	const unsigned char *p;
+	uint32_t previous = 0;
+	uint32_t largest = 0;
+	size_t i;
+
+	if(size < ncontrol + 3) return false;
+	for(i=0; i<ncontrol; i++) {
+		needed += indexgroups.group[control[i]].length;
+	}
+	if(count % 4) needed -= 4 - count % 4; // The missing ones count as one byte
+	if(needed > size - ncontrol - 3) return false;
+
+	p = data + ncontrol;
+	for(i=0; i+4<=count; i+=4) {
+		const IndexGroup &group = indexgroups.group[*control++];
+		uint32_t z0, z1, z2, z3;
+		memcpy(&z0, p + group.offset[0], 4);
+		memcpy(&z1, p + group.offset[1], 4);
+		memcpy(&z2, p + group.offset[2], 4);
+		memcpy(&z3, p + group.offset[3], 4);
+		p += group.length;
+		uint32_t i0 = previous + unzigzag(z0 & group.mask[0]);
+		uint32_t i1 = i0 + unzigzag(z1 & group.mask[1]);
+		uint32_t i2 = i1 + unzigzag(z2 & group.mask[2]);
+		uint32_t i3 = i2 + unzigzag(z3 & group.mask[3]);
+		indices[i] = i0;
+		indices[i+1] = i1;
+		indices[i+2] = i2;
+		indices[i+3] = i3;
+		previous = i3;
+		uint32_t m01 = (i0 > i1) ? i0 : i1;
+		uint32_t m23 = (i2 > i3) ? i2 : i3;
+		uint32_t m = (m01 > m23) ? m01 : m23;
+		largest = (m > largest) ? m : largest;
+	}
+	for(; i<count; i++) { // The last group, with fewer than four
+		const IndexGroup &group = indexgroups.group[*control];
+		uint32_t zigzag;
+		memcpy(&zigzag, p + group.offset[i & 3], 4);
+		previous += unzigzag(zigzag & group.mask[i & 3]);
+		indices[i] = previous;
+		largest = (previous > largest) ? previous : largest;
+	}
+	return count == 0 || largest < nverts;
+}
+
+
+/* Size of the output of encodeVertices() */
+unsigned long long MeshCodec::vertexStreamBytes(size_t nverts, const Quantization &q) {
+	return ((unsigned long long)nverts*vertexBits(q) + 7) / 8 + 8;
+}
+
+
+/*
+ * encodeVertices() - The fields of each vertex are x y z, the two
+ * octahedral normal coordinates and s t, packed from the lowest bit
+ * of each byte and up, with no padding between vertices.
+ */
+void MeshCodec::encodeVertices(const float *vertices, size_t nverts, const Quantization &q,
+	std::vector<unsigned char> &out) {
+
+	size_t start = out.size();
+	uint64_t buffer = 0;
+	int nbits = 0;
+
+	if(!validBits(q.positionbits) || !validBits(q.normalbits) || !validBits(q.texcoordbits)) {
+		return;
+	}
+	out.reserve(start + (size_t)vertexStreamBytes(nverts, q));
+
+	for(size_t i=0; i<nverts; i++) {
+		const float *v = &vertices[8*i];
+		uint32_t fields[7];
+		int sizes[7];
+		float uv[2];
+
+		for(int k=0; k<3; k++) {
+			fields[k] = quantize(v[k], q.posmin[k], q.posmax[k], q.positionbits);
+			sizes[k] = q.positionbits;
+		}
+		octEncode(&v[3], uv);
+		for(int k=0; k<2; k++) {
+			fields[3+k] = quantize(uv[k], -1.0f, 1.0f, q.normalbits);
+			sizes[3+k] = q.normalbits;
+		}
+		for(int k=0; k<2; k++) {
+			fields[5+k] = quantize(v[6+k], q.texmin[k], q.texmax[k], q.texcoordbits);
+			sizes[5+k] = q.texcoordbits;
+		}
+		for(int k=0; k<7; k++) {
+			buffer |= (uint64_t)fields[k] << nbits;
+			nbits += sizes[k];
+			while(nbits >= 8) {
+				out.push_back((unsigned char)buffer);
+				buffer >>= 8;
+				nbits -= 8;
+			}
+		}
+	}
+	if(nbits > 0) {
+		out.push_back((unsigned char)buffer);
+	}
+	out.insert(out.end(), 8, 0); // Padding for the eight byte loads of the decoder
+}
+
+
+/*
+ * decodeVertices() - Every field is read with one unaligned eight byte
+ * load, a shift and a mask, and scaled back to its range. The normal
+ * is unfolded from the octahedron without branches, and normalized.
+ */
+bool MeshCodec::decodeVertices(const unsigned char *data, size_t size, float *vertices,
+	size_t nverts, const Quantization &q) {
+
+	float posscale[3], texscale[2], normalscale;
+	uint32_t posmask, normalmask, texmask;
+	size_t stride;
+	int pbits = q.positionbits;
+	int nbits = q.normalbits;
+	int tbits = q.texcoordbits;
+
+	if(!validBits(pbits) || !validBits(nbits) || !validBits(tbits)
+		|| size < vertexStreamBytes(nverts, q)) {
+		return false;
+	}
+	posmask = (1u << pbits) - 1;
+	normalmask = (1u << nbits) - 1;
+	texmask = (1u << tbits) - 1;
+	for(int k=0; k<3; k++) {
+		posscale[k] = (q.posmax[k] - q.posmin[k]) / posmask;
+	}
+	for(int k=0; k<2; k++) {
+		texscale[k] = (q.texmax[k] - q.texmin[k]) / texmask;
+	}
+	normalscale = 2.0f / normalmask;
+	stride = vertexBits(q);
+
+	for(size_t i=0; i<nverts; i++) {
+		size_t bit = i*stride;
+		float *v = &vertices[8*i];
+		float nx, ny, nz, t, len;
+
+		// The fields are less than 2^24, so the int conversion is exact
+		v[0] = q.posmin[0] + (int)readBits(data, bit, posmask) * posscale[0];
+		v[1] = q.posmin[1] + (int)readBits(data, bit + pbits, posmask) * posscale[1];
+		v[2] = q.posmin[2] + (int)readBits(data, bit + 2*pbits, posmask) * posscale[2];
+		bit += 3*pbits;
+		nx = (int)readBits(data, bit, normalmask) * normalscale - 1.0f;
+		ny = (int)readBits(data, bit + nbits, normalmask) * normalscale - 1.0f;
+		bit += 2*nbits;
+		v[6] = q.texmin[0] + (int)readBits(data, bit, texmask) * texscale[0];
+		v[7] = q.texmin[1] + (int)readBits(data, bit + tbits, texmask) * texscale[1];
+
+		// Fold the lower half back out, as octDecode() in TriangleSoup.cpp does
+		nz = 1.0f - fabsf(nx) - fabsf(ny);
+		t = (nz < 0.0f) ? -nz : 0.0f;
+		nx -= copysignf(t, nx);
+		ny -= copysignf(t, ny);
+		len = 1.0f / sqrtf(nx*nx + ny*ny + nz*nz);
+		v[3] = nx*len;
+		v[4] = ny*len;
+		v[5] = nz*len;
+	}
+	return true;
+}
+
+
+/*
+ * The entropy stage: rANS over bytes with 12-bit frequencies, as in
+ * Fabian Giesen's public domain "ryg_rans". Each block is split in four
+ * lanes of equal length (the last one may be shorter) that are coded
+ * separately, so the decoder can work on the four at once without the
+ * lanes waiting for each other. The coder states are kept in
+ * [RANS_LOW, 65536*RANS_LOW), and are moved in and out 16 bits at a
+ * time, so each symbol needs at most one word and the decoder can do
+ * it without a branch.
+ * A block is stored as its size (4 bytes) and its coded size (4 bytes,
+ * 0 if the block is stored as it is), then for coded blocks the 256
+ * frequencies (2 bytes each), the coded sizes of the four lanes
+ * (4 bytes each), and the lanes. Each lane is the final state of the
+ * encoder, then the words in the order they are read.
+ */
+#define RANS_SCALE_BITS 12
+#define RANS_TOTAL (1u << RANS_SCALE_BITS)
+#define RANS_LOW (1u << 16)
+#define RANS_BLOCK_SIZE (1 << 20)
+
+/*
+ * Scale the byte counts of a block to frequencies that add up to
+ * RANS_TOTAL, and give every byte that occurs a frequency of at least 1.
+ */
+static void normalizeFrequencies(const size_t counts[256], size_t total, uint32_t freq[256]) {
+
+	uint32_t sum = 0;
+	int largest = 0;
+
+	for(int s=0; s<256; s++) {
+		freq[s] = 0;
+		if(counts[s] == 0) continue;
+		freq[s] = (uint32_t)((double)counts[s] * RANS_TOTAL / total);
+		if(freq[s] == 0) freq[s] = 1;
+		sum += freq[s];
+		if(counts[s] > counts[largest]) largest = s;
+	}
+	while(sum > RANS_TOTAL) { // Too many rare bytes were rounded up
+		for(int s=0; s<256 && sum > RANS_TOTAL; s++) {
+			if(freq[s] > 1) {
+				freq[s]--;
+				sum--;
+			}
+		}
+	}
+	freq[largest] += RANS_TOTAL - sum;
+}
+
+/* Code one lane backwards into 'coded', which ends at 'end'. Returns the
+ * start of the coded lane, or NULL if it would not fit. */
+static unsigned char *compressLane(const unsigned char *data, size_t size, const uint32_t freq[256],
+	const uint32_t start[256], unsigned char *coded, unsigned char *end) {
+
+	uint32_t x = RANS_LOW;
+	unsigned char *p = end;
+
+	// Encode backwards, so the decoder can go forwards
+	for(size_t i=size; i-- > 0; ) {
+		int s = data[i];
+		uint32_t xmax = ((RANS_LOW >> RANS_SCALE_BITS) << 16) * freq[s];
+		if(x >= xmax) {
+			if(p - coded < 2 + 4) return NULL;
+			p -= 2;
+			uint16_t word = (uint16_t)x;
+			memcpy(p, &word, 2);
+			x >>= 16;
+		}
+		x = ((x / freq[s]) << RANS_SCALE_BITS) + (x % freq[s]) + start[s];
+	}
+	if(p - coded < 4) return NULL;
+	p -= 4;
+	memcpy(p, &x, 4);
+	return p;
+}
+
+/* Entropy code one block. Returns false if it would not get smaller. */
+static bool compressBlock(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+
+	size_t counts[256] = { 0 };
+	uint32_t freq[256], start[256];
+	size_t lanesize = (size + 3) / 4;
+	std::vector<unsigned char> coded(size + 16);
+	unsigned char *lanestart[4];
+	unsigned char *end = coded.data() + coded.size();
+	uint32_t header[2], lanebytes[4];
+	unsigned short shortfreq[256];
+
+	for(size_t i=0; i<size; i++) {
+		counts[data[i]]++;
+	}
+	normalizeFrequencies(counts, size, freq);
+	start[0] = 0;
+	for(int s=1; s<256; s++) {
+		start[s] = start[s-1] + freq[s-1];
+	}
+
+	// Code the lanes from the last one, each in front of the next
+	for(int k=3; k>=0; k--) {
+		size_t first = (k*lanesize < size) ? k*lanesize : size;
+		size_t last = (first + lanesize < size) ? first + lanesize : size;
+		lanestart[k] = compressLane(data + first, last - first, freq, start, coded.data(), end);
+		if(!lanestart[k]) return false; // Not getting smaller
+		lanebytes[k] = (uint32_t)(end - lanestart[k]);
+		end = lanestart[k];
+	}
+	end = coded.data() + coded.size();
+	if((size_t)(end - lanestart[0]) + sizeof(shortfreq) + sizeof(lanebytes) >= size) return false;
+
+	header[0] = (uint32_t)size;
+	header[1] = (uint32_t)(end - lanestart[0] + sizeof(lanebytes));
+	for(int s=0; s<256; s++) {
+		shortfreq[s] = (unsigned short)freq[s];
+	}
+	out.insert(out.end(), (const unsigned char*)header, (const unsigned char*)header + 8);
+	out.insert(out.end(), (const unsigned char*)shortfreq, (const unsigned char*)shortfreq + sizeof(shortfreq));
+	out.insert(out.end(), (const unsigned char*)lanebytes, (const unsigned char*)lanebytes + sizeof(lanebytes));
+	out.insert(out.end(), lanestart[0], end);
+	return true;
+}
+
+/* Decode one symbol with state 'x', and read a word if it gets too small */
+static inline uint32_t ransDecode(uint32_t x, const unsigned char *symbol, const uint32_t *slotinfo,
+	unsigned char *out, const unsigned char *&p) {
+
+	uint32_t slot = x & (RANS_TOTAL - 1);
+	uint32_t info = slotinfo[slot];
+	uint16_t word;
+	uint32_t refill;
+
+	*out = symbol[slot];
+	x = (info & 0xffff) * (x >> RANS_SCALE_BITS) + (info >> 16);
+	memcpy(&word, p, 2);
+	refill = (x < RANS_LOW);
+	// A shift and a mask, since compilers tend to make a branch of ?:
+	x = (x << (16*refill)) | (word & (0 - refill));
+	p += 2*refill;
+	return x;
+}
+
+/* Decode the last 'count' symbols of a lane, checking the end of its input */
+static bool ransDecodeChecked(uint32_t x, const unsigned char *symbol, const uint32_t *slotinfo,
+	unsigned char *out, size_t count, const unsigned char *p, const unsigned char *end) {
+
+	for(size_t i=0; i<count; i++) {
+		uint32_t slot = x & (RANS_TOTAL - 1);
+		uint32_t info = slotinfo[slot];
+		out[i] = symbol[slot];
+		x = (info & 0xffff) * (x >> RANS_SCALE_BITS) + (info >> 16);
+		if(x < RANS_LOW) {
+			uint16_t word;
+			if(end - p < 2) return false;
+			memcpy(&word, p, 2);
+			p += 2;
+			x = (x << 16) | word;
+		}
+	}
+	return p == end;
+}
+
+/* Decode one rANS coded block of 'size' bytes to 'outsize' bytes */
+static bool decompressBlock(const unsigned char *data, size_t size,
+	const unsigned short shortfreq[256], unsigned char *out, size_t outsize) {
+
+	unsigned char symbol[RANS_TOTAL];
+	uint32_t slotinfo[RANS_TOTAL]; // Frequency, and slot minus start << 16
+	uint32_t lanebytes[4], x[4];
+	const unsigned char *p[4], *end[4];
+	size_t lanesize = (outsize + 3) / 4;
+	size_t done, count[4];
+	uint32_t total = 0;
+
+	for(int s=0; s<256; s++) {
+		uint32_t f = shortfreq[s];
+		if(total + f > RANS_TOTAL) return false;
+		for(uint32_t j=0; j<f; j++) {
+			symbol[total + j] = (unsigned char)s;
+			slotinfo[total + j] = f | (j << 16);
+		}
+		total += f;
+	}
+	if(total != RANS_TOTAL || size < sizeof(lanebytes)) return false;
+	memcpy(lanebytes, data, sizeof(lanebytes));
+	data += sizeof(lanebytes);
+	size -= sizeof(lanebytes);
+	for(int k=0; k<4; k++) {
+		size_t first = (k*lanesize < outsize) ? k*lanesize : outsize;
+		count[k] = (first + lanesize < outsize) ? lanesize : outsize - first;
+		if(lanebytes[k] < 4 || lanebytes[k] > size) return false;
+		memcpy(&x[k], data, 4);
+		p[k] = data + 4;
+		end[k] = data + lanebytes[k];
+		data += lanebytes[k];
+		size -= lanebytes[k];
+	}
+	if(size != 0) return false;
+
+	// All four lanes at once, as long as every lane has a word left
+	// for each symbol, so there is no need to check the ends inside.
+	// The last lane is the shortest.
+	uint32_t x0 = x[0], x1 = x[1], x2 = x[2], x3 = x[3];
+	unsigned char *out0 = out, *out1 = out + lanesize;
+	unsigned char *out2 = out + 2*lanesize, *out3 = out + 3*lanesize;
+	done = 0;
+	while(done < count[3]) {
+		size_t n = count[3] - done;
+		for(int k=0; k<4; k++) {
+			size_t words = (size_t)(end[k] - p[k]) / 2;
+			if(words < n) n = words;
+		}
+		if(n == 0) break;
+		for(size_t i=done; i<done+n; i++) {
+			x0 = ransDecode(x0, symbol, slotinfo, out0 + i, p[0]);
+			x1 = ransDecode(x1, symbol, slotinfo, out1 + i, p[1]);
+			x2 = ransDecode(x2, symbol, slotinfo, out2 + i, p[2]);
+			x3 = ransDecode(x3, symbol, slotinfo, out3 + i, p[3]);
+		}
+		done += n;
+	}
+	x[0] = x0; x[1] = x1; x[2] = x2; x[3] = x3;
+	for(int k=0; k<4; k++) { // The rest of each lane, with checks
+		if(!ransDecodeChecked(x[k], symbol, slotinfo, out + k*lanesize + done,
+			count[k] - done, p[k], end[k])) {
+			return false;
+		}
+	}
+	return true;
+}
+
+
+/*
+ * compress() - Entropy code the data in blocks of RANS_BLOCK_SIZE bytes,
+ * each with its own frequencies.
+ */
+size_t MeshCodec::compress(const unsigned char *data, size_t size, std::vector<unsigned char> &out) {
+
+	size_t start = out.size();
+
+	for(size_t first=0; first<size; first+=RANS_BLOCK_SIZE) {
+		size_t blocksize = (size - first < RANS_BLOCK_SIZE) ? size - first : RANS_BLOCK_SIZE;
+		if(!compressBlock(data + first, blocksize, out)) {
+			uint32_t header[2] = { (uint32_t)blocksize, 0 };
+			out.insert(out.end(), (const unsigned char*)header, (const unsigned char*)header + 8);
+			out.insert(out.end(), data + first, data + first + blocksize);
+		}
+	}
+	return out.size() - start;
+}
+
+
+/*
+ * decompress() - Decode the blocks one by one, checking every size
+ * against what is left of the input and the output.
+ */
+bool MeshCodec::decompress(const unsigned char *data, size_t size, unsigned char *out, size_t outsize) {
+
+	const unsigned char *p = data;
+	const unsigned char *end = data + size;
+	unsigned short shortfreq[256];
+	size_t done = 0;
+	uint32_t header[2];
+
+	while(done < outsize) {
+		if(end - p < 8) return false;
+		memcpy(header, p, 8);
+		p += 8;
+		if(header[0] == 0 || header[0] > RANS_BLOCK_SIZE || header[0] > outsize - done) return false;
+		if(header[1] == 0) { // Stored as it is
+			if((size_t)(end - p) < header[0]) return false;
+			memcpy(out + done, p, header[0]);
+			p += header[0];
+		}
+		else {
+			if((size_t)(end - p) < sizeof(shortfreq) + header[1]) return false;
+			memcpy(shortfreq, p, sizeof(shortfreq));
+			p += sizeof(shortfreq);
+			if(!decompressBlock(p, header[1], shortfreq, out + done, header[0])) return false;
+			p += header[1];
+		}
+		done += header[0];
+	}
+	return p == end;
+}
@@ -0,0 +1,913 @@
+/* MeshOptimizer.cpp */
+/*
+ * Triangle and vertex reordering for indexed triangle meshes.
+ * See MeshOptimizer.hpp for a description of each function.
+ * This code is in the public domain.
+ */
+
+#include <cmath>   // For pow() and sqrt()
+#include <vector>  // For temporary arrays
+#include <cstring> // For memcpy()
+#include <algorithm> // For std::sort()
+
+#include "MeshOptimizer.hpp"
+
+/*
+ * cacheStats() - Count vertex shader runs with a FIFO vertex cache.
+ */
+float MeshOptimizer::cacheStats(const unsigned int *indices, int ntris, int nverts,
+    int cachesize, float *atvr) {
+
+	// A vertex is in the cache if it was added less than 'cachesize'
+	// misses ago. Storing the miss count for each vertex makes this
+	// a FIFO cache without having to move anything around.
+	std::vector<int> timestamp(nverts, -cachesize-1);
+	std::vector<char> used(nverts, 0);
+	int misses = 0;
+	int numused = 0;
+	unsigned int v;
+
+	for(int i=0; i<3*ntris; i++) {
+		v = indices[i];
+		if(misses - timestamp[v] > cachesize) {
+			timestamp[v] = misses;
+			misses++;
+		}
+		if(!used[v]) {
+			used[v] = 1;
+			numused++;
+		}
+	}
+	if(atvr) *atvr = (numused > 0) ? (float)misses / numused : 0.0f;
+	return (ntris > 0) ? (float)misses / ntris : 0.0f;
+}
+
+
+/*
+ * Scoring for optimizeVertexCache(), with the constants from
+ * Forsyth's article. Vertices that are recently used score high,
+ * except for the last triangle's three vertices, which get a slightly
+ * lower fixed score to avoid strips that double back on themselves.
+ * Vertices with few triangles left score high, to get rid of them
+ * before they cause lone triangles later on.
+ */
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_MAX_VALENCE 32
+
+static float cacheScores[FORSYTH_CACHE_SIZE];
+static float valenceScores[FORSYTH_MAX_VALENCE];
+
+static void initScores() {
+	for(int i=0; i<FORSYTH_CACHE_SIZE; i++) {
+		if(i < 3) cacheScores[i] = 0.75f;
+		else cacheScores[i] = (float)pow(1.0 - (double)(i-3)/(FORSYTH_CACHE_SIZE-3), 1.5);
+	}
+	valenceScores[0] = 0.0f;
+	for(int i=1; i<FORSYTH_MAX_VALENCE; i++) {
+		valenceScores[i] = (float)(2.0*pow((double)i, -0.5));
+	}
+}
+
+static float vertexScore(int cacheposition, int livetris) {
+	float score;
+	if(livetris == 0) return -1.0f; // No triangles left to draw for this vertex
+	score = (cacheposition >= 0) ? cacheScores[cacheposition] : 0.0f;
+	if(livetris < FORSYTH_MAX_VALENCE) score += valenceScores[livetris];
+	else score += (float)(2.0*pow((double)livetris, -0.5));
+	return score;
+}
+
+
+/*
+ * optimizeVertexCache() - Forsyth's greedy triangle ordering.
+ * Each step emits the best scoring triangle among those that use
+ * a vertex in the simulated cache, so only the cache contents and
+ * their triangles need new scores. If no such triangle is left, the
+ * next triangle in the original order is used instead of searching.
+ */
+void MeshOptimizer::optimizeVertexCache(unsigned int *indices, int ntris, int nverts) {
+
+	std::vector<int> livetris(nverts, 0);   // Triangles not yet emitted, per vertex
+	std::vector<int> firsttri(nverts+1, 0); // Start of each vertex's list in 'adjacency'
+	std::vector<int> adjacency(3*ntris);    // Triangles that use each vertex
+	std::vector<int> cacheposition(nverts, -1);
+	std::vector<float> vscore(nverts);
+	std::vector<float> tscore(ntris, 0.0f);
+	std::vector<char> emitted(ntris, 0);
+	std::vector<unsigned int> result(3*ntris);
+	int cache[FORSYTH_CACHE_SIZE+3], newcache[FORSYTH_CACHE_SIZE+3];
+	int cachecount = 0;
+	int newcount, best, cursor, t, v, i, j, k;
+	float bestscore, score, diff;
+
+	if(ntris == 0) return;
+	initScores();
+
+	// Build the vertex to triangle adjacency lists
+	for(i=0; i<3*ntris; i++) {
+		livetris[indices[i]]++;
+	}
+	for(v=0; v<nverts; v++) {
+		firsttri[v+1] = firsttri[v] + livetris[v];
+		livetris[v] = 0;
+	}
+	for(i=0; i<3*ntris; i++) {
+		v = indices[i];
+		adjacency[firsttri[v] + livetris[v]++] = i/3;
+	}
+
+	// Initial scores, and the best triangle to start with
+	for(v=0; v<nverts; v++) {
+		vscore[v] = vertexScore(-1, livetris[v]);
+	}
+	best = 0;
+	for(t=0; t<ntris; t++) {
+		tscore[t] = vscore[indices[3*t]] + vscore[indices[3*t+1]] + vscore[indices[3*t+2]];
+		if(tscore[t] > tscore[best]) best = t;
+	}
+
+	cursor = 0;
+	for(int out=0; out<ntris; out++) {
+
+		if(best < 0) { // Dead end: continue with the next triangle in order
+			while(emitted[cursor]) cursor++;
+			best = cursor;
+		}
+		t = best;
+		emitted[t] = 1;
+		for(i=0; i<3; i++) {
+			result[3*out+i] = indices[3*t+i];
+		}
+
+		// Remove the triangle from the adjacency lists of its vertices.
+		// Each list keeps the live triangles first.
+		for(i=0; i<3; i++) {
+			v = indices[3*t+i];
+			int *list = &adjacency[firsttri[v]];
+			for(j=0; j<livetris[v]; j++) {
+				if(list[j] == t) {
+					list[j] = list[livetris[v]-1];
+					list[livetris[v]-1] = t;
+					livetris[v]--;
+					break;
+				}
+			}
+		}
+
+		// Put the triangle's vertices first in the cache, followed by
+		// the old contents. The last entries may fall out of the cache.
+		newcount = 0;
+		for(i=0; i<3; i++) {
+			newcache[newcount++] = indices[3*t+i];
+		}
+		for(i=0; i<cachecount; i++) {
+			v = cache[i];
+			if(v != newcache[0] && v != newcache[1] && v != newcache[2]) {
+				newcache[newcount++] = v;
+			}
+		}
+
+		// Rescore the vertices that moved in the cache or fell out of it,
+		// and their remaining triangles. The best of those goes next.
+		best = -1;
+		bestscore = -1.0f;
+		for(i=0; i<newcount; i++) {
+			v = newcache[i];
+			cacheposition[v] = (i < FORSYTH_CACHE_SIZE) ? i : -1;
+			score = vertexScore(cacheposition[v], livetris[v]);
+			diff = score - vscore[v];
+			vscore[v] = score;
+			for(k=0; k<livetris[v]; k++) {
+				int tri = adjacency[firsttri[v] + k];
+				tscore[tri] += diff;
+			}
+		}
+		for(i=0; i<newcount && i<FORSYTH_CACHE_SIZE; i++) {
+			v = newcache[i];
+			for(k=0; k<livetris[v]; k++) {
+				int tri = adjacency[firsttri[v] + k];
+				if(tscore[tri] > bestscore) {
+					bestscore = tscore[tri];
+					best = tri;
+				}
+			}
+		}
+
+		cachecount = (newcount < FORSYTH_CACHE_SIZE) ? newcount : FORSYTH_CACHE_SIZE;
+		for(i=0; i<cachecount; i++) {
+			cache[i] = newcache[i];
+		}
+	}
+
+	for(i=0; i<3*ntris; i++) {
+		indices[i] = result[i];
+	}
+}
+
+
+/*
+ * optimizeVertexFetch() - Sort the vertices in first-use order.
+ * After optimizeVertexCache(), this makes the vertex fetches mostly
+ * sequential in memory instead of scattered.
+ */
+int MeshOptimizer::optimizeVertexFetch(float *vertices, int stride, unsigned int *indices,
+    int ntris, int nverts) {
+
+	std::vector<int> remap(nverts, -1); // New index for each old vertex
+	std::vector<float> oldvertices(vertices, vertices + (size_t)stride*nverts);
+	int newcount = 0;
+	unsigned int v;
+
+	for(int i=0; i<3*ntris; i++) {
+		v = indices[i];
+		if(remap[v] < 0) {
+			remap[v] = newcount;
+			memcpy(vertices + (size_t)stride*newcount, &oldvertices[(size_t)stride*v],
+				stride*sizeof(float));
+			newcount++;
+		}
+		indices[i] = remap[v];
+	}
+	return newcount;
+}
+
+
+/*
+ * Count the vertex cache misses for one triangle. Used by the cache
+ * simulations in optimizeOverdraw(). Adding cachesize+1 to 'timestamp'
+ * flushes the cache.
+ */
+static int cacheMisses(const unsigned int *triangle, int cachesize,
+    std::vector<int> &timestamps, int &timestamp) {
+	int misses = 0;
+	for(int i=0; i<3; i++) {
+		if(timestamp - timestamps[triangle[i]] > cachesize) {
+			timestamps[triangle[i]] = timestamp++;
+			misses++;
+		}
+	}
+	return misses;
+}
+
+/*
+ * optimizeOverdraw() - Split into clusters, sort the clusters.
+ */
+void MeshOptimizer::optimizeOverdraw(unsigned int *indices, int ntris, const float *vertices,
+    int stride, int nverts, float threshold) {
+
+	const int cachesize = 16;
+	std::vector<int> timestamps(nverts, 0);
+	std::vector<int> hard;     // First triangle of each hard cluster, plus ntris
+	std::vector<int> clusters; // First triangle of each soft cluster
+	std::vector<float> sortkey;
+	std::vector<int> order;
+	std::vector<unsigned int> result(3*ntris);
+	int timestamp, start, end, misses, runmisses, runtris, c, t, i, out;
+	double centroid[3] = {0.0, 0.0, 0.0};
+	float clusterthreshold;
+
+	if(ntris == 0) return;
+
+	// Hard boundaries: where a triangle misses the cache for all three
+	// vertices, the vertex cache optimizer started over somewhere else.
+	timestamp = cachesize + 1;
+	for(t=0; t<ntris; t++) {
+		if(cacheMisses(&indices[3*t], cachesize, timestamps, timestamp) == 3) {
+			hard.push_back(t);
+		}
+	}
+	hard.push_back(ntris);
+
+	// Soft boundaries: split each hard cluster as soon as the running
+	// ACMR from a flushed cache is down to 'threshold' times the ACMR
+	// of the whole hard cluster.
+	for(c=0; c+1<(int)hard.size(); c++) {
+		start = hard[c];
+		end = hard[c+1];
+		timestamp += cachesize + 1;
+		misses = 0;
+		for(t=start; t<end; t++) {
+			misses += cacheMisses(&indices[3*t], cachesize, timestamps, timestamp);
+		}
+		clusterthreshold = threshold * misses / (end - start);
+
+		clusters.push_back(start);
+		timestamp += cachesize + 1;
+		runmisses = 0;
+		runtris = 0;
+		for(t=start; t<end; t++) {
+			runmisses += cacheMisses(&indices[3*t], cachesize, timestamps, timestamp);
+			runtris++;
+			if(runmisses <= clusterthreshold * runtris) {
+				clusters.push_back(t+1);
+				timestamp += cachesize + 1;
+				runmisses = 0;
+				runtris = 0;
+			}
+		}
+		// The last split rarely leaves a good cluster behind, so merge
+		// the remainder with the cluster before it. This also removes
+		// a split that landed exactly on 'end'.
+		if(clusters.back() != start) {
+			clusters.pop_back();
+		}
+	}
+	clusters.push_back(ntris);
+
+	// The centroid of the mesh
+	for(i=0; i<3*ntris; i++) {
+		for(int j=0; j<3; j++) {
+			centroid[j] += vertices[(size_t)stride*indices[i] + j];
+		}
+	}
+	for(int j=0; j<3; j++) {
+		centroid[j] /= 3.0*ntris;
+	}
+
+	// Sort key for each cluster: how far its area weighted centroid is
+	// from the mesh centroid along its average normal. Clusters on the
+	// outside, facing outward, are likely to occlude the rest.
+	for(c=0; c+1<(int)clusters.size(); c++) {
+		double ccentroid[3] = {0.0, 0.0, 0.0};
+		double cnormal[3] = {0.0, 0.0, 0.0};
+		double area = 0.0, length, key;
+		for(t=clusters[c]; t<clusters[c+1]; t++) {
+			const float *p0 = &vertices[(size_t)stride*indices[3*t]];
+			const float *p1 = &vertices[(size_t)stride*indices[3*t+1]];
+			const float *p2 = &vertices[(size_t)stride*indices[3*t+2]];
+			double e1[3] = {p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2]};
+			double e2[3] = {p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2]};
+			double n[3] = {e1[1]*e2[2]-e1[2]*e2[1], e1[2]*e2[0]-e1[0]*e2[2], e1[0]*e2[1]-e1[1]*e2[0]};
+			double a = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+			for(int j=0; j<3; j++) {
+				ccentroid[j] += a*(p0[j] + p1[j] + p2[j])/3.0;
+				cnormal[j] += n[j];
+			}
+			area += a;
+		}
+		length = sqrt(cnormal[0]*cnormal[0] + cnormal[1]*cnormal[1] + cnormal[2]*cnormal[2]);
+		key = 0.0;
+		if(area > 0.0 && length > 0.0) {
+			for(int j=0; j<3; j++) {
+				key += (ccentroid[j]/area - centroid[j]) * cnormal[j]/length;
+			}
+		}
+		sortkey.push_back((float)key);
+		order.push_back(c);
+	}
+	std::stable_sort(order.begin(), order.end(),
+		[&](int a, int b) { return sortkey[a] > sortkey[b]; });
+
+	out = 0;
+	for(i=0; i<(int)order.size(); i++) {
+		c = order[i];
+		for(t=clusters[c]; t<clusters[c+1]; t++) {
+			result[3*out] = indices[3*t];
+			result[3*out+1] = indices[3*t+1];
+			result[3*out+2] = indices[3*t+2];
+			out++;
+		}
+	}
+	for(i=0; i<3*ntris; i++) {
+		indices[i] = result[i];
+	}
+}
+
+
+/*
+ * overdrawStats() - Count shaded fragments in six orthographic views.
+ * A fragment is "shaded" if it passes the depth test when it is drawn,
+ * as it would with early depth testing on a GPU.
+ */
+float MeshOptimizer::overdrawStats(const unsigned int *indices, int ntris, const float *vertices,
+    int stride, int nverts, float ratios[6]) {
+
+	const int size = 256; // Resolution of the views
+	// View direction and up vector for each of the six views
+	static const float views[6][6] = {
+		{ 1, 0, 0,  0, 1, 0}, {-1, 0, 0,  0, 1, 0},
+		{ 0, 1, 0,  0, 0, 1}, { 0,-1, 0,  0, 0, 1},
+		{ 0, 0, 1,  0, 1, 0}, { 0, 0,-1,  0, 1, 0}
+	};
+	std::vector<float> depth(size*size);
+	std::vector<float> screen(3*nverts); // x, y, depth for each vertex
+	float sum = 0.0f;
+
+	for(int view=0; view<6; view++) {
+		const float *d = views[view];
+		const float *up = views[view] + 3;
+		// Camera space axes: right = d x up, up, depth along d
+		float right[3] = {d[1]*up[2]-d[2]*up[1], d[2]*up[0]-d[0]*up[2], d[0]*up[1]-d[1]*up[0]};
+		float xmin = 1e30f, xmax = -1e30f, ymin = 1e30f, ymax = -1e30f, scale;
+		long long shaded = 0, covered = 0;
+		int v, t, x, y;
+
+		for(v=0; v<nverts; v++) {
+			const float *p = &vertices[(size_t)stride*v];
+			screen[3*v] = p[0]*right[0] + p[1]*right[1] + p[2]*right[2];
+			screen[3*v+1] = p[0]*up[0] + p[1]*up[1] + p[2]*up[2];
+			screen[3*v+2] = p[0]*d[0] + p[1]*d[1] + p[2]*d[2];
+			if(screen[3*v] < xmin) xmin = screen[3*v];
+			if(screen[3*v] > xmax) xmax = screen[3*v];
+			if(screen[3*v+1] < ymin) ymin = screen[3*v+1];
+			if(screen[3*v+1] > ymax) ymax = screen[3*v+1];
+		}
+		// Fit the mesh to the view, keeping the aspect ratio
+		scale = (xmax-xmin > ymax-ymin) ? xmax-xmin : ymax-ymin;
+		scale = (scale > 0.0f) ? (size-1)/scale : 1.0f;
+		for(v=0; v<nverts; v++) {
+			screen[3*v] = (screen[3*v] - xmin)*scale;
+			screen[3*v+1] = (screen[3*v+1] - ymin)*scale;
+		}
+		std::fill(depth.begin(), depth.end(), 1e30f);
+
+		for(t=0; t<ntris; t++) {
+			const float *a = &screen[3*indices[3*t]];
+			const float *b = &screen[3*indices[3*t+1]];
+			const float *c = &screen[3*indices[3*t+2]];
+			float area = (b[0]-a[0])*(c[1]-a[1]) - (b[1]-a[1])*(c[0]-a[0]);
+			if(area <= 0.0f) continue; // Back facing or degenerate
+			int x0 = (int)std::max(0.0f, std::min(a[0], std::min(b[0], c[0])));
+			int x1 = (int)std::min(size-1.0f, std::max(a[0], std::max(b[0], c[0])));
+			int y0 = (int)std::max(0.0f, std::min(a[1], std::min(b[1], c[1])));
+			int y1 = (int)std::min(size-1.0f, std::max(a[1], std::max(b[1], c[1])));
+			for(y=y0; y<=y1; y++) {
+				for(x=x0; x<=x1; x++) {
+					float px = x + 0.5f, py = y + 0.5f;
+					float wa = (c[0]-b[0])*(py-b[1]) - (c[1]-b[1])*(px-b[0]);
+					float wb = (a[0]-c[0])*(py-c[1]) - (a[1]-c[1])*(px-c[0]);
+					float wc = (b[0]-a[0])*(py-a[1]) - (b[1]-a[1])*(px-a[0]);
+					if(wa < 0.0f || wb < 0.0f || wc < 0.0f) continue;
+					float z = (wa*a[2] + wb*b[2] + wc*c[2]) / area;
+					if(z < depth[y*size+x]) {
+						depth[y*size+x] = z;
+						shaded++;
+					}
+				}
+			}
+		}
+		for(x=0; x<size*size; x++) {
+			if(depth[x] < 1e30f) covered++;
+		}
+		float ratio = (covered > 0) ? (float)shaded / covered : 0.0f;
+		if(ratios) ratios[view] = ratio;
+		sum += ratio;
+	}
+	return sum / 6.0f;
+}
+
+
+/*
+ * Unit normal of a counterclockwise triangle, or zero if it is degenerate.
+ */
+static void triangleNormal(const unsigned int *triangle, const float *vertices,
+    int stride, float *n) {
+
+	const float *a = &vertices[(size_t)stride*triangle[0]];
+	const float *b = &vertices[(size_t)stride*triangle[1]];
+	const float *c = &vertices[(size_t)stride*triangle[2]];
+	float e1[3], e2[3], len;
+
+	for(int k=0; k<3; k++) {
+		e1[k] = b[k] - a[k];
+		e2[k] = c[k] - a[k];
+	}
+	n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+	n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+	n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+	len = sqrtf(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+	for(int k=0; k<3; k++) {
+		n[k] = (len > 0.0f) ? n[k]/len : 0.0f;
+	}
+}
+
+/*
+ * Compute the bounding sphere and the normal cone of a cluster.
+ * The sphere is centered in the bounding box, which is not the smallest
+ * sphere, but close enough for culling.
+ */
+static void clusterBounds(MeshOptimizer::Cluster &cluster, const unsigned int *indices,
+    const float *vertices, int stride) {
+
+	float bmin[3], bmax[3], n[3], axis[3] = {0.0f, 0.0f, 0.0f};
+	float radius2 = 0.0f, len, mindot = 1.0f;
+	int i, k, t;
+
+	for(k=0; k<3; k++) {
+		bmin[k] = bmax[k] = vertices[(size_t)stride*indices[3*cluster.firsttri] + k];
+	}
+	for(i=3*cluster.firsttri; i<3*(cluster.firsttri+cluster.ntris); i++) {
+		const float *p = &vertices[(size_t)stride*indices[i]];
+		for(k=0; k<3; k++) {
+			if(p[k] < bmin[k]) bmin[k] = p[k];
+			if(p[k] > bmax[k]) bmax[k] = p[k];
+		}
+	}
+	for(k=0; k<3; k++) {
+		cluster.center[k] = 0.5f*(bmin[k] + bmax[k]);
+	}
+	for(i=3*cluster.firsttri; i<3*(cluster.firsttri+cluster.ntris); i++) {
+		const float *p = &vertices[(size_t)stride*indices[i]];
+		float dx = p[0]-cluster.center[0], dy = p[1]-cluster.center[1], dz = p[2]-cluster.center[2];
+		radius2 = std::max(radius2, dx*dx + dy*dy + dz*dz);
+	}
+	cluster.radius = sqrtf(radius2);
+
+	for(t=cluster.firsttri; t<cluster.firsttri+cluster.ntris; t++) {
+		triangleNormal(&indices[3*t], vertices, stride, n);
+		for(k=0; k<3; k++) axis[k] += n[k];
+	}
+	len = sqrtf(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+	if(len > 0.0f) {
+		for(k=0; k<3; k++) axis[k] /= len;
+		for(t=cluster.firsttri; t<cluster.firsttri+cluster.ntris; t++) {
+			triangleNormal(&indices[3*t], vertices, stride, n);
+			if(n[0] == 0.0f && n[1] == 0.0f && n[2] == 0.0f) continue; // Degenerate
+			mindot = std::min(mindot, n[0]*axis[0] + n[1]*axis[1] + n[2]*axis[2]);
+		}
+	}
+	for(k=0; k<3; k++) cluster.coneaxis[k] = axis[k];
+	// Normals spread over a half space or more can't all face away
+	if(len == 0.0f || mindot <= 0.0f) cluster.conecutoff = 1.0f;
+	else cluster.conecutoff = sqrtf(1.0f - mindot*mindot);
+}
+
+/*
+ * buildClusters() - Grow clusters greedily from a seed triangle.
+ * Each step adds the candidate triangle (one that shares a vertex with
+ * the cluster) that brings in the fewest new vertices, with a penalty
+ * for facing away from the cluster's average normal. A cluster ends
+ * when it is full or when no neighbour fits.
+ */
+void MeshOptimizer::buildClusters(unsigned int *indices, int ntris, const float *vertices,
+    int stride, int nverts, int maxverts, int maxtris, std::vector<Cluster> &clusters) {
+
+	std::vector<int> offsets(nverts+1, 0); // Triangles around each vertex
+	std::vector<int> adjacency(3*ntris);
+	std::vector<float> normals(3*ntris);  // Unit normal of each triangle
+	std::vector<char> used(ntris, 0);
+	std::vector<int> marker(nverts, -1);  // Last cluster that each vertex was added to
+	std::vector<int> candidates;
+	std::vector<unsigned int> result;
+	int seed = 0;
+	int i, k;
+
+	clusters.clear();
+	if(ntris == 0 || maxverts < 3 || maxtris < 1) return;
+	result.reserve(3*ntris);
+
+	// Build the vertex to triangle adjacency, counting sort style
+	for(i=0; i<3*ntris; i++) {
+		offsets[indices[i]+1]++;
+	}
+	for(i=0; i<nverts; i++) {
+		offsets[i+1] += offsets[i];
+	}
+	{
+		std::vector<int> fill(offsets.begin(), offsets.end()-1);
+		for(i=0; i<3*ntris; i++) {
+			adjacency[fill[indices[i]]++] = i/3;
+		}
+	}
+
+	for(i=0; i<ntris; i++) {
+		triangleNormal(&indices[3*i], vertices, stride, &normals[3*i]);
+	}
+
+	while(true) {
+		Cluster cluster;
+		int id = (int)clusters.size();
+		int next, clusterverts = 0;
+		float axis[3] = {0.0f, 0.0f, 0.0f};
+
+		while(seed < ntris && used[seed]) seed++;
+		if(seed == ntris) break;
+
+		cluster.firsttri = (int)result.size()/3;
+		cluster.ntris = 0;
+		candidates.clear();
+		next = seed;
+		while(next >= 0) {
+			// Add the triangle and remember its unused neighbours
+			used[next] = 1;
+			cluster.ntris++;
+			for(k=0; k<3; k++) {
+				unsigned int v = indices[3*next+k];
+				result.push_back(v);
+				axis[k] += normals[3*next+k];
+				if(marker[v] != id) {
+					marker[v] = id;
+					clusterverts++;
+					for(i=offsets[v]; i<offsets[v+1]; i++) {
+						if(!used[adjacency[i]]) candidates.push_back(adjacency[i]);
+					}
+				}
+			}
+			if(cluster.ntris == maxtris) break;
+
+			// Pick the best neighbour, dropping used ones from the list
+			float len = sqrtf(axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2]);
+			float bestscore = 1e30f;
+			int kept = 0;
+			next = -1;
+			for(i=0; i<(int)candidates.size(); i++) {
+				int t = candidates[i];
+				int newverts = 0;
+				float facing, score;
+				if(used[t]) continue;
+				candidates[kept++] = t;
+				for(k=0; k<3; k++) {
+					if(marker[indices[3*t+k]] != id) newverts++;
+				}
+				if(clusterverts + newverts > maxverts) continue;
+				facing = (len > 0.0f) ? (normals[3*t]*axis[0] + normals[3*t+1]*axis[1]
+					+ normals[3*t+2]*axis[2]) / len : 1.0f;
+				score = newverts + 0.5f*(1.0f - facing);
+				if(score < bestscore) {
+					bestscore = score;
+					next = t;
+				}
+			}
+			candidates.resize(kept);
+		}
+		cluster.nverts = clusterverts;
+		clusters.push_back(cluster);
+	}
+
+	for(i=0; i<3*ntris; i++) {
+		indices[i] = result[i];
+	}
+	for(i=0; i<(int)clusters.size(); i++) {
+		clusterBounds(clusters[i], indices, vertices, stride);
+	}
+}
+
+
+/*
+ * Find vertices that are exact copies of an earlier vertex in their
+ * first 'nfloats' floats, and map each vertex to the first copy.
+ * An open addressing hash table of vertex numbers does the lookup.
+ */
+static void remapDuplicates(const float *vertices, int stride, int nverts, int nfloats,
+    std::vector<unsigned int> &remap) {
+
+	size_t tablesize = 1;
+	std::vector<int> table;
+
+	while(tablesize < 2*(size_t)nverts) tablesize *= 2;
+	table.assign(tablesize, -1);
+	remap.resize(nverts);
+	for(int v=0; v<nverts; v++) {
+		const float *p = &vertices[(size_t)stride*v];
+		unsigned int hash = 2166136261u; // FNV-1a over the bytes
+		const unsigned char *bytes = (const unsigned char*)p;
+		for(size_t b=0; b<nfloats*sizeof(float); b++) {
+			hash = (hash ^ bytes[b]) * 16777619u;
+		}
+		size_t slot = hash & (tablesize-1);
+		while(table[slot] >= 0
+		      && memcmp(&vertices[(size_t)stride*table[slot]], p, nfloats*sizeof(float)) != 0) {
+			slot = (slot + 1) & (tablesize-1);
+		}
+		if(table[slot] < 0) table[slot] = v;
+		remap[v] = table[slot];
+	}
+}
+
+/*
+ * A quadric for the error metric: the symmetric matrix A, the vector b
+ * and the constant c of x'Ax + 2b'x + c, summed over planes weighted by
+ * triangle area. w is the sum of the weights, to turn the sum of squared
+ * distances into an average.
+ */
+struct Quadric {
+	double a00, a01, a02, a11, a12, a22;
+	double b0, b1, b2;
+	double c, w;
+};
+
+static void addPlane(Quadric &q, const double *n, double d, double weight) {
+	q.a00 += weight*n[0]*n[0]; q.a01 += weight*n[0]*n[1]; q.a02 += weight*n[0]*n[2];
+	q.a11 += weight*n[1]*n[1]; q.a12 += weight*n[1]*n[2]; q.a22 += weight*n[2]*n[2];
+	q.b0 += weight*n[0]*d; q.b1 += weight*n[1]*d; q.b2 += weight*n[2]*d;
+	q.c += weight*d*d;
+	q.w += weight;
+}
+
+static void addQuadric(Quadric &q, const Quadric &r) {
+	q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02;
+	q.a11 += r.a11; q.a12 += r.a12; q.a22 += r.a22;
+	q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+	q.c += r.c;
+	q.w += r.w;
+}
+
+static double quadricError(const Quadric &q, const float *p) {
+	double x = p[0], y = p[1], z = p[2];
+	double e = q.a00*x*x + q.a11*y*y + q.a22*z*z
+		+ 2.0*(q.a01*x*y + q.a02*x*z + q.a12*y*z)
+		+ 2.0*(q.b0*x + q.b1*y + q.b2*z) + q.c;
+	if(q.w > 0.0) e /= q.w;
+	return (e > 0.0) ? e : 0.0; // Rounding can make it slightly negative
+}
+
+/* Unnormalized normal of the triangle (a, b, c), in double precision */
+static void crossNormal(const float *a, const float *b, const float *c, double *n) {
+	double e1[3], e2[3];
+	for(int k=0; k<3; k++) {
+		e1[k] = (double)b[k] - a[k];
+		e2[k] = (double)c[k] - a[k];
+	}
+	n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+	n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+	n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+}
+
+/* A possible collapse of vertex 'from' onto vertex 'to' */
+struct Collapse {
+	float error;
+	unsigned int from, to;
+	bool operator<(const Collapse &other) const { return error < other.error; }
+};
+
+/*
+ * simplify() - Collapse edges in passes. Each pass sorts the possible
+ * collapses by error and performs the cheapest ones, but only one per
+ * neighbourhood, so that the flip test stays valid. A pass removes
+ * no more triangles than needed to reach the target.
+ */
+int MeshOptimizer::simplify(unsigned int *destination, const unsigned int *indices, int ntris,
+    const float *vertices, int stride, int nverts, int targettris, float *resulterror) {
+
+	std::vector<unsigned int> canonical; // Same vertex, all attributes equal
+	std::vector<unsigned int> position;  // Same position only
+	std::vector<int> wedges(nverts, 0);  // Distinct vertices at each position
+	std::vector<char> locked(nverts, 0);
+	std::vector<Quadric> quadrics(nverts);
+	std::vector<unsigned int> tris;
+	std::vector<unsigned long long> halfedges;
+	std::vector<Collapse> collapses;
+	std::vector<int> offsets, adjacency;
+	std::vector<char> touched(nverts);
+	double maxerror = 0.0;
+	int i, k, count;
+
+	if(resulterror) *resulterror = 0.0f;
+
+	// Merge exact duplicates, which unwelded meshes have a lot of
+	remapDuplicates(vertices, stride, nverts, stride, canonical);
+	remapDuplicates(vertices, stride, nverts, 3, position);
+	for(i=0; i<nverts; i++) {
+		if(canonical[i] == (unsigned int)i) wedges[position[i]]++;
+	}
+	for(i=0; i<nverts; i++) {
+		if(wedges[position[i]] > 1) locked[i] = 1; // Seam or crease
+	}
+
+	tris.reserve(3*ntris);
+	for(i=0; i<ntris; i++) {
+		unsigned int a = canonical[indices[3*i]];
+		unsigned int b = canonical[indices[3*i+1]];
+		unsigned int c = canonical[indices[3*i+2]];
+		if(a == b || b == c || c == a) continue;
+		tris.push_back(a);
+		tris.push_back(b);
+		tris.push_back(c);
+	}
+	count = (int)tris.size()/3;
+
+	// Open borders: half-edges (by position) without an opposite half-edge
+	for(i=0; i<3*count; i++) {
+		unsigned int a = position[tris[i]];
+		unsigned int b = position[tris[i - i%3 + (i+1)%3]];
+		halfedges.push_back(((unsigned long long)a << 32) | b);
+	}
+	std::sort(halfedges.begin(), halfedges.end());
+	for(i=0; i<3*count; i++) {
+		unsigned int a = position[tris[i]];
+		unsigned int b = position[tris[i - i%3 + (i+1)%3]];
+		if(!std::binary_search(halfedges.begin(), halfedges.end(),
+		                       ((unsigned long long)b << 32) | a)) {
+			locked[tris[i]] = 1;
+			locked[tris[i - i%3 + (i+1)%3]] = 1;
+		}
+	}
+
+	memset(&quadrics[0], 0, nverts*sizeof(Quadric));
+	for(i=0; i<count; i++) {
+		const float *a = &vertices[(size_t)stride*tris[3*i]];
+		double n[3], len, d;
+		crossNormal(a, &vertices[(size_t)stride*tris[3*i+1]],
+			&vertices[(size_t)stride*tris[3*i+2]], n);
+		len = sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+		if(len == 0.0) continue;
+		for(k=0; k<3; k++) n[k] /= len;
+		d = -(n[0]*a[0] + n[1]*a[1] + n[2]*a[2]);
+		for(k=0; k<3; k++) {
+			addPlane(quadrics[tris[3*i+k]], n, d, 0.5*len);
+		}
+	}
+
+	while(count > targettris) {
+		int limit = (count - targettris + 1) / 2; // A collapse removes about two triangles
+		int done = 0;
+
+		// Consider each edge once, in the cheaper of its two directions
+		collapses.clear();
+		for(i=0; i<3*count; i++) {
+			unsigned int a = tris[i];
+			unsigned int b = tris[i - i%3 + (i+1)%3];
+			Collapse ab, ba;
+			if(a > b) continue;
+			ab.from = a; ab.to = b;
+			ba.from = b; ba.to = a;
+			ab.error = ba.error = 1e30f;
+			if(!locked[a]) {
+				Quadric q = quadrics[a];
+				addQuadric(q, quadrics[b]);
+				ab.error = (float)quadricError(q, &vertices[(size_t)stride*b]);
+			}
+			if(!locked[b]) {
+				Quadric q = quadrics[b];
+				addQuadric(q, quadrics[a]);
+				ba.error = (float)quadricError(q, &vertices[(size_t)stride*a]);
+			}
+			if(locked[a] && locked[b]) continue;
+			collapses.push_back(ab.error <= ba.error ? ab : ba);
+		}
+		if(collapses.empty()) break;
+		std::sort(collapses.begin(), collapses.end());
+
+		// Triangles around each vertex, for the flip test
+		offsets.assign(nverts+1, 0);
+		for(i=0; i<3*count; i++) offsets[tris[i]+1]++;
+		for(i=0; i<nverts; i++) offsets[i+1] += offsets[i];
+		adjacency.resize(3*count);
+		{
+			std::vector<int> fill(offsets.begin(), offsets.end()-1);
+			for(i=0; i<3*count; i++) adjacency[fill[tris[i]]++] = i/3;
+		}
+		touched.assign(nverts, 0);
+
+		for(size_t c=0; c<collapses.size() && done < limit; c++) {
+			unsigned int from = collapses[c].from, to = collapses[c].to;
+			bool flips = false;
+			if(touched[from] || touched[to]) continue;
+
+			// Reject the collapse if a remaining triangle turns more than
+			// about 75 degrees, or becomes degenerate
+			for(k=offsets[from]; k<offsets[from+1] && !flips; k++) {
+				const unsigned int *t = &tris[3*adjacency[k]];
+				const float *p[3], *q[3];
+				double n0[3], n1[3], dot, len;
+				if(t[0] == to || t[1] == to || t[2] == to) continue; // Goes away
+				for(int j=0; j<3; j++) {
+					p[j] = &vertices[(size_t)stride*t[j]];
+					q[j] = (t[j] == from) ? &vertices[(size_t)stride*to] : p[j];
+				}
+				crossNormal(p[0], p[1], p[2], n0);
+				crossNormal(q[0], q[1], q[2], n1);
+				dot = n0[0]*n1[0] + n0[1]*n1[1] + n0[2]*n1[2];
+				len = sqrt((n0[0]*n0[0] + n0[1]*n0[1] + n0[2]*n0[2])
+					* (n1[0]*n1[0] + n1[1]*n1[1] + n1[2]*n1[2]));
+				if(len == 0.0 || dot < 0.25*len) flips = true;
+			}
+			if(flips) continue;
+
+			// Collapse, and keep the whole neighbourhood out of this pass
+			for(k=offsets[from]; k<offsets[from+1]; k++) {
+				const unsigned int *t = &tris[3*adjacency[k]];
+				touched[t[0]] = touched[t[1]] = touched[t[2]] = 1;
+			}
+			touched[to] = 1;
+			for(k=offsets[from]; k<offsets[from+1]; k++) {
+				unsigned int *t = &tris[3*adjacency[k]];
+				for(int j=0; j<3; j++) {
+					if(t[j] == from) t[j] = to;
+				}
+			}
+			addQuadric(quadrics[to], quadrics[from]);
+			maxerror = std::max(maxerror, (double)collapses[c].error);
+			done++;
+		}
+		if(done == 0) break; // Nothing more can be collapsed
+
+		// Drop the triangles that collapsed to a line
+		int kept = 0;
+		for(i=0; i<count; i++) {
+			unsigned int a = tris[3*i], b = tris[3*i+1], c = tris[3*i+2];
+			if(a == b || b == c || c == a) continue;
+			tris[3*kept] = a;
+			tris[3*kept+1] = b;
+			tris[3*kept+2] = c;
+			kept++;
+		}
+		count = kept;
+	}
+
+	for(i=0; i<3*count; i++) {
+		destination[i] = tris[i];
+	}
+	if(resulterror) *resulterror = (float)sqrt(maxerror);
+	return count;
+}
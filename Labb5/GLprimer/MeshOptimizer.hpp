@@ -0,0 +1,117 @@
+/* MeshOptimizer.hpp */
+/*
+ * Functions to reorder indexed triangle meshes for faster rendering.
+ * They work on plain index arrays with three indices per triangle,
+ * and do not make any OpenGL calls. TriangleSoup uses them for its
+ * optional optimization stages.
+ * This code is in the public domain.
+ */
+
+#ifndef MESHOPTIMIZER_HPP // Avoid including this header twice
+#define MESHOPTIMIZER_HPP
+
+#include <vector> // For the list of clusters
+
+namespace MeshOptimizer {
+
+/*
+ * A small group of triangles that are stored next to each other in
+ * the index array, with the data needed to cull them as a whole:
+ * a bounding sphere, and a cone that contains all triangle normals.
+ * The cluster faces away from a camera at position 'eye' if
+ * dot(center - eye, coneaxis) >= conecutoff * |center - eye| + radius.
+ * A cluster with conecutoff >= 1 can never be culled by its cone.
+ */
+struct Cluster {
+    int firsttri;      // First triangle in the index array
+    int ntris;         // Number of triangles
+    int nverts;        // Number of distinct vertices
+    float center[3];   // Bounding sphere
+    float radius;
+    float coneaxis[3]; // Unit vector, average facing direction
+    float conecutoff;  // Sine of the half angle of the normal cone
+};
+
+/*
+ * cacheStats() - Simulate a FIFO post-transform vertex cache with
+ * 'cachesize' entries and return the ACMR (average cache miss ratio,
+ * vertex shader runs per triangle, 0.5 to 3.0). The ATVR (vertex
+ * shader runs per referenced vertex, 1.0 at best) is returned in *atvr.
+ */
+float cacheStats(const unsigned int *indices, int ntris, int nverts,
+    int cachesize, float *atvr);
+
+/*
+ * optimizeVertexCache() - Reorder the triangles for good reuse of
+ * the post-transform vertex cache, using Tom Forsyth's "Linear-speed
+ * vertex cache optimisation" (2006). Runs in linear time.
+ */
+void optimizeVertexCache(unsigned int *indices, int ntris, int nverts);
+
+/*
+ * optimizeVertexFetch() - Renumber the vertices in the order they are
+ * first used by the triangles, and move them around in the interleaved
+ * vertex array (with 'stride' floats per vertex) to match. Vertices that
+ * no triangle uses are dropped. Returns the new number of vertices.
+ */
+int optimizeVertexFetch(float *vertices, int stride, unsigned int *indices,
+    int ntris, int nverts);
+
+/*
+ * optimizeOverdraw() - Reorder the triangles to draw outward facing
+ * parts of the mesh first, using the clustering of Sander, Nehab and
+ * Barczak, "Fast Triangle Reordering for Vertex Locality and Reducing
+ * Overdraw" (2007). The index array should already be optimized with
+ * optimizeVertexCache(). It is split into clusters that each keep
+ * their ACMR within 'threshold' times that of the whole run they are
+ * taken from (1.05 allows 5% more vertex shader runs), and the
+ * clusters are sorted by how much they face away from the centroid.
+ * 'vertices' is an interleaved array with the position first in each
+ * vertex and 'stride' floats per vertex.
+ */
+void optimizeOverdraw(unsigned int *indices, int ntris, const float *vertices,
+    int stride, int nverts, float threshold);
+
+/*
+ * overdrawStats() - Rasterize the mesh in software with depth test and
+ * back face culling, orthographically from the six axis directions
+ * (+x, -x, +y, -y, +z, -z), and return the average overdraw ratio
+ * (shaded fragments per covered pixel, 1.0 at best). The ratio for
+ * each view is stored in 'ratios', if it is not NULL.
+ */
+float overdrawStats(const unsigned int *indices, int ntris, const float *vertices,
+    int stride, int nverts, float ratios[6]);
+
+/*
+ * buildClusters() - Split the mesh into clusters of at most 'maxverts'
+ * distinct vertices and 'maxtris' triangles (64 and 124 are good
+ * values for current GPUs), and reorder the triangles so that each
+ * cluster is a contiguous range of the index array. Clusters are grown
+ * from neighbouring triangles that add few new vertices and face the
+ * same way, to keep the bounding spheres small and the cones narrow.
+ * 'vertices' is an interleaved array with the position first in each
+ * vertex and 'stride' floats per vertex.
+ */
+void buildClusters(unsigned int *indices, int ntris, const float *vertices,
+    int stride, int nverts, int maxverts, int maxtris, std::vector<Cluster> &clusters);
+
+/*
+ * simplify() - Reduce the mesh to about 'targettris' triangles by edge
+ * collapses ordered by the quadric error metric of Garland and Heckbert,
+ * "Surface Simplification Using Quadric Error Metrics" (1997).
+ * Vertices are only moved onto other existing vertices, so the result
+ * indexes the same vertex array. Vertices on UV seams, normal creases
+ * (several vertices with the same position) and open borders are never
+ * moved, and collapses that would flip a triangle are rejected.
+ * The result is written to 'destination', which must have room for
+ * 3*ntris indices, and the number of triangles is returned. The largest
+ * geometric error, as a distance, is stored in *resulterror.
+ * 'vertices' is an interleaved array with the position first in each
+ * vertex and 'stride' floats per vertex.
+ */
+int simplify(unsigned int *destination, const unsigned int *indices, int ntris,
+    const float *vertices, int stride, int nverts, int targettris, float *resulterror);
+
+}
+
+#endif // MESHOPTIMIZER_HPP
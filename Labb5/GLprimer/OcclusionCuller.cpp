@@ -0,0 +1,245 @@
+/* OcclusionCuller.cpp */
+/*
+ * Occlusion culling of heavy meshes with hardware occlusion queries.
+ * See OcclusionCuller.hpp for a description of the class.
+ * This code is in the public domain.
+ */
+
+#include <algorithm> // For std::max()
+
+#include "OcclusionCuller.hpp"
+#include "Utilities.hpp"
+
+/* Constructor: no objects yet. The proxy box is created in begin(),
+ * because the constructor may run before there is an OpenGL context. */
+OcclusionCuller::OcclusionCuller(int mode) {
+
+	this->mode = mode;
+	proxycreated = false;
+	cullface = false;
+	nqueries = 0;
+	ndrawn = 0;
+	nskipped = 0;
+}
+
+
+/* Destructor: delete the queries */
+OcclusionCuller::~OcclusionCuller() {
+
+	for(size_t i=0; i<objects.size(); i++) {
+		if(glIsQuery(objects[i].queries[0])) {
+			glDeleteQueries(2, objects[i].queries);
+		}
+	}
+}
+
+
+/* Add a heavy mesh. Until a query result is read back, it is visible. */
+int OcclusionCuller::addObject(TriangleSoup *mesh) {
+
+	OcclusionObject object;
+
+	object.mesh = mesh;
+	glGenQueries(2, object.queries);
+	object.pending[0] = object.pending[1] = false;
+	object.next = 0;
+	object.visible = true;
+	objects.push_back(object);
+	return (int)objects.size() - 1;
+}
+
+
+/* Choose how the query results are used */
+void OcclusionCuller::setMode(int mode) {
+	this->mode = mode;
+}
+
+
+/*
+ * begin()
+ *
+ * Read the results of the queries that the GPU has finished, oldest
+ * first, so the newest result wins. A query that is not finished is
+ * left for a later frame, because reading it would stall the CPU.
+ * Queries finish in order, so a newer one is never ready before an
+ * older one.
+ */
+void OcclusionCuller::begin() {
+
+	if(!proxycreated) {
+		proxy.createBox(1.0f, 1.0f, 1.0f);
+		proxycreated = true;
+	}
+	cullface = glIsEnabled(GL_CULL_FACE) == GL_TRUE;
+	nqueries = 0;
+	ndrawn = 0;
+	nskipped = 0;
+
+	for(size_t i=0; i<objects.size(); i++) {
+		OcclusionObject &object = objects[i];
+		for(int k=0; k<2; k++) {
+			int slot = (object.next + k) & 1;
+			GLuint available = 0, passed = 0;
+			if(!object.pending[slot]) continue;
+			glGetQueryObjectuiv(object.queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available) break;
+			glGetQueryObjectuiv(object.queries[slot], GL_QUERY_RESULT, &passed);
+			object.visible = (passed != 0);
+			object.pending[slot] = false;
+		}
+	}
+}
+
+
+/*
+ * render(int id, float MV[], GLint mvlocation)
+ *
+ * Draw the proxy in a query, then the mesh. If the camera is inside the
+ * proxy, the query could come out empty for a mesh right in front of the
+ * camera, so the mesh is then drawn without a query. A query is never
+ * issued again before its result is read, or a GPU that runs more than
+ * a frame behind would never deliver any results.
+ */
+bool OcclusionCuller::render(int id, float MV[], GLint mvlocation) {
+
+	float PM[16];
+
+	if(id < 0 || id >= (int)objects.size()) return false;
+	OcclusionObject &object = objects[id];
+
+	if(proxyMatrix(object.mesh, MV, PM)) {
+		glUniformMatrix4fv(mvlocation, 1, GL_FALSE, MV);
+		object.mesh->render();
+		object.visible = true;
+		ndrawn++;
+		return true;
+	}
+
+	if(object.pending[object.next]) {
+		// Both queries are still waiting for the GPU. Keep them,
+		// and go by the last result without a new query.
+		if(mode == OCCLUSION_LASTFRAME && !object.visible) {
+			nskipped++;
+			return false;
+		}
+		glUniformMatrix4fv(mvlocation, 1, GL_FALSE, MV);
+		object.mesh->render();
+		ndrawn++;
+		return true;
+	}
+
+	drawProxy(object, PM, mvlocation);
+	glUniformMatrix4fv(mvlocation, 1, GL_FALSE, MV);
+	if(mode == OCCLUSION_CONDITIONAL) {
+		// The GPU waits for the query, but the CPU goes on
+		glBeginConditionalRender(object.queries[1 - object.next], GL_QUERY_WAIT);
+		object.mesh->render();
+		glEndConditionalRender();
+	}
+	else {
+		if(!object.visible) {
+			nskipped++;
+			return false;
+		}
+		object.mesh->render();
+	}
+	ndrawn++;
+	return true;
+}
+
+
+/* Counts for the current frame, since begin() */
+int OcclusionCuller::queryCount() {
+	return nqueries;
+}
+
+int OcclusionCuller::drawnCount() {
+	return ndrawn;
+}
+
+int OcclusionCuller::skippedCount() {
+	return nskipped;
+}
+
+
+/* Number of objects that were hidden by the last results read back */
+int OcclusionCuller::hiddenCount() {
+
+	int hidden = 0;
+
+	for(size_t i=0; i<objects.size(); i++) {
+		if(!objects[i].visible) hidden++;
+	}
+	return hidden;
+}
+
+
+/*
+ * private
+ * proxyMatrix() - Make the modelview matrix PM for the proxy box of
+ * a mesh. The box is made a little larger than the bounding box, so
+ * the front of the mesh can't hide it, and a flat mesh still gets a
+ * box with some depth. Returns true if the camera is inside the
+ * bounding sphere of the box.
+ */
+bool OcclusionCuller::proxyMatrix(TriangleSoup *mesh, float MV[], float PM[]) {
+
+	float min[3], max[3], center[3], half[3], largest = 0.0f;
+	float T[16], S[16], M[16];
+	float viewcenter[3], radius = 0.0f, scale = 0.0f, distance = 0.0f;
+
+	mesh->bounds(min, max);
+	for(int k=0; k<3; k++) {
+		center[k] = 0.5f*(min[k] + max[k]);
+		half[k] = 0.5f*(max[k] - min[k]);
+		largest = std::max(largest, half[k]);
+	}
+	for(int k=0; k<3; k++) {
+		half[k] += 0.01f*largest + 1e-6f;
+		radius += half[k]*half[k];
+	}
+	Utilities::mat4translate(T, center[0], center[1], center[2]);
+	Utilities::mat4scale(S, half[0], half[1], half[2]);
+	Utilities::mat4mult(T, S, M);
+	Utilities::mat4mult(MV, M, PM);
+
+	// The bounding sphere of the box in view space, scaled by the
+	// largest scaling in MV
+	for(int k=0; k<3; k++) {
+		viewcenter[k] = MV[12+k] + MV[k]*center[0] + MV[4+k]*center[1] + MV[8+k]*center[2];
+		distance += viewcenter[k]*viewcenter[k];
+		scale = std::max(scale, MV[4*k]*MV[4*k] + MV[4*k+1]*MV[4*k+1] + MV[4*k+2]*MV[4*k+2]);
+	}
+	return distance <= radius*scale;
+}
+
+
+/*
+ * private
+ * drawProxy() - Draw the proxy box in the next query of the object.
+ * Only the depth test matters, so nothing is written. Back faces are
+ * drawn too, because front faces clipped by the near plane would
+ * otherwise leave no samples for a box that is partly in view.
+ */
+void OcclusionCuller::drawProxy(OcclusionObject &object, float PM[], GLint mvlocation) {
+
+	glUniformMatrix4fv(mvlocation, 1, GL_FALSE, PM);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthMask(GL_FALSE);
+	if(cullface) {
+		glDisable(GL_CULL_FACE);
+	}
+
+	glBeginQuery(GL_ANY_SAMPLES_PASSED, object.queries[object.next]);
+	proxy.render();
+	glEndQuery(GL_ANY_SAMPLES_PASSED);
+
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glDepthMask(GL_TRUE);
+	if(cullface) {
+		glEnable(GL_CULL_FACE);
+	}
+	object.pending[object.next] = true;
+	object.next = 1 - object.next;
+	nqueries++;
+}
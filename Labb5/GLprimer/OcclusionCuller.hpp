@@ -0,0 +1,104 @@
+/* OcclusionCuller.hpp */
+/*
+ * Occlusion culling of heavy meshes with hardware occlusion queries.
+ * Usage: addObject() each heavy mesh once. Each frame, draw the large
+ * occluders (walls, floors) first, then call begin() and render() each
+ * heavy object with its modelview matrix.
+ * render() draws a bounding box proxy of the mesh, with color and depth
+ * writes turned off, inside a GL_ANY_SAMPLES_PASSED query. In the
+ * OCCLUSION_CONDITIONAL mode, the real mesh is then drawn inside
+ * glBeginConditionalRender() on that query, so the GPU skips it if no
+ * sample of the box passed the depth test. In the OCCLUSION_LASTFRAME
+ * mode, the real mesh is drawn or skipped by the result of an earlier
+ * frame, which saves the GPU from waiting for the query, but may skip
+ * an object during the first frame it comes into view.
+ * Query results are only read back when they are available, which they
+ * normally are one frame later, so the CPU never waits for the GPU.
+ * Each object has two queries that are used every other frame, so a
+ * new query never replaces the one that is about to be read. If both
+ * are still waiting for the GPU, the object goes without a query for
+ * that frame.
+ * This code is in the public domain.
+ */
+
+#ifndef OCCLUSIONCULLER_HPP // Avoid including this header twice
+#define OCCLUSIONCULLER_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h> // To use OpenGL datatypes
+#include <vector>       // For the objects
+
+#include "TriangleSoup.hpp"
+
+class OcclusionCuller {
+
+public:
+
+/* Modes for setMode() */
+enum {
+    OCCLUSION_CONDITIONAL = 0, // Draw under conditional rendering on this frame's query
+    OCCLUSION_LASTFRAME = 1    // Draw or skip by the last result read back
+};
+
+/* Constructor: no objects yet */
+OcclusionCuller(int mode = OCCLUSION_CONDITIONAL);
+
+/* Destructor: delete the queries */
+~OcclusionCuller();
+
+/* Add a heavy mesh. Returns an id for render(). The mesh is not
+ * owned by the culler, so it must outlive it. */
+int addObject(TriangleSoup *mesh);
+
+/* Choose how the query results are used */
+void setMode(int mode);
+
+/* Start a new frame, and read the query results that are ready */
+void begin();
+
+/* Query the visibility of an object and draw it, with MV in the
+ * uniform mat4 at 'mvlocation' of the shader in use. Returns false
+ * if the object was skipped without drawing by the CPU. */
+bool render(int id, float MV[], GLint mvlocation);
+
+/* Counts for the current frame, since begin() */
+int queryCount();   // Proxies drawn
+int drawnCount();   // Meshes sent to the GPU, conditionally or not
+int skippedCount(); // Meshes skipped by the last frame's result
+
+/* Number of objects that were hidden by the last results read back */
+int hiddenCount();
+
+private:
+
+struct OcclusionObject {
+    TriangleSoup *mesh;
+    GLuint queries[2]; // Used every other frame
+    bool pending[2];   // Issued, but the result is not read yet
+    int next;          // The query to issue next, the older one
+    bool visible;      // The last result read back
+};
+
+int mode;
+std::vector<OcclusionObject> objects;
+TriangleSoup proxy;  // A box from -1 to 1, scaled to the bounds of each mesh
+bool proxycreated;
+bool cullface;       // Whether GL_CULL_FACE was enabled at begin()
+int nqueries;
+int ndrawn;
+int nskipped;
+
+bool proxyMatrix(TriangleSoup *mesh, float MV[], float PM[]);
+
+void drawProxy(OcclusionObject &object, float PM[], GLint mvlocation);
+
+/* The queries are a unique resource, so copying is not allowed */
+OcclusionCuller(const OcclusionCuller &);
+OcclusionCuller &operator=(const OcclusionCuller &);
+
+};
+
+#endif // OCCLUSIONCULLER_HPP
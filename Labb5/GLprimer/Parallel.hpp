@@ -0,0 +1,29 @@
+/* Parallel.hpp */
+/*
+ * A small helper to split work between threads, for the classes that
+ * do heavy work on the CPU (TriangleSoup, SoftwareOcclusion). It uses
+ * no OpenGL, so it can be used by code that must build without it.
+ * This code is in the public domain.
+ */
+
+#ifndef PARALLEL_HPP // Avoid including this header twice
+#define PARALLEL_HPP
+
+#include <thread> // For the worker threads
+#include <vector> // For the list of workers
+
+/* Run func(0) ... func(n-1) in parallel, one thread for each, and
+ * return when all of them are done. func(0) runs in the calling thread. */
+template<class Function>
+void runParallel(int n, Function func) {
+	std::vector<std::thread> workers;
+	for(int i=1; i<n; i++) {
+		workers.push_back(std::thread(func, i));
+	}
+	func(0); // Do one part of the work in this thread
+	for(size_t i=0; i<workers.size(); i++) {
+		workers[i].join();
+	}
+}
+
+#endif // PARALLEL_HPP
@@ -0,0 +1,459 @@
+/* Scene.cpp */
+/*
+ * Scene objects with a bounding volume hierarchy for culling.
+ * See Scene.hpp for a description of the class.
+ * This code is in the public domain.
+ */
+
+#include <cstdio>    // For printf()
+#include <cmath>     // For fabsf()
+#include <algorithm> // For std::partition() and std::sort()
+
+#include "Scene.hpp"
+#include "TriangleSoup.hpp"
+#include "Utilities.hpp"
+
+// Build parameters. A leaf is made for few objects, or when no split is
+// cheaper by the SAH, but never for more than LEAF_MAX objects unless
+// they can't be told apart by their centroids.
+#define SAH_BINS 16
+#define LEAF_MIN 2
+#define LEAF_MAX 8
+#define SAH_TRAVERSAL 1.0f // Cost of visiting a node, relative to an object
+#define REFIT_LIMIT 2.0f   // Rebuild when refits make the nodes this much larger
+
+/* Half the surface area of a box, which is all the SAH needs */
+static float halfArea(const float min[3], const float max[3]) {
+
+	float dx = max[0] - min[0], dy = max[1] - min[1], dz = max[2] - min[2];
+	return dx*dy + dy*dz + dz*dx;
+}
+
+/* Grow the box min, max to contain the box omin, omax */
+static void growBox(float min[3], float max[3], const float omin[3], const float omax[3]) {
+
+	for(int k=0; k<3; k++) {
+		min[k] = std::min(min[k], omin[k]);
+		max[k] = std::max(max[k], omax[k]);
+	}
+}
+
+/* Make the box empty, so any box grown into it replaces it */
+static void emptyBox(float min[3], float max[3]) {
+
+	for(int k=0; k<3; k++) {
+		min[k] = 1e30f;
+		max[k] = -1e30f;
+	}
+}
+
+
+/* Constructor: create an empty scene */
+Scene::Scene() {
+
+	Utilities::mat4identity(V);
+	needbuild = false;
+	needrefit = false;
+	builtarea = 0.0f;
+	nliving = 0;
+	nodesvisited = 0;
+	objectstested = 0;
+}
+
+
+/* Add an object with the model matrix M */
+int Scene::addObject(TriangleSoup *mesh, float M[], GLuint texture) {
+
+	SceneObject object;
+
+	object.mesh = mesh;
+	for(int i=0; i<16; i++) {
+		object.M[i] = M[i];
+	}
+	object.texture = texture;
+	object.lod = -1;
+	objectBounds(object);
+	objects.push_back(object);
+	nliving++;
+	needbuild = true;
+	return (int)objects.size() - 1;
+}
+
+
+/* Remove an object. Its id is not used again. */
+void Scene::removeObject(int id) {
+
+	if(id < 0 || id >= (int)objects.size() || !objects[id].mesh) return;
+	objects[id].mesh = NULL;
+	nliving--;
+	needbuild = true;
+}
+
+
+/* Move an object. The tree is refitted at the next cull(). */
+void Scene::setTransform(int id, float M[]) {
+
+	if(id < 0 || id >= (int)objects.size() || !objects[id].mesh) return;
+	for(int i=0; i<16; i++) {
+		objects[id].M[i] = M[i];
+	}
+	objectBounds(objects[id]);
+	needrefit = true;
+}
+
+
+/*
+ * cull(float P[], float V[])
+ *
+ * Walk the tree from the root. Each node carries a mask of the frustum
+ * planes that its parent straddles. Planes that a node is completely
+ * inside of are dropped from the mask for its children, and when no
+ * planes are left, the whole subtree is visible.
+ */
+int Scene::cull(float P[], float V[]) {
+
+	float PV[16], planes[24];
+	int stack[64], planemasks[64];
+	int top = 0;
+
+	if(needbuild) {
+		build();
+	}
+	else if(needrefit) {
+		refit();
+	}
+	for(int i=0; i<16; i++) {
+		this->V[i] = V[i];
+	}
+	Utilities::mat4mult(P, V, PV);
+	Utilities::mat4frustumPlanes(PV, planes);
+
+	drawlist.clear();
+	nodesvisited = 0;
+	objectstested = 0;
+	if(nodes.empty()) return 0;
+
+	stack[top] = 0;
+	planemasks[top++] = 0x3f; // All six planes
+	while(top > 0) {
+		int node = stack[--top];
+		int mask = planemasks[top];
+		const BVHNode &n = nodes[node];
+
+		nodesvisited++;
+		int inside = classify(n.min, n.max, planes, &mask);
+		if(inside < 0) continue; // Completely outside
+		if(inside > 0) { // Completely inside
+			addSubtree(node);
+			continue;
+		}
+		if(n.count > 0) {
+			for(int i=n.first; i<n.first+n.count; i++) {
+				const SceneObject &object = objects[order[i]];
+				int objectmask = mask;
+				objectstested++;
+				if(classify(object.min, object.max, planes, &objectmask) >= 0) {
+					drawlist.push_back(order[i]);
+				}
+			}
+		}
+		else if(top + 2 <= 64) {
+			stack[top] = n.first;
+			planemasks[top++] = mask;
+			stack[top] = n.first + 1;
+			planemasks[top++] = mask;
+		}
+		else { // Too deep for the stack, which SAH trees never are
+			addSubtree(node);
+		}
+	}
+
+	// Sort to switch textures and meshes as seldom as possible
+	std::sort(drawlist.begin(), drawlist.end(), [this](int a, int b) {
+		if(objects[a].texture != objects[b].texture) {
+			return objects[a].texture < objects[b].texture;
+		}
+		if(objects[a].mesh != objects[b].mesh) {
+			return objects[a].mesh < objects[b].mesh;
+		}
+		return a < b;
+	});
+	return (int)drawlist.size();
+}
+
+
+/* The objects found by the last cull(), sorted by texture and mesh */
+const std::vector<int> &Scene::drawList() {
+	return drawlist;
+}
+
+
+/* Draw the objects in the draw list */
+int Scene::render(GLint mvlocation, float P[], int viewportheight, float pixelerror) {
+
+	float MV[16];
+	GLuint texture = 0;
+
+	for(size_t i=0; i<drawlist.size(); i++) {
+		SceneObject &object = objects[drawlist[i]];
+		Utilities::mat4mult(V, object.M, MV);
+		glUniformMatrix4fv(mvlocation, 1, GL_FALSE, MV);
+		if(object.texture != texture || i == 0) {
+			texture = object.texture;
+			glBindTexture(GL_TEXTURE_2D, texture);
+		}
+		// Keep the level per object, since objects may share a mesh
+		object.lod = object.mesh->selectLOD(MV, P, viewportheight, pixelerror, object.lod);
+		object.mesh->renderLOD(object.lod);
+	}
+	return (int)drawlist.size();
+}
+
+
+/* Number of objects in the scene */
+int Scene::objectCount() {
+	return nliving;
+}
+
+
+/* Print the size of the tree and the work done by the last cull() */
+void Scene::printInfo() {
+
+	int leaves = 0;
+
+	for(size_t i=0; i<nodes.size(); i++) {
+		if(nodes[i].count > 0) leaves++;
+	}
+	printf("Scene information:\n");
+	printf("objects: %d\n", nliving);
+	printf("BVH    : %d nodes, %d leaves\n", (int)nodes.size(), leaves);
+	printf("cull   : %d visible, %d nodes visited, %d objects tested\n",
+		(int)drawlist.size(), nodesvisited, objectstested);
+}
+
+
+/*
+ * private
+ * build() - Build the tree from scratch over all objects.
+ */
+void Scene::build() {
+
+	order.clear();
+	nodes.clear();
+	for(int i=0; i<(int)objects.size(); i++) {
+		if(objects[i].mesh) order.push_back(i);
+	}
+	needbuild = false;
+	needrefit = false;
+	if(order.empty()) return;
+
+	nodes.reserve(2*order.size());
+	nodes.resize(1); // The root, which buildNode() fills in
+	buildNode(0, 0, (int)order.size());
+
+	builtarea = 0.0f;
+	for(size_t i=0; i<nodes.size(); i++) {
+		builtarea += halfArea(nodes[i].min, nodes[i].max);
+	}
+}
+
+
+/*
+ * private
+ * buildNode() - Make a node for 'count' objects from 'first' in order,
+ * and split it recursively. The objects are put into SAH_BINS bins by
+ * their centroids along each axis, and the split between two bins with
+ * the lowest cost area(left)*count(left) + area(right)*count(right)
+ * is taken, if it is cheaper than a leaf.
+ */
+void Scene::buildNode(int node, int first, int count) {
+
+	float cmin[3], cmax[3], bestcost;
+	int bestaxis = -1, bestbin = 0;
+
+	emptyBox(nodes[node].min, nodes[node].max);
+	emptyBox(cmin, cmax);
+	for(int i=first; i<first+count; i++) {
+		const SceneObject &object = objects[order[i]];
+		float centroid[3];
+		for(int k=0; k<3; k++) {
+			centroid[k] = 0.5f*(object.min[k] + object.max[k]);
+		}
+		growBox(nodes[node].min, nodes[node].max, object.min, object.max);
+		growBox(cmin, cmax, centroid, centroid);
+	}
+	nodes[node].first = first;
+	nodes[node].count = count;
+	if(count <= LEAF_MIN) return;
+
+	bestcost = halfArea(nodes[node].min, nodes[node].max) * (count - SAH_TRAVERSAL);
+	for(int axis=0; axis<3; axis++) {
+		float extent = cmax[axis] - cmin[axis];
+		float binmin[SAH_BINS][3], binmax[SAH_BINS][3];
+		int bincount[SAH_BINS] = {0};
+		float rightarea[SAH_BINS];
+		int rightcount[SAH_BINS];
+		float min[3], max[3];
+
+		if(extent <= 0.0f) continue;
+		for(int b=0; b<SAH_BINS; b++) {
+			emptyBox(binmin[b], binmax[b]);
+		}
+		for(int i=first; i<first+count; i++) {
+			const SceneObject &object = objects[order[i]];
+			float centroid = 0.5f*(object.min[axis] + object.max[axis]);
+			int b = std::min(SAH_BINS - 1, (int)(SAH_BINS*(centroid - cmin[axis])/extent));
+			bincount[b]++;
+			growBox(binmin[b], binmax[b], object.min, object.max);
+		}
+		// Sweep from the right to get the areas and counts right of each split...
+		emptyBox(min, max);
+		for(int b=SAH_BINS-1, n=0; b>0; b--) {
+			n += bincount[b];
+			growBox(min, max, binmin[b], binmax[b]);
+			rightarea[b] = n ? halfArea(min, max) : 0.0f;
+			rightcount[b] = n;
+		}
+		// ...then from the left to find the cheapest split
+		emptyBox(min, max);
+		for(int b=1, n=0; b<SAH_BINS; b++) {
+			n += bincount[b-1];
+			growBox(min, max, binmin[b-1], binmax[b-1]);
+			if(n == 0 || rightcount[b] == 0) continue;
+			float cost = halfArea(min, max)*n + rightarea[b]*rightcount[b];
+			if(cost < bestcost) {
+				bestcost = cost;
+				bestaxis = axis;
+				bestbin = b;
+			}
+		}
+	}
+	if(bestaxis < 0) {
+		if(count <= LEAF_MAX) return; // A leaf is cheaper
+		// Too many for a leaf, so split at the middle of the widest axis
+		bestaxis = 0;
+		for(int k=1; k<3; k++) {
+			if(cmax[k] - cmin[k] > cmax[bestaxis] - cmin[bestaxis]) bestaxis = k;
+		}
+		if(cmax[bestaxis] <= cmin[bestaxis]) return; // All centroids are the same
+		bestbin = SAH_BINS/2;
+	}
+
+	float extent = cmax[bestaxis] - cmin[bestaxis];
+	float axismin = cmin[bestaxis];
+	int axis = bestaxis, bin = bestbin;
+	int *middle = std::partition(&order[first], &order[first] + count, [&](int id) {
+		float centroid = 0.5f*(objects[id].min[axis] + objects[id].max[axis]);
+		return std::min(SAH_BINS - 1, (int)(SAH_BINS*(centroid - axismin)/extent)) < bin;
+	});
+	int leftcount = (int)(middle - &order[first]);
+	if(leftcount == 0 || leftcount == count) return; // Can't happen, but stay safe
+
+	int left = (int)nodes.size();
+	nodes.resize(nodes.size() + 2);
+	nodes[node].first = left;
+	nodes[node].count = 0;
+	buildNode(left, first, leftcount);
+	buildNode(left + 1, first + leftcount, count - leftcount);
+}
+
+
+/*
+ * private
+ * refit() - Update the boxes of all nodes after objects have moved,
+ * without changing the structure of the tree. Children come after
+ * their parents, so a backwards pass updates the children first.
+ */
+void Scene::refit() {
+
+	float area = 0.0f;
+
+	needrefit = false;
+	for(int i=(int)nodes.size()-1; i>=0; i--) {
+		BVHNode &n = nodes[i];
+		emptyBox(n.min, n.max);
+		if(n.count > 0) {
+			for(int j=n.first; j<n.first+n.count; j++) {
+				growBox(n.min, n.max, objects[order[j]].min, objects[order[j]].max);
+			}
+		}
+		else {
+			growBox(n.min, n.max, nodes[n.first].min, nodes[n.first].max);
+			growBox(n.min, n.max, nodes[n.first+1].min, nodes[n.first+1].max);
+		}
+		area += halfArea(n.min, n.max);
+	}
+	// Objects that moved apart leave large, overlapping nodes behind
+	if(area > REFIT_LIMIT*builtarea) {
+		build();
+	}
+}
+
+
+/*
+ * private
+ * objectBounds() - Transform the bounding box of the mesh with M.
+ * The new box has the transformed center, and its half size along each
+ * axis is the half size of the mesh box times |M| (Arvo 1990).
+ */
+void Scene::objectBounds(SceneObject &object) {
+
+	float min[3], max[3], center[3], half[3];
+	const float *M = object.M;
+
+	object.mesh->bounds(min, max);
+	for(int k=0; k<3; k++) {
+		center[k] = 0.5f*(min[k] + max[k]);
+		half[k] = 0.5f*(max[k] - min[k]);
+	}
+	for(int k=0; k<3; k++) {
+		float c = M[12+k] + M[k]*center[0] + M[4+k]*center[1] + M[8+k]*center[2];
+		float h = fabsf(M[k])*half[0] + fabsf(M[4+k])*half[1] + fabsf(M[8+k])*half[2];
+		object.min[k] = c - h;
+		object.max[k] = c + h;
+	}
+}
+
+
+/*
+ * private
+ * addSubtree() - Add all objects below a node to the draw list.
+ * The leaves of a subtree are a contiguous range of 'order', so
+ * only the first and the last leaf need to be found.
+ */
+void Scene::addSubtree(int node) {
+
+	int firstleaf = node, lastleaf = node;
+
+	while(nodes[firstleaf].count == 0) firstleaf = nodes[firstleaf].first;
+	while(nodes[lastleaf].count == 0) lastleaf = nodes[lastleaf].first + 1;
+	for(int i=nodes[firstleaf].first; i<nodes[lastleaf].first+nodes[lastleaf].count; i++) {
+		drawlist.push_back(order[i]);
+	}
+}
+
+
+/*
+ * private
+ * classify() - Test a box against the frustum planes in *planemask.
+ * Returns -1 if the box is completely outside a plane. Otherwise,
+ * the planes that the box is completely inside of are removed from
+ * *planemask, and 1 is returned if none remain, else 0.
+ */
+int Scene::classify(const float min[3], const float max[3], const float planes[24],
+	int *planemask) {
+
+	for(int k=0; k<6; k++) {
+		if(!(*planemask & (1 << k))) continue;
+		const float *plane = &planes[4*k];
+		// The corners of the box furthest along and against the normal
+		float far = plane[3], near = plane[3];
+		for(int j=0; j<3; j++) {
+			far += plane[j] * (plane[j] > 0.0f ? max[j] : min[j]);
+			near += plane[j] * (plane[j] > 0.0f ? min[j] : max[j]);
+		}
+		if(far < 0.0f) return -1;
+		if(near >= 0.0f) *planemask &= ~(1 << k);
+	}
+	return (*planemask == 0) ? 1 : 0;
+}
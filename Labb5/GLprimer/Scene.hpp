@@ -0,0 +1,114 @@
+/* Scene.hpp */
+/*
+ * A container for the objects of a scene: a mesh, a model matrix and
+ * a texture for each, with a bounding volume hierarchy (BVH) over their
+ * world space bounding boxes for fast view frustum culling.
+ * Usage: addObject() each object once, setTransform() when it moves,
+ * and call cull() and render() once per frame. The meshes are not
+ * owned by the scene, so they must outlive it.
+ * The BVH is built top-down with the surface area heuristic (SAH) over
+ * binned object centroids. When objects move, the boxes of the nodes
+ * are only refitted, which is much faster than a new build. If that
+ * makes the tree too loose, it is rebuilt. cull() walks the tree and
+ * skips whole subtrees outside the frustum, and accepts whole subtrees
+ * inside it without further tests, so it only looks at a small part of
+ * the objects in a large scene.
+ * This code is in the public domain.
+ */
+
+#ifndef SCENE_HPP // Avoid including this header twice
+#define SCENE_HPP
+
+#ifdef __APPLE__
+#define GLFW_INCLUDE_GLCOREARB
+#endif
+
+#include <GLFW/glfw3.h> // To use OpenGL datatypes
+#include <vector>       // For the objects and the tree
+
+class TriangleSoup;
+
+class Scene {
+
+public:
+
+/* Constructor: create an empty scene */
+Scene();
+
+/* Add an object with the model matrix M, drawn with 'texture' bound to
+ * GL_TEXTURE_2D (0 for none). Returns an id for the other methods. */
+int addObject(TriangleSoup *mesh, float M[], GLuint texture = 0);
+
+/* Remove an object. Its id is not used again. */
+void removeObject(int id);
+
+/* Move an object. The tree is refitted at the next cull(). */
+void setTransform(int id, float M[]);
+
+/* Find the objects that may be visible through P*V, where V is the
+ * view matrix. Returns the number of objects in the draw list. */
+int cull(float P[], float V[]);
+
+/* The objects found by the last cull(), sorted by texture and mesh */
+const std::vector<int> &drawList();
+
+/* Draw the objects in the draw list, each with V*M in the uniform mat4
+ * at 'mvlocation', at the level of detail that keeps the error below
+ * 'pixelerror' pixels (see TriangleSoup::renderLOD()). Returns the
+ * number of objects drawn. */
+int render(GLint mvlocation, float P[], int viewportheight, float pixelerror);
+
+/* Number of objects in the scene */
+int objectCount();
+
+/* Print the size of the tree and the work done by the last cull() */
+void printInfo();
+
+private:
+
+struct SceneObject {
+	TriangleSoup *mesh; // NULL for a removed object
+	float M[16];        // Model matrix
+	float min[3];       // World space bounding box
+	float max[3];
+	GLuint texture;
+	int lod;            // Level of detail drawn last, or -1
+};
+
+/* A node of the tree. Inner nodes have count = 0 and their
+ * children at 'first' and 'first' + 1, leaves have 'count'
+ * objects from 'first' in 'order'. */
+struct BVHNode {
+	float min[3];
+	float max[3];
+	int first;
+	int count;
+};
+
+std::vector<SceneObject> objects;
+std::vector<int> order;     // Object ids in the order of the leaves
+std::vector<BVHNode> nodes; // Root first, children always after their parent
+std::vector<int> drawlist;
+float V[16];                // View matrix of the last cull()
+bool needbuild;             // Objects were added or removed
+bool needrefit;             // Objects were moved
+float builtarea;            // Sum of the node areas after the last build
+int nliving;                // Objects not removed
+int nodesvisited;           // Statistics of the last cull()
+int objectstested;
+
+void build();
+
+void buildNode(int node, int first, int count);
+
+void refit();
+
+void objectBounds(SceneObject &object);
+
+void addSubtree(int node);
+
+int classify(const float min[3], const float max[3], const float planes[24], int *planemask);
+
+};
+
+#endif // SCENE_HPP
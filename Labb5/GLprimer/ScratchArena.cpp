@@ -0,0 +1,349 @@
+/* ScratchArena.cpp */
+/*
+ * A growable scratch allocator for the temporary arrays of loaders.
+ * See ScratchArena.hpp for a description of the class.
+ * Large blocks are mapped with VirtualAlloc() on Windows and with
+ * mmap() on other platforms, to be able to ask for huge pages.
+ * This code is in the public domain.
+ */
+
+#include <cstdint>   // For uintptr_t and SIZE_MAX
+#include <algorithm> // For std::max()
+#include <mutex>     // For the shared pool
+
+#include "ScratchArena.hpp"
+
+#ifdef __WIN32__
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+/* Size of a huge page where the OS doesn't tell us (2 MB on x86-64) */
+static const size_t HUGE_PAGE_SIZE = 2 << 20;
+
+/* The shared pool for acquire() and release(), emptied at exit */
+static struct ArenaPool {
+	std::vector<ScratchArena*> arenas;
+	~ArenaPool() {
+		for(size_t i=0; i<arenas.size(); i++) {
+			delete arenas[i];
+		}
+	}
+} pool;
+static std::mutex poolmutex;
+
+/* Constructor: no memory until the first allocate() */
+ScratchArena::ScratchArena(size_t blocksize) {
+
+	current = 0;
+	this->blocksize = (blocksize > 0) ? blocksize : 1;
+	usedbytes = 0;
+	peakbytes = 0;
+}
+
+
+/* Destructor: give all blocks back to the OS */
+ScratchArena::~ScratchArena() {
+	trim();
+}
+
+
+/*
+ * allocate(size_t bytes, size_t alignment)
+ *
+ * Take memory from the current block, or move on to the next one if
+ * it is full. A new block is at least as large as all the others
+ * together, so the number of blocks stays small. The unused end of a
+ * full block is left until the arena is rewound. Returns NULL if the
+ * OS is out of memory, or if the request is so large that its size
+ * with the alignment would wrap around.
+ */
+void *ScratchArena::allocate(size_t bytes, size_t alignment) {
+
+	size_t padding, total;
+
+	if(bytes == 0) bytes = 1; // Every allocation gets an address of its own
+	if(bytes > SIZE_MAX - alignment) return NULL;
+
+	while(current < blocks.size()) {
+		Block &block = blocks[current];
+		padding = (0 - (uintptr_t)(block.data + block.used)) & (alignment - 1);
+		if(padding + bytes <= block.size - block.used) {
+			void *pointer = block.data + block.used + padding;
+			block.used += padding + bytes;
+			usedbytes += padding + bytes;
+			if(usedbytes > peakbytes) peakbytes = usedbytes;
+			return pointer;
+		}
+		if(current + 1 == blocks.size()) break;
+		current++;
+		if(blocks[current].size < bytes + alignment) {
+			// This block could never hold the request, so make it larger
+			freeBlock(blocks[current]);
+			if(!newBlock(blocks[current], bytes + alignment)) {
+				blocks.erase(blocks.begin() + current, blocks.end());
+				current--;
+				return NULL;
+			}
+		}
+	}
+
+	total = capacity();
+	Block block;
+	if(!newBlock(block, std::max(std::max(blocksize, total), bytes + alignment))) {
+		return NULL;
+	}
+	blocks.push_back(block);
+	current = blocks.size() - 1;
+	return allocate(bytes, alignment);
+}
+
+
+/* The current end of the used memory */
+ScratchArena::Mark ScratchArena::mark() {
+
+	Mark position;
+
+	position.block = current;
+	position.offset = (current < blocks.size()) ? blocks[current].used : 0;
+	return position;
+}
+
+
+/* Give back everything allocated after 'position' */
+void ScratchArena::rewind(Mark position) {
+
+	if(position.block >= blocks.size()) return; // Nothing was allocated
+
+	for(size_t i=position.block+1; i<blocks.size(); i++) {
+		blocks[i].used = 0;
+	}
+	blocks[position.block].used = position.offset;
+	current = position.block;
+	usedbytes = 0;
+	for(size_t i=0; i<=current; i++) {
+		usedbytes += blocks[i].used;
+	}
+}
+
+
+/*
+ * reset()
+ *
+ * Give back everything. If the arena had to grow, its blocks are
+ * replaced by one that is as large as all of them, so the next load
+ * of the same size fits without moving between blocks.
+ */
+void ScratchArena::reset() {
+
+	size_t total;
+
+	if(blocks.size() > 1) {
+		total = capacity();
+		trim();
+		if(total > blocksize) blocksize = total;
+		return;
+	}
+	if(!blocks.empty()) {
+		blocks[0].used = 0;
+	}
+	current = 0;
+	usedbytes = 0;
+}
+
+
+/* Give back everything, and free all blocks */
+void ScratchArena::trim() {
+
+	for(size_t i=0; i<blocks.size(); i++) {
+		freeBlock(blocks[i]);
+	}
+	blocks.clear();
+	current = 0;
+	usedbytes = 0;
+}
+
+
+/* Whether a pointer is inside one of the blocks */
+bool ScratchArena::contains(const void *pointer) {
+
+	const char *p = (const char*)pointer;
+
+	for(size_t i=0; i<blocks.size(); i++) {
+		if(p >= blocks[i].data && p < blocks[i].data + blocks[i].size) return true;
+	}
+	return false;
+}
+
+
+/* Bytes in use */
+size_t ScratchArena::used() {
+	return usedbytes;
+}
+
+
+/* Most bytes in use since resetPeak() */
+size_t ScratchArena::peak() {
+	return peakbytes;
+}
+
+
+/* Bytes in all blocks */
+size_t ScratchArena::capacity() {
+
+	size_t total = 0;
+
+	for(size_t i=0; i<blocks.size(); i++) {
+		total += blocks[i].size;
+	}
+	return total;
+}
+
+
+/* Bytes in blocks that are backed by huge pages */
+size_t ScratchArena::hugePageBytes() {
+
+	size_t total = 0;
+
+	for(size_t i=0; i<blocks.size(); i++) {
+		if(blocks[i].huge) total += blocks[i].size;
+	}
+	return total;
+}
+
+
+/* Start a new peak() measurement from the current use */
+void ScratchArena::resetPeak() {
+	peakbytes = usedbytes;
+}
+
+
+/* Take an arena from the shared pool, or a new one if it is empty */
+ScratchArena *ScratchArena::acquire() {
+
+	std::lock_guard<std::mutex> lock(poolmutex);
+
+	if(pool.arenas.empty()) {
+		return new ScratchArena;
+	}
+	ScratchArena *arena = pool.arenas.back();
+	pool.arenas.pop_back();
+	return arena;
+}
+
+
+/* Reset an arena from acquire() and put it back in the pool */
+void ScratchArena::release(ScratchArena *arena) {
+
+	if(!arena) return;
+	arena->reset();
+	arena->resetPeak();
+	std::lock_guard<std::mutex> lock(poolmutex);
+	pool.arenas.push_back(arena);
+}
+
+
+/* Free the blocks of all arenas in the pool */
+void ScratchArena::trimPool() {
+
+	std::lock_guard<std::mutex> lock(poolmutex);
+
+	for(size_t i=0; i<pool.arenas.size(); i++) {
+		pool.arenas[i]->trim();
+	}
+}
+
+
+/*
+ * private
+ * newBlock() - Get a block of at least 'minsize' bytes. Large blocks are
+ * mapped from the OS, rounded up to whole huge pages, and backed by them
+ * if the OS allows. Explicit huge pages need privileges or pages set
+ * aside by the administrator, so a normal mapping is used if that fails.
+ * On Linux, it is then marked for transparent huge pages instead.
+ */
+bool ScratchArena::newBlock(Block &block, size_t minsize) {
+
+	void *data = NULL;
+	size_t size = minsize;
+
+	block.mapped = false;
+	block.huge = false;
+	block.used = 0;
+
+	if(size < (size_t)HUGE_PAGE_THRESHOLD) {
+		block.data = new(std::nothrow) char[size];
+		block.size = size;
+		return block.data != NULL;
+	}
+	block.data = NULL;
+	block.size = 0;
+	if(size > SIZE_MAX - HUGE_PAGE_SIZE) return false; // Would wrap when rounded up
+
+#ifdef __WIN32__
+	size_t pagesize = GetLargePageMinimum();
+	if(pagesize > 0 && size <= SIZE_MAX - pagesize) {
+		size_t hugesize = (size + pagesize - 1) / pagesize * pagesize;
+		data = VirtualAlloc(NULL, hugesize, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES,
+			PAGE_READWRITE);
+		if(data) {
+			size = hugesize;
+			block.huge = true;
+		}
+	}
+	if(!data) {
+		data = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	}
+#else
+	size = (size + HUGE_PAGE_SIZE - 1) / HUGE_PAGE_SIZE * HUGE_PAGE_SIZE;
+#ifdef MAP_HUGETLB
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	if(data != MAP_FAILED) {
+		block.huge = true;
+	}
+#else
+	data = MAP_FAILED;
+#endif // MAP_HUGETLB
+	if(data == MAP_FAILED) {
+		data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+		if(data != MAP_FAILED && madvise(data, size, MADV_HUGEPAGE) == 0) {
+			block.huge = true;
+		}
+#endif // MADV_HUGEPAGE
+	}
+	if(data == MAP_FAILED) {
+		data = NULL;
+	}
+#endif // __WIN32__
+
+	block.data = (char*)data;
+	block.size = size;
+	block.mapped = true;
+	return data != NULL;
+}
+
+
+/*
+ * private
+ * freeBlock() - Give a block back to where it came from.
+ */
+void ScratchArena::freeBlock(Block &block) {
+
+	if(!block.data) return;
+	if(!block.mapped) {
+		delete[] block.data;
+	}
+	else {
+#ifdef __WIN32__
+		VirtualFree(block.data, 0, MEM_RELEASE);
+#else
+		munmap(block.data, block.size);
+#endif
+	}
+	block.data = NULL;
+	block.size = 0;
+	block.used = 0;
+}
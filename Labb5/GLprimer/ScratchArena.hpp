@@ -0,0 +1,177 @@
+/* ScratchArena.hpp */
+/*
+ * A growable scratch allocator for the temporary arrays of loaders.
+ * Usage: allocate() takes memory from the end of a large block, and
+ * mark() and rewind() give back everything allocated after a mark
+ * at once. Nothing is freed on its own. When a block is full, a new
+ * one is added that is at least as large as all the others together,
+ * and reset() merges the blocks into one, so an arena that is reused
+ * for loads of similar size soon needs no more than a single block,
+ * and no calls to malloc() at all.
+ * Blocks of HUGE_PAGE_THRESHOLD bytes or more are mapped directly from
+ * the OS and backed by huge pages where it can be done (MAP_HUGETLB or
+ * transparent huge pages on Linux, MEM_LARGE_PAGES on Windows), which
+ * saves TLB misses when the arrays of a very large mesh are walked.
+ * peak() tells how much was used at most since resetPeak(), for
+ * reports of the scratch memory needed by each load.
+ * An arena must only be used by one thread at a time. acquire() and
+ * release() keep a shared pool of arenas, so loaders that are not
+ * given an arena, or that need one per thread, can reuse the memory
+ * of earlier loads.
+ * ScratchAllocator lets std::vector grow in an arena. Its memory is
+ * only given back by rewind(), so a vector that grows by doubling
+ * leaves its old copies behind, up to as much again as its final size.
+ * This code is in the public domain.
+ */
+
+#ifndef SCRATCHARENA_HPP // Avoid including this header twice
+#define SCRATCHARENA_HPP
+
+#include <cstddef>     // For size_t
+#include <new>         // For ::operator new() and std::bad_alloc
+#include <type_traits> // For std::true_type
+#include <vector>      // For the blocks, and for ScratchVector
+
+class ScratchArena {
+
+public:
+
+/* Blocks of this size or larger are mapped with huge pages if possible */
+enum { HUGE_PAGE_THRESHOLD = 32 << 20 };
+
+/* A position in the arena, to rewind() to */
+struct Mark {
+    size_t block;
+    size_t offset;
+};
+
+/* Constructor: no memory until the first allocate(), which takes
+ * a block of 'blocksize' bytes, or more for a larger request */
+ScratchArena(size_t blocksize = 1 << 20);
+
+/* Destructor: give all blocks back to the OS */
+~ScratchArena();
+
+/* Get 'bytes' bytes, aligned to 'alignment' (a power of two) */
+void *allocate(size_t bytes, size_t alignment = 16);
+
+/* Get an array of 'count' elements of type T, or NULL if the
+ * size in bytes would not fit in a size_t */
+template<class T>
+T *allocate(size_t count) {
+    if(count > ((size_t)-1) / sizeof(T)) return NULL;
+    return (T*)allocate(count*sizeof(T), alignof(T) > 16 ? alignof(T) : 16);
+}
+
+/* The current end of the used memory */
+Mark mark();
+
+/* Give back everything allocated after 'position' */
+void rewind(Mark position);
+
+/* Give back everything, and merge the blocks into one */
+void reset();
+
+/* Give back everything, and free all blocks */
+void trim();
+
+/* Whether a pointer is inside one of the blocks */
+bool contains(const void *pointer);
+
+/* Bytes in use, most bytes in use since resetPeak(), bytes in all
+ * blocks, and bytes in blocks that are backed by huge pages */
+size_t used();
+size_t peak();
+size_t capacity();
+size_t hugePageBytes();
+
+/* Start a new peak() measurement from the current use */
+void resetPeak();
+
+/* Take an arena from the shared pool, or a new one if it is empty */
+static ScratchArena *acquire();
+
+/* Reset an arena from acquire() and put it back in the pool */
+static void release(ScratchArena *arena);
+
+/* Free the blocks of all arenas in the pool */
+static void trimPool();
+
+private:
+
+struct Block {
+    char *data;
+    size_t size;
+    size_t used;
+    bool mapped; // From the OS, not from new[]
+    bool huge;   // Backed by huge pages
+};
+
+std::vector<Block> blocks; // All blocks after 'current' are unused
+size_t current;   // The block that allocate() takes memory from
+size_t blocksize; // Smallest size of a new block
+size_t usedbytes; // Sum of 'used' for all blocks up to 'current'
+size_t peakbytes;
+
+bool newBlock(Block &block, size_t minsize);
+
+void freeBlock(Block &block);
+
+// The blocks are a unique resource, so copying is not allowed
+ScratchArena(const ScratchArena&);
+ScratchArena& operator=(const ScratchArena&);
+
+};
+
+/*
+ * An allocator for standard containers that takes memory from an
+ * arena, or from the heap if the arena is NULL. Deallocation does
+ * nothing for arena memory, so the arena may be rewound before the
+ * containers are destroyed. The allocator follows its container on
+ * swap and move assignment, so containers in different arenas can
+ * be swapped.
+ */
+template<class T>
+struct ScratchAllocator {
+
+    typedef T value_type;
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    ScratchArena *arena;
+
+    ScratchAllocator(ScratchArena *arena = NULL) : arena(arena) {}
+
+    template<class U>
+    ScratchAllocator(const ScratchAllocator<U> &other) : arena(other.arena) {}
+
+    T *allocate(size_t count) {
+        if(!arena) {
+            if(count > ((size_t)-1) / sizeof(T)) throw std::bad_alloc();
+            return (T*)::operator new(count*sizeof(T));
+        }
+        T *pointer = arena->allocate<T>(count);
+        if(!pointer) throw std::bad_alloc(); // Containers expect an exception
+        return pointer;
+    }
+
+    void deallocate(T *pointer, size_t) {
+        if(!arena) ::operator delete(pointer);
+    }
+};
+
+template<class T, class U>
+bool operator==(const ScratchAllocator<T> &a, const ScratchAllocator<U> &b) {
+    return a.arena == b.arena;
+}
+
+template<class T, class U>
+bool operator!=(const ScratchAllocator<T> &a, const ScratchAllocator<U> &b) {
+    return a.arena != b.arena;
+}
+
+/* A growable array in an arena */
+template<class T>
+using ScratchVector = std::vector<T, ScratchAllocator<T> >;
+
+#endif // SCRATCHARENA_HPP
@@ -1,4 +1,5 @@
 #include "Shader.hpp"
+#include "TriangleSoup.hpp" // To forget the uniforms of deleted programs
 
 /*
  * Constructor without arguments.
@@ -25,8 +26,10 @@ Shader::Shader(const char *vertexshaderfile, const char *fragmentshaderfile) {
  * Cleans up by deleting the program if it was compiled.
  */
 Shader::~Shader() {
-    if(programID != 0)
+    if(programID != 0) {
+        TriangleSoup::forgetProgram(programID);
         glDeleteProgram(programID);
+    }
 }
 
 
@@ -49,8 +52,10 @@ void Shader::createShader(const char *vertexshaderfile, const char *fragmentshad
     char str[4096]; // For error messages from the GLSL compiler and linker
 
     // If a program is already stored in this object, delete it
-    if(programID != 0)
+    if(programID != 0) {
+        TriangleSoup::forgetProgram(programID);
         glDeleteProgram(programID);
+    }
 
     // Create the vertex shader.
     vertexShader = glCreateShader(GL_VERTEX_SHADER);
@@ -97,6 +102,8 @@ void Shader::createShader(const char *vertexshaderfile, const char *fragmentshad
     // Link the program object and print out the info log.
     glLinkProgram(programObject);
     glGetProgramiv(programObject, GL_LINK_STATUS, &shadersLinked);
+    // The name may have belonged to a program deleted elsewhere
+    TriangleSoup::forgetProgram(programObject);
 
     if(shadersLinked == GL_FALSE)
 	{
@@ -2,7 +2,9 @@
 /* A class to load and compile GLSL shaders from files. */
 /* Usage: call createShader() to load and compile a program object,
  * or use the constructor with two file name arguments.
- * Call glUseProgram() with the public member programID as argument. */
+ * Call glUseProgram(), or TriangleSoup::useProgram() to save the
+ * render calls of TriangleSoup a query, with the public member
+ * programID as argument. */
 /* Stefan Gustavson (stefan.gustavson@liu.se) 2014-03-27 */
 
 #ifndef SHADER_HPP // Avoid including this header twice
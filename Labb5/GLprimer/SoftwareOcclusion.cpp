@@ -0,0 +1,487 @@
+/* SoftwareOcclusion.cpp */
+/*
+ * Occlusion culling on the CPU, with a small software depth buffer.
+ * See SoftwareOcclusion.hpp for a description of the class.
+ * This code is in the public domain.
+ */
+
+#include <cmath>     // For floorf(), ceilf() and fabsf()
+#include <thread>    // For the number of CPU cores
+#include <algorithm> // For std::min() and std::max()
+#ifdef __SSE__
+#include <xmmintrin.h> // For drawing four pixels at a time
+#endif
+
+#include "SoftwareOcclusion.hpp"
+#include "Parallel.hpp" // For runParallel()
+
+/* out = A*B for column-major 4x4 matrices, as Utilities::mat4mult().
+ * Utilities needs GLFW, and this class must build without it. */
+static void mat4mult(const float A[], const float B[], float out[]) {
+
+	float result[16];
+
+	for(int col=0; col<4; col++) {
+		for(int row=0; row<4; row++) {
+			result[4*col+row] = A[row]*B[4*col] + A[4+row]*B[4*col+1]
+				+ A[8+row]*B[4*col+2] + A[12+row]*B[4*col+3];
+		}
+	}
+	for(int i=0; i<16; i++) {
+		out[i] = result[i];
+	}
+}
+
+
+/* Constructor: a depth buffer of width x height pixels, rounded up to whole tiles */
+SoftwareOcclusion::SoftwareOcclusion(int width, int height, int numthreads) {
+
+	bufferwidth = std::max(1, (width + TILE_SIZE - 1)/TILE_SIZE)*TILE_SIZE;
+	bufferheight = std::max(1, (height + TILE_SIZE - 1)/TILE_SIZE)*TILE_SIZE;
+	if(numthreads <= 0) {
+		numthreads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	// Each thread gets at least one row of tiles
+	this->numthreads = std::min(numthreads, bufferheight/TILE_SIZE);
+	depth.assign(bufferwidth*bufferheight, 0.0f);
+	tiledepth.assign((bufferwidth/TILE_SIZE)*(bufferheight/TILE_SIZE), 0.0f);
+	for(int i=0; i<16; i++) {
+		PV[i] = (i % 5 == 0) ? 1.0f : 0.0f; // Identity
+	}
+	ntested = 0;
+	nhidden = 0;
+}
+
+
+/* Start a new frame with the view frustum of P*V */
+void SoftwareOcclusion::begin(const float P[], const float V[]) {
+
+	mat4mult(P, V, PV);
+	triangles.clear();
+	ntested = 0;
+	nhidden = 0;
+}
+
+
+/*
+ * addOccluder(const float *vertices, int stride, int nverts,
+ *     const unsigned int *indices, int ntris, const float M[])
+ *
+ * Move the vertices to clip space, and set up the triangles that are
+ * not entirely outside one of the clip planes. Triangles are only
+ * drawn in rasterize().
+ */
+void SoftwareOcclusion::addOccluder(const float *vertices, int stride, int nverts,
+	const unsigned int *indices, int ntris, const float M[]) {
+
+	float PVM[16];
+	std::vector<float> clip(4*nverts);
+
+	mat4mult(PV, M, PVM);
+	for(int i=0; i<nverts; i++) {
+		const float *v = &vertices[i*stride];
+		for(int k=0; k<4; k++) {
+			clip[4*i+k] = PVM[k]*v[0] + PVM[4+k]*v[1] + PVM[8+k]*v[2] + PVM[12+k];
+		}
+	}
+
+	for(int t=0; t<ntris; t++) {
+		float triangle[3][4];
+		int outside = 0x3f; // Planes that all three vertices are outside
+		for(int j=0; j<3; j++) {
+			unsigned int index = indices[3*t+j];
+			if(index >= (unsigned int)nverts) {
+				outside = -1;
+				break;
+			}
+			const float *c = &clip[4*index];
+			int planes = (c[0] < -c[3]) | (c[0] > c[3]) << 1 | (c[1] < -c[3]) << 2
+				| (c[1] > c[3]) << 3 | (c[2] < -c[3]) << 4 | (c[2] > c[3]) << 5;
+			outside &= planes;
+			for(int k=0; k<4; k++) {
+				triangle[j][k] = c[k];
+			}
+		}
+		if(outside != 0) continue; // Out of view, or a bad index
+		addTriangle(triangle);
+	}
+}
+
+
+/*
+ * rasterize()
+ *
+ * Clear and draw each band of rows in a thread of its own, then build
+ * the tiles of the band. The bands are whole rows of tiles, so no two
+ * threads ever write to the same pixel or tile.
+ */
+void SoftwareOcclusion::rasterize() {
+
+	int tilerows = bufferheight/TILE_SIZE;
+
+	runParallel(numthreads, [&](int part) {
+		int firstrow = tilerows*part/numthreads*TILE_SIZE;
+		int endrow = tilerows*(part+1)/numthreads*TILE_SIZE;
+		drawBand(firstrow, endrow);
+		buildTiles(firstrow, endrow);
+	});
+}
+
+
+/*
+ * testBox(const float min[3], const float max[3])
+ *
+ * The nearest point of the box is at one of its corners, and the box
+ * is inside the screen rectangle around its corners. If the nearest
+ * corner is behind the farthest pixel of a tile, the box is hidden in
+ * all of that tile. Otherwise, the pixels of the tile are tested.
+ */
+bool SoftwareOcclusion::testBox(const float min[3], const float max[3]) {
+
+	float minx = 1e30f, maxx = -1e30f, miny = 1e30f, maxy = -1e30f;
+	float nearest = 0.0f;
+	int tilewidth = bufferwidth/TILE_SIZE;
+
+	ntested++;
+	for(int corner=0; corner<8; corner++) {
+		float p[3], c[4];
+		p[0] = (corner & 1) ? max[0] : min[0];
+		p[1] = (corner & 2) ? max[1] : min[1];
+		p[2] = (corner & 4) ? max[2] : min[2];
+		for(int k=0; k<4; k++) {
+			c[k] = PV[k]*p[0] + PV[4+k]*p[1] + PV[8+k]*p[2] + PV[12+k];
+		}
+		if(c[2] < -c[3]) return true; // In front of the near plane
+		float invw = 1.0f/c[3];
+		float x = (0.5f*c[0]*invw + 0.5f)*bufferwidth;
+		float y = (0.5f*c[1]*invw + 0.5f)*bufferheight;
+		minx = std::min(minx, x);
+		maxx = std::max(maxx, x);
+		miny = std::min(miny, y);
+		maxy = std::max(maxy, y);
+		nearest = std::max(nearest, invw);
+	}
+	// Pixel p covers [p, p+1), so the rectangle covers these pixels
+	int x0 = (int)floorf(std::max(minx, 0.0f));
+	int x1 = (int)floorf(std::min(maxx, bufferwidth - 1.0f));
+	int y0 = (int)floorf(std::max(miny, 0.0f));
+	int y1 = (int)floorf(std::min(maxy, bufferheight - 1.0f));
+	if(x0 > x1 || y0 > y1) { // Outside the screen
+		nhidden++;
+		return false;
+	}
+
+	for(int ty=y0/TILE_SIZE; ty<=y1/TILE_SIZE; ty++) {
+		for(int tx=x0/TILE_SIZE; tx<=x1/TILE_SIZE; tx++) {
+			if(nearest < tiledepth[ty*tilewidth + tx]) continue;
+			int rowbegin = std::max(y0, ty*TILE_SIZE);
+			int rowend = std::min(y1 + 1, (ty + 1)*TILE_SIZE);
+			int colbegin = std::max(x0, tx*TILE_SIZE);
+			int colend = std::min(x1 + 1, (tx + 1)*TILE_SIZE);
+			for(int row=rowbegin; row<rowend; row++) {
+				const float *pixels = &depth[row*bufferwidth];
+				for(int col=colbegin; col<colend; col++) {
+					if(nearest >= pixels[col]) return true;
+				}
+			}
+		}
+	}
+	nhidden++;
+	return false;
+}
+
+
+/* Size of the depth buffer, and the buffer itself */
+int SoftwareOcclusion::width() {
+	return bufferwidth;
+}
+
+int SoftwareOcclusion::height() {
+	return bufferheight;
+}
+
+const float *SoftwareOcclusion::depthBuffer() {
+	return &depth[0];
+}
+
+
+/* Counts for the current frame, since begin() */
+int SoftwareOcclusion::triangleCount() {
+	return (int)triangles.size();
+}
+
+int SoftwareOcclusion::testCount() {
+	return ntested;
+}
+
+int SoftwareOcclusion::hiddenCount() {
+	return nhidden;
+}
+
+
+/*
+ * private
+ * addTriangle() - Clip a triangle in clip space against the near plane,
+ * which gives a polygon of up to four vertices, then move it to pixel
+ * coordinates and keep the front facing triangles of the polygon.
+ */
+void SoftwareOcclusion::addTriangle(const float clip[3][4]) {
+
+	float polygon[4][4];
+	int n = 0;
+
+	for(int i=0; i<3; i++) {
+		const float *a = clip[i];
+		const float *b = clip[(i+1) % 3];
+		float da = a[2] + a[3]; // Distance to the near plane z = -w
+		float db = b[2] + b[3];
+		if(da >= 0.0f) {
+			for(int k=0; k<4; k++) polygon[n][k] = a[k];
+			n++;
+		}
+		if((da >= 0.0f) != (db >= 0.0f)) {
+			float t = da/(da - db);
+			for(int k=0; k<4; k++) polygon[n][k] = a[k] + t*(b[k] - a[k]);
+			n++;
+		}
+	}
+	if(n < 3) return;
+
+	float x[4], y[4], invw[4];
+	for(int i=0; i<n; i++) {
+		invw[i] = 1.0f/polygon[i][3];
+		x[i] = (0.5f*polygon[i][0]*invw[i] + 0.5f)*bufferwidth;
+		y[i] = (0.5f*polygon[i][1]*invw[i] + 0.5f)*bufferheight;
+	}
+	for(int i=1; i+1<n; i++) {
+		int v[3] = {0, i, i+1};
+		ScreenTriangle triangle;
+		float area = (x[v[1]] - x[v[0]])*(y[v[2]] - y[v[0]]) - (x[v[2]] - x[v[0]])*(y[v[1]] - y[v[0]]);
+		if(area <= 0.0f) continue; // Back facing, or with no area at all
+		float ymin = 1e30f, ymax = -1e30f, xmin = 1e30f, xmax = -1e30f;
+		for(int j=0; j<3; j++) {
+			triangle.x[j] = x[v[j]];
+			triangle.y[j] = y[v[j]];
+			triangle.invw[j] = invw[v[j]];
+			xmin = std::min(xmin, x[v[j]]);
+			xmax = std::max(xmax, x[v[j]]);
+			ymin = std::min(ymin, y[v[j]]);
+			ymax = std::max(ymax, y[v[j]]);
+		}
+		if(xmax < 0.0f || xmin > bufferwidth || ymax < 0.0f || ymin > bufferheight) continue;
+		triangle.miny = std::max(0, (int)floorf(ymin));
+		triangle.maxy = std::min(bufferheight - 1, (int)ceilf(ymax));
+		triangles.push_back(triangle);
+	}
+}
+
+
+/*
+ * private
+ * drawBand() - Clear the rows from 'firstrow' up to 'endrow', and
+ * draw the parts of all triangles that fall in them.
+ */
+void SoftwareOcclusion::drawBand(int firstrow, int endrow) {
+
+	std::fill(depth.begin() + firstrow*bufferwidth, depth.begin() + endrow*bufferwidth, 0.0f);
+	for(size_t i=0; i<triangles.size(); i++) {
+		if(triangles[i].maxy < firstrow || triangles[i].miny >= endrow) continue;
+		drawTriangle(triangles[i], firstrow, endrow);
+	}
+}
+
+
+/*
+ * private
+ * drawTriangle() - Draw the pixels that lie entirely inside a triangle,
+ * in the rows from 'firstrow' up to 'endrow'. Each edge function is
+ * positive on the inside of its edge, and 1/w is interpolated with
+ * the edge functions as barycentric coordinates. A pixel keeps the
+ * nearest depth, the largest 1/w.
+ * testBox() trusts a pixel for all of its area, so the occluders are
+ * drawn conservatively: the edge functions are moved inwards by half
+ * a pixel in the direction of each edge normal, so only pixels that
+ * are covered everywhere pass, and the depth written is the farthest
+ * in the pixel, not the one at its center.
+ */
+void SoftwareOcclusion::drawTriangle(const ScreenTriangle &triangle, int firstrow, int endrow) {
+
+	const float *x = triangle.x, *y = triangle.y;
+	float area = (x[1] - x[0])*(y[2] - y[0]) - (x[2] - x[0])*(y[1] - y[0]);
+	float stepx[3], stepy[3], origin[3]; // Edge function i = origin + stepx*x + stepy*y
+	float zstepx = 0.0f, zstepy = 0.0f, zorigin = 0.0f;
+
+	for(int i=0; i<3; i++) {
+		int a = (i + 1) % 3, b = (i + 2) % 3; // Edge i is opposite vertex i
+		stepx[i] = y[a] - y[b];
+		stepy[i] = x[b] - x[a];
+		origin[i] = x[a]*y[b] - x[b]*y[a];
+		zstepx += stepx[i]*triangle.invw[i]/area;
+		zstepy += stepy[i]*triangle.invw[i]/area;
+		zorigin += origin[i]*triangle.invw[i]/area;
+	}
+	for(int i=0; i<3; i++) {
+		origin[i] -= 0.5f*(fabsf(stepx[i]) + fabsf(stepy[i]));
+	}
+	zorigin -= 0.5f*(fabsf(zstepx) + fabsf(zstepy));
+
+	float xmin = std::min(x[0], std::min(x[1], x[2]));
+	float xmax = std::max(x[0], std::max(x[1], x[2]));
+	int colbegin = std::max(0, (int)floorf(xmin)) & ~3; // Whole groups of four
+	int colend = std::min(bufferwidth, (int)ceilf(xmax) + 1);
+	int rowbegin = std::max(firstrow, triangle.miny);
+	int rowend = std::min(endrow, triangle.maxy + 1);
+
+	for(int row=rowbegin; row<rowend; row++) {
+		float cy = row + 0.5f;
+		float *pixels = &depth[row*bufferwidth];
+		float e[3], z = zorigin + zstepy*cy;
+		for(int i=0; i<3; i++) {
+			e[i] = origin[i] + stepy[i]*cy;
+		}
+#ifdef __SSE__
+		__m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f); // Pixel centers
+		__m128 zero = _mm_setzero_ps();
+		for(int col=colbegin; col<colend; col+=4) {
+			__m128 cx = _mm_add_ps(_mm_set1_ps((float)col), offsets);
+			__m128 e0 = _mm_add_ps(_mm_set1_ps(e[0]), _mm_mul_ps(_mm_set1_ps(stepx[0]), cx));
+			__m128 e1 = _mm_add_ps(_mm_set1_ps(e[1]), _mm_mul_ps(_mm_set1_ps(stepx[1]), cx));
+			__m128 e2 = _mm_add_ps(_mm_set1_ps(e[2]), _mm_mul_ps(_mm_set1_ps(stepx[2]), cx));
+			__m128 inside = _mm_and_ps(_mm_cmpge_ps(e0, zero),
+				_mm_and_ps(_mm_cmpge_ps(e1, zero), _mm_cmpge_ps(e2, zero)));
+			if(_mm_movemask_ps(inside) == 0) continue;
+			__m128 znew = _mm_add_ps(_mm_set1_ps(z), _mm_mul_ps(_mm_set1_ps(zstepx), cx));
+			__m128 zold = _mm_loadu_ps(&pixels[col]);
+			__m128 zmax = _mm_max_ps(zold, znew);
+			_mm_storeu_ps(&pixels[col], _mm_or_ps(_mm_and_ps(inside, zmax), _mm_andnot_ps(inside, zold)));
+		}
+#else
+		for(int col=colbegin; col<colend; col++) { // Without SSE, one pixel at a time
+			float cx = col + 0.5f;
+			if(e[0] + stepx[0]*cx < 0.0f || e[1] + stepx[1]*cx < 0.0f || e[2] + stepx[2]*cx < 0.0f) continue;
+			pixels[col] = std::max(pixels[col], z + zstepx*cx);
+		}
+#endif
+	}
+}
+
+
+/*
+ * private
+ * buildTiles() - Keep the farthest depth, the smallest 1/w, of each
+ * tile in the rows from 'firstrow' up to 'endrow'.
+ */
+void SoftwareOcclusion::buildTiles(int firstrow, int endrow) {
+
+	int tilewidth = bufferwidth/TILE_SIZE;
+
+	for(int ty=firstrow/TILE_SIZE; ty<endrow/TILE_SIZE; ty++) {
+		for(int tx=0; tx<tilewidth; tx++) {
+			float farthest = 1e30f;
+			for(int row=ty*TILE_SIZE; row<(ty+1)*TILE_SIZE; row++) {
+				const float *pixels = &depth[row*bufferwidth + tx*TILE_SIZE];
+				for(int col=0; col<TILE_SIZE; col++) {
+					farthest = std::min(farthest, pixels[col]);
+				}
+			}
+			tiledepth[ty*tilewidth + tx] = farthest;
+		}
+	}
+}
+
+
+#ifdef SOFTWAREOCCLUSION_BENCHMARK
+/*
+ * A benchmark without OpenGL: a street of box shaped houses, seen
+ * along the street, with many small boxes spread out behind them.
+ * Build with: g++ -O2 -pthread -DSOFTWAREOCCLUSION_BENCHMARK SoftwareOcclusion.cpp
+ */
+#include <cstdio>  // For printf()
+#include <cstdlib> // For rand()
+#include <chrono>  // For timing
+
+/* A box from min to max, 8 vertices and 12 counterclockwise triangles */
+static void makeBox(const float min[3], const float max[3], float vertices[24], unsigned int indices[36]) {
+
+	static const unsigned int faces[36] = {
+		0,2,3, 0,3,1, 4,5,7, 4,7,6, 0,1,5, 0,5,4,
+		2,6,7, 2,7,3, 0,4,6, 0,6,2, 1,3,7, 1,7,5 };
+
+	for(int corner=0; corner<8; corner++) {
+		vertices[3*corner] = (corner & 1) ? max[0] : min[0];
+		vertices[3*corner+1] = (corner & 2) ? max[1] : min[1];
+		vertices[3*corner+2] = (corner & 4) ? max[2] : min[2];
+	}
+	for(int i=0; i<36; i++) {
+		indices[i] = faces[i];
+	}
+}
+
+int main(int argc, char *argv[]) {
+
+	const int numhouses = 40, numboxes = 20000, numframes = 200;
+	float P[16] = {0}, V[16] = {0}, M[16] = {0};
+	float near = 0.1f, far = 500.0f, f = 1.0f/tanf(0.5f);
+	std::vector<float> houses(24*numhouses);
+	std::vector<unsigned int> indices(36*numhouses);
+	std::vector<float> boxes(6*numboxes);
+	int numthreads = (argc > 1) ? atoi(argv[1]) : 0;
+
+	// A perspective projection with a 1:2 aspect, as the buffer
+	P[0] = f/2.0f;
+	P[5] = f;
+	P[10] = -(far + near)/(far - near);
+	P[11] = -1.0f;
+	P[14] = -2.0f*far*near/(far - near);
+	V[0] = V[5] = V[10] = V[15] = 1.0f;
+	V[13] = -2.0f; // Eye a little above the ground
+	M[0] = M[5] = M[10] = M[15] = 1.0f;
+
+	// Houses on both sides of a street along -z, and a wall across it
+	for(int i=0; i<numhouses; i++) {
+		float side = (i % 2) ? 1.0f : -1.0f;
+		float min[3] = {side*4.0f - (side < 0 ? 8.0f : 0.0f), 0.0f, -12.0f*(i/2) - 22.0f};
+		float max[3] = {min[0] + 8.0f, 10.0f + (i % 3)*4.0f, min[2] + 10.0f};
+		if(i == numhouses - 1) {
+			min[0] = -4.0f; max[0] = 4.0f; min[2] = -60.0f; max[2] = -59.0f; max[1] = 12.0f;
+		}
+		makeBox(min, max, &houses[24*i], &indices[36*i]);
+	}
+	srand(1);
+	for(int i=0; i<numboxes; i++) {
+		float *box = &boxes[6*i];
+		box[0] = rand() % 200 - 100.0f;
+		box[1] = (float)(rand() % 10);
+		box[2] = -(float)(rand() % 400) - 5.0f;
+		box[3] = box[0] + 1.0f;
+		box[4] = box[1] + 1.0f;
+		box[5] = box[2] + 1.0f;
+	}
+
+	SoftwareOcclusion occlusion(256, 128, numthreads);
+	double drawtime = 0.0, testtime = 0.0;
+	int hidden = 0;
+	for(int frame=0; frame<numframes; frame++) {
+		std::chrono::high_resolution_clock::time_point t0 = std::chrono::high_resolution_clock::now();
+		occlusion.begin(P, V);
+		for(int i=0; i<numhouses; i++) {
+			occlusion.addOccluder(&houses[24*i], 3, 8, &indices[36*i], 12, M);
+		}
+		occlusion.rasterize();
+		std::chrono::high_resolution_clock::time_point t1 = std::chrono::high_resolution_clock::now();
+		for(int i=0; i<numboxes; i++) {
+			occlusion.testBox(&boxes[6*i], &boxes[6*i+3]);
+		}
+		std::chrono::high_resolution_clock::time_point t2 = std::chrono::high_resolution_clock::now();
+		drawtime += std::chrono::duration<double>(t1 - t0).count();
+		testtime += std::chrono::duration<double>(t2 - t1).count();
+		hidden = occlusion.hiddenCount();
+	}
+	printf("SoftwareOcclusion: %dx%d pixels, %d occluder triangles\n",
+		occlusion.width(), occlusion.height(), occlusion.triangleCount());
+	printf("rasterize: %.3f ms per frame\n", 1000.0*drawtime/numframes);
+	printf("testBox  : %.3f ms for %d boxes (%.1f ns each), %d hidden\n",
+		1000.0*testtime/numframes, numboxes, 1e9*testtime/numframes/numboxes, hidden);
+	return 0;
+}
+#endif
@@ -0,0 +1,103 @@
+/* SoftwareOcclusion.hpp */
+/*
+ * Occlusion culling on the CPU, with a small software depth buffer.
+ * Usage: call begin() once per frame with the projection matrix P and
+ * the view matrix V, addOccluder() a few large meshes that hide much of
+ * the scene (walls, floors, terrain), then rasterize() to draw them.
+ * After that, testBox() tells whether a world space bounding box may be
+ * visible, before any OpenGL calls are made for it.
+ * The depth buffer has a low resolution, 256x128 by default. It holds
+ * 1/w, which is linear in screen space, so larger values are nearer.
+ * rasterize() splits the buffer into bands of rows, one per thread, and
+ * each thread draws the parts of all triangles that fall in its band,
+ * four pixels at a time with SSE. Only pixels that the occluders cover
+ * completely are drawn, so a box is never hidden by a pixel that it
+ * can be seen through at the edge of an occluder. Then the farthest depth of each 8x8
+ * tile is kept in a second, hierarchical buffer. testBox() compares the
+ * nearest depth of the box with the tiles under its screen rectangle,
+ * and only looks at single pixels in tiles where that is not enough.
+ * Unlike occlusion queries, the answer is known in the same frame,
+ * with no round trip to the GPU. A box that is hidden by several
+ * occluders together is rejected too, since they share the buffer.
+ * The class uses no OpenGL at all, so it can be tested and timed on a
+ * machine without a GPU. Compile SoftwareOcclusion.cpp on its own with
+ * SOFTWAREOCCLUSION_BENCHMARK defined for a small benchmark program.
+ * This code is in the public domain.
+ */
+
+#ifndef SOFTWAREOCCLUSION_HPP // Avoid including this header twice
+#define SOFTWAREOCCLUSION_HPP
+
+#include <vector> // For the triangles and the buffers
+
+class SoftwareOcclusion {
+
+public:
+
+/* Side of the square tiles of the hierarchical buffer, in pixels */
+enum { TILE_SIZE = 8 };
+
+/* Constructor: a depth buffer of width x height pixels, rounded up to
+ * whole tiles, drawn by 'numthreads' threads (0 for one per CPU core) */
+SoftwareOcclusion(int width = 256, int height = 128, int numthreads = 0);
+
+/* Start a new frame with the view frustum of P*V, and forget the
+ * occluders of the last frame */
+void begin(const float P[], const float V[]);
+
+/* Add an occluder mesh with the model matrix M. Positions are the
+ * first three floats of each vertex, 'stride' floats apart (8 for
+ * TriangleSoup). Triangles facing away from the camera are skipped,
+ * so occluders must be closed, or face the camera. */
+void addOccluder(const float *vertices, int stride, int nverts,
+    const unsigned int *indices, int ntris, const float M[]);
+
+/* Draw the occluders into the depth buffer */
+void rasterize();
+
+/* Whether any part of a world space box may be visible. Boxes that
+ * reach behind the near plane of the camera are always visible. */
+bool testBox(const float min[3], const float max[3]);
+
+/* Size of the depth buffer, and the buffer itself (1/w, 0 for empty) */
+int width();
+int height();
+const float *depthBuffer();
+
+/* Counts for the current frame, since begin() */
+int triangleCount(); // Occluder triangles set up for drawing
+int testCount();     // Boxes tested
+int hiddenCount();   // Boxes found hidden
+
+private:
+
+/* A triangle in pixel coordinates, ready for drawing */
+struct ScreenTriangle {
+    float x[3];
+    float y[3];
+    float invw[3];
+    int miny;
+    int maxy;
+};
+
+int bufferwidth;
+int bufferheight;
+int numthreads;
+float PV[16];
+std::vector<ScreenTriangle> triangles;
+std::vector<float> depth;    // 1/w of the nearest occluder, for each pixel
+std::vector<float> tiledepth; // 1/w of the farthest pixel, for each tile
+int ntested;
+int nhidden;
+
+void addTriangle(const float clip[3][4]);
+
+void drawBand(int firstrow, int endrow);
+
+void drawTriangle(const ScreenTriangle &triangle, int firstrow, int endrow);
+
+void buildTiles(int firstrow, int endrow);
+
+};
+
+#endif // SOFTWAREOCCLUSION_HPP
@@ -4,6 +4,7 @@
 /* Stefan Gustavson (stefan.gustavson@liu.se 2014-02-28 */
 
 #include "Texture.hpp"
+#include "ScratchArena.hpp" // For the image data while loading
 
 /* Constructor */
 Texture::Texture() {
@@ -26,10 +27,11 @@ Texture::~Texture() {
 
 
 /*
- * loadUncompressedTGA(FILE *TGAfile)
- * Open and test the file to make sure it is a valid TGA file
+ * loadUncompressedTGA(FILE *TGAfile, ScratchArena *scratch)
+ * Open and test the file to make sure it is a valid TGA file.
+ * The image data is read into the scratch arena.
  */
-int Texture::loadUncompressedTGA(FILE *TGAfile) // Load an uncompressed TGA
+int Texture::loadUncompressedTGA(FILE *TGAfile, ScratchArena *scratch) // Load an uncompressed TGA
 {												// (based on NeHe's TGA loading code)
 	GLubyte temp;
 	GLuint cswap;
@@ -76,7 +78,7 @@ int Texture::loadUncompressedTGA(FILE *TGAfile) // Load an uncompressed TGA
 
 	tga.bytesPerPixel	= (tga.bpp / 8);						// Compute the number of BYTES per pixel
 	tga.imageSize		= (tga.bytesPerPixel * tga.width * tga.height);	// Compute the total amount of memory needed
-	this->imageData = new GLubyte[tga.imageSize];				        // Allocate that much memory
+	this->imageData = scratch->allocate<GLubyte>(tga.imageSize);		// Allocate that much memory
 
 	if(this->imageData == NULL)										// If no space was allocated
 	{
@@ -88,10 +90,7 @@ int Texture::loadUncompressedTGA(FILE *TGAfile) // Load an uncompressed TGA
 	if(fread(this->imageData, 1, tga.imageSize, TGAfile) != tga.imageSize)	// Attempt to read image data
 	{
 		fprintf(stderr, "Could not read image data.\n");					// Display error
-		if(this->imageData != NULL)										// If image data was allocated
-		{
-			delete[] this->imageData;										// Deallocate that data
-		}
+		this->imageData = NULL;											// The arena takes the data back
 		fclose(TGAfile);														// Close file
 		return GL_FALSE;													// Return "failure"
 	}
@@ -110,10 +109,10 @@ int Texture::loadUncompressedTGA(FILE *TGAfile) // Load an uncompressed TGA
 }
 
 /*
- * loadTGA(char * filename)
+ * loadTGA(char * filename, ScratchArena *scratch)
  * Open and test the file to make sure it is a valid TGA file
  */
-int Texture::loadTGA(const char *filename)
+int Texture::loadTGA(const char *filename, ScratchArena *scratch)
 {
 	FILE * TGAfile;
 	TGAHeader tgaheader;
@@ -141,7 +140,7 @@ int Texture::loadTGA(const char *filename)
 
 	if(memcmp(uTGAcompare, &tgaheader, sizeof(tgaheader)) == 0)	// See if header matches the predefined header of
 	{															// an Uncompressed TGA image
-		this->loadUncompressedTGA(TGAfile);		                // If so, jump to Uncompressed TGA loading code
+		return this->loadUncompressedTGA(TGAfile, scratch);		// If so, jump to Uncompressed TGA loading code
 	}
 	else if(memcmp(cTGAcompare, &tgaheader, sizeof(tgaheader)) == 0) // See if header matches the predefined header of
 	{																 // an RLE compressed TGA image
@@ -159,11 +158,20 @@ int Texture::loadTGA(const char *filename)
 }
 
 /*
- * Load and activate a 2D texture from a TGA file
+ * Load and activate a 2D texture from a TGA file.
+ * The image data only lives until it is uploaded, so it is read into
+ * a scratch arena, which is rewound afterwards, instead of the heap.
+ * The peak scratch memory for the load is reported.
  */
-void Texture::createTexture(const char *filename) {
+void Texture::createTexture(const char *filename, ScratchArena *scratch) {
 
-    this->loadTGA(filename);
+    ScratchArena *arena = scratch ? scratch : ScratchArena::acquire();
+    ScratchArena::Mark start = arena->mark();
+    size_t startused = arena->used();
+
+    arena->resetPeak();
+    this->imageData = NULL;
+    this->loadTGA(filename, arena);
 
 	glEnable(GL_TEXTURE_2D); // Required for glBuildMipmap() to work (!)
 	glGenTextures(1, &(this->texID));     // Create The texture ID
@@ -179,5 +187,11 @@ void Texture::createTexture(const char *filename) {
 		this->type, GL_UNSIGNED_BYTE, this->imageData);
 	glGenerateMipmap(GL_TEXTURE_2D);
 
-	delete[] this->imageData; // Image data is now uploaded to OpenGL, so we don't need it any more
+	printf("createTexture(\"%s\"): peak scratch memory %.1f MB.\n",
+		filename, (arena->peak() - startused)/1e6);
+
+	// Image data is now uploaded to OpenGL, so we don't need it any more
+	this->imageData = NULL;
+	if(scratch) scratch->rewind(start);
+	else ScratchArena::release(arena);
 }
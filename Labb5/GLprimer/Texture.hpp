@@ -10,6 +10,8 @@
 
 #include "Utilities.hpp" // To have access to GL extensions (glGenerateMipmap)
 
+class ScratchArena;
+
 
 class Texture {
 
@@ -36,14 +38,15 @@ Texture(const char *filename);
 /* Destructor */
 ~Texture();
 
-// The external entry point for loading a texture from a TGA file
-void createTexture(const char *filename); // Load GL texture from file
+// The external entry point for loading a texture from a TGA file.
+// The image data is read into 'scratch', or into a pooled arena if it is NULL.
+void createTexture(const char *filename, ScratchArena *scratch = NULL); // Load GL texture from file
 
 private:
 
 // Internal "private" funtions, called internally by createTexture()
-int loadUncompressedTGA(FILE *tgafile); // Load data from an uncompressed TGA file
-int loadTGA(const char *filename);		    // Open, check and load a TGA file
+int loadUncompressedTGA(FILE *tgafile, ScratchArena *scratch); // Load data from an uncompressed TGA file
+int loadTGA(const char *filename, ScratchArena *scratch);       // Open, check and load a TGA file
 
 };
 
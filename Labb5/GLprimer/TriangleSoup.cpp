@@ -1,20 +1,159 @@
-#include <cstdio>  // For C-style file input in readOBJ()
+#include <cstdio>  // For printf() and fprintf()
 #include <cmath>   // For sin() and cos() in soupCreateSphere()
-#include <cstring> // For strcmp() - a leftover from the C version
+#include <vector>  // For growable arrays while parsing in readOBJ()
+#include <chrono>  // For timing the OBJ parser
+#include <thread>  // For parsing OBJ files and creating spheres in parallel
+#include <algorithm> // For std::copy()
+#include <string>  // For cache file names
+#include <cstring> // For memcmp(), memset() and memcpy()
+#ifdef __SSE2__
+#include <emmintrin.h> // For SSE2 vertex generation in createSphere()
+#endif
 
 #include "TriangleSoup.hpp"
+#include "MappedFile.hpp" // For reading OBJ files directly from memory
+#include "MeshOptimizer.hpp" // For the optional optimization stages
+#include "MeshArena.hpp" // For meshes in shared buffers
+#include "ScratchArena.hpp" // For temporary arrays while loading
+#include "MeshCodec.hpp" // For compressed mesh files
+#include "Parallel.hpp" // For runParallel()
 
 #include "Utilities.hpp"  // To be able to use OpenGL extensions
 
+// Counters for lodStats(), shared by all TriangleSoup objects
+long long TriangleSoup::lodtrisdrawn = 0;
+long long TriangleSoup::lodtrissaved = 0;
+
+// The dequantization uniforms of each shader program that has drawn a
+// mesh, with the values they were last given. Uniforms belong to the
+// program, so this is shared by all TriangleSoup objects.
+struct DequantState {
+	GLuint program;
+	GLint locations[5]; // posScale, posOffset, texScale, texOffset, octNormals
+	GLfloat values[11]; // The same uniforms, one after the other
+};
+static std::vector<DequantState> dequantstates;
+static GLuint currentprogram = 0; // Set by useProgram(), 0 if not known
+
 /* Constructor: initialize a TriangleSoup object to all zeros */
 TriangleSoup::TriangleSoup() {
+	initialize();
+}
+
+
+/* Move constructor: take over everything from 'other' */
+TriangleSoup::TriangleSoup(TriangleSoup &&other) {
+	moveFrom(other);
+}
+
+
+/* Move assignment: clean up our own data, then take over everything from 'other' */
+TriangleSoup &TriangleSoup::operator=(TriangleSoup &&other) {
+
+	if(this != &other) {
+		clean();
+		moveFrom(other);
+	}
+	return *this;
+}
+
+
+/*
+ * private
+ * initialize() - Set all members for an empty mesh without any
+ * arrays or OpenGL objects.
+ */
+void TriangleSoup::initialize() {
 	vao = 0;
 	vertexbuffer = 0;
 	indexbuffer = 0;
 	vertexarray = NULL;
 	indexarray = NULL;
+	cachefile = NULL;
 	nverts = 0;
 	ntris = 0;
+	for(int i=0; i<3; i++) {
+		boundsmin[i] = boundsmax[i] = 0.0f;
+		spherecenter[i] = 0.0f;
+	}
+	sphereradius = 0.0f;
+	vertexformat = VERTEX_FLOAT;
+	indextype = GL_UNSIGNED_INT;
+	texmin[0] = texmin[1] = 0.0f;
+	texmax[0] = texmax[1] = 1.0f;
+	clusters = NULL;
+	nclusters = 0;
+	nlods = 0;
+	lastlod = -1;
+	dynamicframes = 0;
+	dynamicslot = 0;
+	dynamicpending = false;
+	dynamicstalls = 0;
+	for(int i=0; i<MAX_DYNAMIC_FRAMES; i++) {
+		dynamicfences[i] = 0;
+		dirtyfirst[i] = dirtyend[i] = 0;
+	}
+	arena = NULL;
+	arenaslot = -1;
+	retention = RETAIN_ALL;
+	positionarray = NULL;
+	scratcharena = NULL;
+}
+
+
+/*
+ * private
+ * moveFrom() - Take over all members of 'other', and leave it empty.
+ * Only pointers and handles are copied, so nothing is freed twice.
+ * This object must not hold any arrays or OpenGL objects before.
+ */
+void TriangleSoup::moveFrom(TriangleSoup &other) {
+
+	vao = other.vao;
+	nverts = other.nverts;
+	ntris = other.ntris;
+	vertexbuffer = other.vertexbuffer;
+	indexbuffer = other.indexbuffer;
+	vertexarray = other.vertexarray;
+	indexarray = other.indexarray;
+	for(int k=0; k<3; k++) {
+		boundsmin[k] = other.boundsmin[k];
+		boundsmax[k] = other.boundsmax[k];
+		spherecenter[k] = other.spherecenter[k];
+	}
+	sphereradius = other.sphereradius;
+	cachefile = other.cachefile;
+	vertexformat = other.vertexformat;
+	indextype = other.indextype;
+	for(int k=0; k<2; k++) {
+		texmin[k] = other.texmin[k];
+		texmax[k] = other.texmax[k];
+	}
+	clusters = other.clusters;
+	nclusters = other.nclusters;
+	nlods = other.nlods;
+	for(int i=0; i<nlods; i++) {
+		lodfirst[i] = other.lodfirst[i];
+		lodtris[i] = other.lodtris[i];
+		loderror[i] = other.loderror[i];
+	}
+	lastlod = other.lastlod;
+	dynamicframes = other.dynamicframes;
+	dynamicslot = other.dynamicslot;
+	dynamicpending = other.dynamicpending;
+	dynamicstalls = other.dynamicstalls;
+	for(int i=0; i<MAX_DYNAMIC_FRAMES; i++) {
+		dynamicfences[i] = other.dynamicfences[i];
+		dirtyfirst[i] = other.dirtyfirst[i];
+		dirtyend[i] = other.dirtyend[i];
+	}
+	arena = other.arena;
+	arenaslot = other.arenaslot;
+	retention = other.retention;
+	positionarray = other.positionarray;
+	scratcharena = other.scratcharena;
+
+	other.initialize(); // It owns nothing now
 }
 
 
@@ -26,21 +165,22 @@ TriangleSoup::~TriangleSoup() {
 
 void TriangleSoup::clean() {
 
-	if(glIsVertexArray(vao)) {
-		glDeleteVertexArrays(1, &vao);
-	}
-	vao = 0;
+	releaseBuffers();
+	clearFences();
+	dynamicslot = 0;
+	dynamicpending = false;
 
-	if(glIsBuffer(vertexbuffer)) {
-		glDeleteBuffers(1, &vertexbuffer);
+	if(cachefile) { // The arrays may point into a mapped cache file
+		if(inCacheFile(vertexarray)) vertexarray = NULL;
+		if(inCacheFile(indexarray)) indexarray = NULL;
+		delete cachefile;
+		cachefile = NULL;
 	}
-	vertexbuffer = 0;
-
-	if(glIsBuffer(indexbuffer)) {
-		glDeleteBuffers(1, &indexbuffer);
+	if(scratcharena) { // The arrays may be borrowed from a scratch arena
+		if(inScratch(vertexarray)) vertexarray = NULL;
+		if(inScratch(indexarray)) indexarray = NULL;
+		scratcharena = NULL;
 	}
-	indexbuffer = 0;
-
 	if(vertexarray) {
 		delete[] vertexarray;
 		vertexarray = NULL;
@@ -49,6 +189,13 @@ void TriangleSoup::clean() {
 		delete[] indexarray;
 		indexarray = NULL;
 	}
+	if(positionarray) {
+		delete[] positionarray;
+		positionarray = NULL;
+	}
+	clearClusters();
+	nlods = 0;
+	lastlod = -1;
 	nverts = 0;
 	ntris = 0;
 }
@@ -72,6 +219,9 @@ void TriangleSoup::createTriangle() {
         0,1,2
     };
 
+    // Delete any previous content in the TriangleSoup object
+    clean();
+
     nverts = 3;
     ntris = 1;
 
@@ -84,49 +234,9 @@ void TriangleSoup::createTriangle() {
         indexarray[i]=index_array_data[i];
     }
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &(vao));
-	glBindVertexArray(vao);
-
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
-
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 floats (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3 or 6 floats (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
-
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
-
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the index buffer while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Send the data to OpenGL
+	computeBounds();
+	upload();
 };
 
 
@@ -193,6 +303,9 @@ void TriangleSoup::createBox(float xsize, float ysize, float zsize) {
         11,5,8,  //grn V3->V1->V2
     };
 
+    // Delete any previous content in the TriangleSoup object
+    clean();
+
     nverts = 24;
     ntris = 12;
 
@@ -207,52 +320,56 @@ void TriangleSoup::createBox(float xsize, float ysize, float zsize) {
         indexarray[i]=index_array_data[i];
     }
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &(vao));
-	glBindVertexArray(vao);
-
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
-
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 floats (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3 or 6 floats (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
-
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
-
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the index buffer while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	// Send the data to OpenGL
+	computeBounds();
+	upload();
 };
 
 
+/*
+ * Fill one latitude ring of 'count' sphere vertices, at height z and
+ * ring radius R (for a unit sphere), from tables of the longitudes.
+ * The SSE2 version computes two vertices at a time with the same
+ * double precision products and float conversions as the scalar
+ * code, so the results are identical.
+ */
+static void fillSphereRing(float *v, int count, float radius, float z, float R, float t,
+    const double *cosphi, const double *sinphi, const float *s) {
+
+	int i = 0;
+#ifdef __SSE2__
+	__m128d R2 = _mm_set1_pd((double)R);
+	__m128 rad = _mm_set1_ps(radius);
+	__m128 z4 = _mm_set1_ps(z);
+	__m128 rz4 = _mm_set1_ps(radius*z);
+	__m128 t4 = _mm_set1_ps(t);
+	for(; i+2<=count; i+=2, v+=16) {
+		__m128 x = _mm_cvtpd_ps(_mm_mul_pd(R2, _mm_loadu_pd(&cosphi[i]))); // x0 x1 0 0
+		__m128 y = _mm_cvtpd_ps(_mm_mul_pd(R2, _mm_loadu_pd(&sinphi[i]))); // y0 y1 0 0
+		__m128 st = _mm_unpacklo_ps(_mm_loadl_pi(_mm_setzero_ps(), (const __m64*)&s[i]), t4);
+		__m128 pxy = _mm_unpacklo_ps(_mm_mul_ps(rad, x), _mm_mul_ps(rad, y)); // rx0 ry0 rx1 ry1
+		__m128 zx = _mm_unpacklo_ps(rz4, x);  // rz x0 rz x1
+		__m128 yz = _mm_unpacklo_ps(y, z4);   // y0 z y1 z
+		_mm_storeu_ps(v, _mm_movelh_ps(pxy, zx));     // rx0 ry0 rz x0
+		_mm_storeu_ps(v+4, _mm_movelh_ps(yz, st));    // y0 z s0 t
+		_mm_storeu_ps(v+8, _mm_movehl_ps(zx, pxy));   // rx1 ry1 rz x1
+		_mm_storeu_ps(v+12, _mm_movehl_ps(st, yz));   // y1 z s1 t
+	}
+#endif
+	for(; i<count; i++, v+=8) {
+		float x = R*cosphi[i];
+		float y = R*sinphi[i];
+		v[0] = radius*x;
+		v[1] = radius*y;
+		v[2] = radius*z;
+		v[3] = x;
+		v[4] = y;
+		v[5] = z;
+		v[6] = s[i];
+		v[7] = t;
+	}
+}
+
 /*
  * createSphere(float radius, int segments)
  *
@@ -265,28 +382,45 @@ void TriangleSoup::createBox(float xsize, float ysize, float zsize) {
  * coordinates (s, t). The arrays are allocated by malloc() inside the
  * function and should be disposed of using free() when they are no longer
  * needed, e.g with the function soupDelete().
+ * Large spheres are generated with one thread per CPU core, using
+ * tables of sines and cosines instead of computing them per vertex.
+ * The tables are taken from the scratch arena, and so are the vertex
+ * and index arrays if the retention policy frees them after upload.
  *
  * Author: Stefan Gustavson (stegu@itn.liu.se) 2014.
  * This code is in the public domain.
  */
-void TriangleSoup::createSphere(float radius, int segments) {
+void TriangleSoup::createSphere(float radius, int segments, ScratchArena *scratch) {
 
-	int i, j, base, i0;
-	float x, y, z, R;
-	double theta, phi;
 	int vsegs, hsegs;
+	int numthreads = 1;
+	size_t base;
+	double *cosphi, *sinphi; // Longitude table, hsegs+1 entries
+	float *ss;               // s texture coordinate for each longitude
 	int stride = 8;
+	ScratchArena *arena = scratch ? scratch : ScratchArena::acquire();
+	ScratchArena::Mark start = arena->mark();
 
 	// Delete any previous content in the TriangleSoup object
 	clean();
 
 	vsegs = segments;
 	if (vsegs < 2) vsegs = 2;
+	// glDrawElements() takes the index count as a GLsizei, 3*ntris = 12*vsegs*(vsegs-1)
+	if (12.0 * vsegs * (vsegs-1) > 2147483647.0) {
+		vsegs = 13377;
+		printError("TriangleSoup::createSphere()", "Too many segments, using 13377.");
+	}
 	hsegs = vsegs * 2;
 	nverts = 1 + (vsegs-1) * (hsegs+1) + 1; // top + middle + bottom
 	ntris = hsegs + (vsegs-2) * hsegs * 2 + hsegs; // top + middle + bottom
-	vertexarray = new float[nverts * 8];
-	indexarray = new GLuint[ntris * 3];
+	allocateArrays(arena);
+
+	// Large spheres are split into bands of rings, one for each thread
+	if (nverts >= 65536) {
+		numthreads = std::max(1u, std::thread::hardware_concurrency());
+		numthreads = std::min(numthreads, vsegs-1);
+	}
 
 	// The vertex array: 3D xyz, 3D normal, 2D st (8 floats per vertex)
 	// First vertex: top pole (+z is "up" in object local coords)
@@ -299,7 +433,7 @@ void TriangleSoup::createSphere(float radius, int segments) {
 	vertexarray[6] = 0.5f;
 	vertexarray[7] = 1.0f;
 	// Last vertex: bottom pole
-	base = (nverts-1)*stride;
+	base = (size_t)(nverts-1)*stride;
 	vertexarray[base] = 0.0f;
 	vertexarray[base+1] = 0.0f;
 	vertexarray[base+2] = -radius;
@@ -314,321 +448,918 @@ void TriangleSoup::createSphere(float radius, int segments) {
 #ifndef M_PI
 #define M_PI 3.1415926536
 #endif // M_PI
-	for(j=0; j<vsegs-1; j++) { // vsegs-1 latitude rings of vertices
-		theta = (double)(j+1)/vsegs*M_PI;
-		z = cos(theta);
-		R = sin(theta);
-		for (i=0; i<=hsegs; i++) { // hsegs+1 vertices in each ring (duplicate for texcoords)
-        	phi = (double)i/hsegs*2.0*M_PI;
-        	x = R*cos(phi);
-        	y = R*sin(phi);
-			base = (1+j*(hsegs+1)+i)*stride;
-    		vertexarray[base] = radius*x;
-    		vertexarray[base+1] = radius*y;
-    		vertexarray[base+2] = radius*z;
-    		vertexarray[base+3] = x;
-    		vertexarray[base+4] = y;
-    		vertexarray[base+5] = z;
-    		vertexarray[base+6] = (float)i/hsegs;
-    		vertexarray[base+7] = 1.0f-(float)(j+1)/vsegs;
-		}
-	}
-
-	// The index array: triplets of integers, one for each triangle
-	// Top cap
-	for(i=0; i<hsegs; i++) {
-    	indexarray[3*i]=0;
-		indexarray[3*i+1]=1+i;
-		indexarray[3*i+2]=2+i;
-	}
-	// Middle part (possibly empty if vsegs=2)
-	for(j=0; j<vsegs-2; j++) {
-		for(i=0; i<hsegs; i++) {
-			base = 3*(hsegs + 2*(j*hsegs + i));
-			i0 = 1 + j*(hsegs+1) + i;
-			indexarray[base] = i0;
-			indexarray[base+1] = i0+hsegs+1;
-			indexarray[base+2] = i0+1;
-			indexarray[base+3] = i0+1;
-			indexarray[base+4] = i0+hsegs+1;
-			indexarray[base+5] = i0+hsegs+2;
-		}
-	}
-	// Bottom cap
-	base = 3*(hsegs + 2*(vsegs-2)*hsegs);
-	for(i=0; i<hsegs; i++) {
-		indexarray[base+3*i] = nverts-1;
-		indexarray[base+3*i+1] = nverts-2-i;
-		indexarray[base+3*i+2] = nverts-3-i;
+	// Every ring uses the same longitudes, so compute their sines and
+	// cosines only once. The expressions are the same as they would be
+	// per vertex, to get exactly the same numbers.
+	cosphi = arena->allocate<double>(hsegs+1);
+	sinphi = arena->allocate<double>(hsegs+1);
+	ss = arena->allocate<float>(hsegs+1);
+	for (int i=0; i<=hsegs; i++) {
+		double phi = (double)i/hsegs*2.0*M_PI;
+		cosphi[i] = cos(phi);
+		sinphi[i] = sin(phi);
+		ss[i] = (float)i/hsegs;
 	}
+	runParallel(numthreads, [&](int part) {
+		int jbegin = (int)((long long)(vsegs-1)*part/numthreads);
+		int jend = (int)((long long)(vsegs-1)*(part+1)/numthreads);
+		for(int j=jbegin; j<jend; j++) { // vsegs-1 latitude rings of vertices
+			double theta = (double)(j+1)/vsegs*M_PI;
+			float z = cos(theta);
+			float R = sin(theta);
+			float t = 1.0f-(float)(j+1)/vsegs;
+			fillSphereRing(&vertexarray[(1+(size_t)j*(hsegs+1))*stride], hsegs+1,
+				radius, z, R, t, cosphi, sinphi, ss);
+		}
+	});
+
+	// The index array: triplets of integers, one for each triangle,
+	// in bands of triangles between neighbouring rings.
+	// Band 0 is the top cap and band vsegs-1 is the bottom cap.
+	runParallel(numthreads, [&](int part) {
+		int bbegin = (int)((long long)vsegs*part/numthreads);
+		int bend = (int)((long long)vsegs*(part+1)/numthreads);
+		for(int b=bbegin; b<bend; b++) {
+			if(b == 0) { // Top cap
+				for(int i=0; i<hsegs; i++) {
+					indexarray[3*i]=0;
+					indexarray[3*i+1]=1+i;
+					indexarray[3*i+2]=2+i;
+				}
+			}
+			else if(b == vsegs-1) { // Bottom cap
+				GLuint *out = &indexarray[3*(hsegs + 2*(size_t)(vsegs-2)*hsegs)];
+				for(int i=0; i<hsegs; i++) {
+					out[3*i] = nverts-1;
+					out[3*i+1] = nverts-2-i;
+					out[3*i+2] = nverts-3-i;
+				}
+			}
+			else { // Middle part (possibly empty if vsegs=2)
+				int j = b-1;
+				GLuint *out = &indexarray[3*(hsegs + 2*(size_t)j*hsegs)];
+				GLuint i0 = 1 + j*(hsegs+1);
+				for(int i=0; i<hsegs; i++, i0++) {
+					out[6*i] = i0;
+					out[6*i+1] = i0+hsegs+1;
+					out[6*i+2] = i0+1;
+					out[6*i+3] = i0+1;
+					out[6*i+4] = i0+hsegs+1;
+					out[6*i+5] = i0+hsegs+2;
+				}
+			}
+		}
+	});
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &(vao));
-	glBindVertexArray(vao);
+	// Send the data to OpenGL
+	computeBounds();
+	upload();
 
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
+	// Give back the temporary arrays
+	if(scratch) scratch->rewind(start);
+	else ScratchArena::release(arena);
+};
 
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3, 6 (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
 
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
+/*
+ * OBJ parsing helpers for readOBJ()
+ *
+ * These work directly on the memory mapped file, with 'end' pointing
+ * one byte past the last character, so they never read outside the file.
+ * Unlike sscanf() and atof(), they do not depend on the C locale:
+ * the decimal separator is always '.', as the OBJ format requires.
+ * The number parsers return NULL if no number could be read.
+ */
 
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the buffers while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+/* Skip blanks (spaces and tabs), but not line breaks */
+static const char *skipBlanks(const char *p, const char *end) {
+	while(p < end && (*p == ' ' || *p == '\t')) p++;
+	return p;
+}
+
+/* Skip to the first character of the next line */
+static const char *skipLine(const char *p, const char *end) {
+	while(p < end && *p != '\n') p++;
+	return (p < end) ? p+1 : end;
+}
+
+/* Parse a signed decimal integer */
+static const char *parseInt(const char *p, const char *end, int *value) {
+
+	const char *digits;
+	int negative = 0;
+	int n = 0;
+
+	if(p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+	digits = p;
+	while(p < end && *p >= '0' && *p <= '9') {
+		n = 10*n + (*p - '0');
+		p++;
+	}
+	if(p == digits) return NULL;
+	*value = negative ? -n : n;
+	return p;
+}
+
+/* Parse a decimal floating point number, like "-1.25" or "3.5e-2" */
+static const char *parseFloat(const char *p, const char *end, float *value) {
+
+	// All powers of ten that are exactly representable as a double
+	static const double powersOf10[] = {
+		1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	unsigned long long mantissa = 0;
+	int exponent = 0; // Decimal exponent to apply to the mantissa
+	int numdigits = 0;
+	int negative = 0;
+	int e;
+	const char *q;
+	double result;
+
+	if(p < end && (*p == '-' || *p == '+')) {
+		negative = (*p == '-');
+		p++;
+	}
+	while(p < end && *p >= '0' && *p <= '9') {
+		if(mantissa < 100000000000000000ULL) mantissa = 10*mantissa + (*p - '0');
+		else exponent++; // Digits beyond the 18th only scale the value
+		numdigits++;
+		p++;
+	}
+	if(p < end && *p == '.') {
+		p++;
+		while(p < end && *p >= '0' && *p <= '9') {
+			if(mantissa < 100000000000000000ULL) {
+				mantissa = 10*mantissa + (*p - '0');
+				exponent--;
+			}
+			numdigits++;
+			p++;
+		}
+	}
+	if(numdigits == 0) return NULL;
+	if(p < end && (*p == 'e' || *p == 'E')) {
+		q = parseInt(p+1, end, &e);
+		if(q) { // A lone "e" is not part of the number
+			exponent += e;
+			p = q;
+		}
+	}
+
+	// For the short mantissas in typical OBJ files, this is exact
+	// up to the final rounding, because both factors are exact doubles.
+	result = (double)mantissa;
+	if(mantissa == 0 || exponent < -400) {
+		result = 0.0;
+	}
+	else if(exponent > 400) {
+		result = HUGE_VAL;
+	}
+	else if(exponent < 0) {
+		while(exponent < -22) {
+			result /= 1e22;
+			exponent += 22;
+		}
+		result /= powersOf10[-exponent];
+	}
+	else {
+		while(exponent > 22) {
+			result *= 1e22;
+			exponent -= 22;
+		}
+		result *= powersOf10[exponent];
+	}
+	*value = (float)(negative ? -result : result);
+	return p;
+}
+
+/* Parse n floats separated by blanks */
+static const char *parseFloats(const char *p, const char *end, float *values, int n) {
+	for(int i=0; i<n && p; i++) {
+		p = parseFloat(skipBlanks(p, end), end, &values[i]);
+	}
+	return p;
+}
+
+/* Parse one face corner on the form v/t/n */
+static const char *parseCorner(const char *p, const char *end, int *corner) {
+	p = parseInt(skipBlanks(p, end), end, &corner[0]);
+	if(!p || p >= end || *p != '/') return NULL;
+	p = parseInt(p+1, end, &corner[1]);
+	if(!p || p >= end || *p != '/') return NULL;
+	return parseInt(p+1, end, &corner[2]);
+}
+
+/* Check if there is nothing but blanks or a comment left on the line */
+static bool atLineEnd(const char *p, const char *end) {
+	p = skipBlanks(p, end);
+	return (p == end || *p == '\n' || *p == '\r' || *p == '#');
+}
+
+enum { OBJ_ERROR_NONE = 0, OBJ_ERROR_VERTEX, OBJ_ERROR_NORMAL,
+	OBJ_ERROR_TEXCOORD, OBJ_ERROR_FACE, OBJ_ERROR_RANGE };
+
+/*
+ * The parsed contents of one chunk of an OBJ file.
+ * Face indices are stored 0-based. Positive OBJ indices are global
+ * and can be used as they are, but negative (relative) indices can
+ * only be resolved against the chunk's own lists. Those are listed
+ * in 'relative' and fixed up when the chunks are merged.
+ */
+struct OBJChunk {
+	const char *begin, *end;       // The part of the file to parse
+	ScratchVector<float> verts, normals, texcoords;
+	ScratchVector<int> faces;      // 9 indices per face: v1 t1 n1 v2 t2 n2 v3 t3 n3
+	ScratchVector<int> relative;   // Positions in 'faces' that are chunk relative
+	int error;                     // One of the OBJ_ERROR_XXX codes above
+	int badface;                   // Chunk-local face with an index out of range
+	int firstvert, firstnormal, firsttexcoord, firstface; // Offsets into the merged lists
+
+	// The lists grow in 'arena', which only the parsing thread may use
+	OBJChunk(ScratchArena *arena) : begin(NULL), end(NULL), verts(arena), normals(arena),
+		texcoords(arena), faces(arena), relative(arena), error(OBJ_ERROR_NONE), badface(-1),
+		firstvert(0), firstnormal(0), firsttexcoord(0), firstface(0) {}
+};
+
+/* Store one index from a face, resolving it if it is relative */
+static void addFaceIndex(OBJChunk *chunk, int index, int count) {
+	if(index < 0) {
+		chunk->relative.push_back(chunk->faces.size());
+		chunk->faces.push_back(count + index);
+	}
+	else {
+		chunk->faces.push_back(index - 1);
+	}
+}
+
+/* Parse all lines in one chunk of an OBJ file */
+static void parseOBJChunk(OBJChunk *chunk) {
+
+	const char *p = chunk->begin;
+	const char *end = chunk->end;
+	const char *tag;
+	float values[3];
+	int corner[3];
+	int i, taglen;
+	size_t facestart;
+
+	while(p < end) {
+		p = skipBlanks(p, end);
+		tag = p;
+		while(p < end && *p > ' ') p++;
+		taglen = p - tag;
+		if(taglen == 1 && tag[0] == 'v') {
+			p = parseFloats(p, end, values, 3);
+			if(!p) {
+				chunk->error = OBJ_ERROR_VERTEX;
+				return;
+			}
+			chunk->verts.insert(chunk->verts.end(), values, values+3);
+		}
+		else if(taglen == 2 && tag[0] == 'v' && tag[1] == 'n') {
+			p = parseFloats(p, end, values, 3);
+			if(!p) {
+				chunk->error = OBJ_ERROR_NORMAL;
+				return;
+			}
+			chunk->normals.insert(chunk->normals.end(), values, values+3);
+		}
+		else if(taglen == 2 && tag[0] == 'v' && tag[1] == 't') {
+			p = parseFloats(p, end, values, 2);
+			if(!p) {
+				chunk->error = OBJ_ERROR_TEXCOORD;
+				return;
+			}
+			chunk->texcoords.insert(chunk->texcoords.end(), values, values+2);
+		}
+		else if(taglen == 1 && tag[0] == 'f') {
+			facestart = chunk->faces.size();
+			for(i=0; i<3 && p; i++) {
+				p = parseCorner(p, end, corner);
+				if(p) {
+					addFaceIndex(chunk, corner[0], chunk->verts.size()/3);
+					addFaceIndex(chunk, corner[1], chunk->texcoords.size()/2);
+					addFaceIndex(chunk, corner[2], chunk->normals.size()/3);
+				}
+			}
+			if(!p || !atLineEnd(p, end)) { // Too few corners, or more than three
+				chunk->faces.resize(facestart);
+				chunk->error = OBJ_ERROR_FACE;
+				return;
+			}
+		}
+		p = skipLine(p, end);
+	}
+}
+
+/* Write one interleaved vertex from the attributes of a face corner (v/t/n) */
+static void copyOBJVertex(float *vertex, const int *corner, const float *verts,
+	const float *normals, const float *texcoords) {
+	vertex[0] = verts[3*corner[0]];
+	vertex[1] = verts[3*corner[0]+1];
+	vertex[2] = verts[3*corner[0]+2];
+	vertex[3] = normals[3*corner[2]];
+	vertex[4] = normals[3*corner[2]+1];
+	vertex[5] = normals[3*corner[2]+2];
+	vertex[6] = texcoords[2*corner[1]];
+	vertex[7] = texcoords[2*corner[1]+1];
+}
+
+/*
+ * A hash set of v/t/n face corners for vertex welding in readOBJ().
+ * add() returns the same index for every occurrence of a combination.
+ * Open addressing with linear probing keeps this linear in time,
+ * and the table is doubled when it gets half full.
+ */
+struct OBJWelder {
+
+	ScratchVector<int> unique; // 3 ints (v/t/n) for each unique corner
+	ScratchVector<int> table;  // Index into 'unique', or -1 for an empty slot
+	unsigned int mask;         // Table size - 1 (the size is a power of two)
+
+	OBJWelder(int numcorners, ScratchArena *arena) : unique(arena), table(arena) {
+		// Meshes typically share each vertex between several faces,
+		// so start small and let the table grow if needed.
+		unsigned int size = 1024;
+		while(size < (unsigned int)numcorners/2) size *= 2;
+		table.assign(size, -1);
+		mask = size - 1;
+		unique.reserve(3*(size/2));
+	}
+
+	static unsigned int hash(const int *corner) {
+		unsigned int h = corner[0]*0x9e3779b1u ^ corner[1]*0x85ebca77u ^ corner[2]*0xc2b2ae3du;
+		return h ^ (h >> 15);
+	}
+
+	GLuint add(const int *corner) {
+		unsigned int slot = hash(corner) & mask;
+		while(table[slot] >= 0) {
+			const int *u = &unique[3*table[slot]];
+			if(u[0] == corner[0] && u[1] == corner[1] && u[2] == corner[2]) {
+				return table[slot];
+			}
+			slot = (slot + 1) & mask;
+		}
+		table[slot] = unique.size()/3;
+		unique.insert(unique.end(), corner, corner+3);
+		if(unique.size()/3 > table.size()/2) {
+			grow();
+		}
+		return unique.size()/3 - 1;
+	}
 
+	void grow() {
+		unsigned int slot;
+		table.assign(2*table.size(), -1);
+		mask = table.size() - 1;
+		for(int i=0; i<(int)unique.size()/3; i++) {
+			slot = hash(&unique[3*i]) & mask;
+			while(table[slot] >= 0) slot = (slot + 1) & mask;
+			table[slot] = i;
+		}
+	}
 };
 
 
 /*
- * readObj(const char* filename)
+ * readObj(const char* filename, int flags)
  *
  * Load TriangleSoup geometry data from an OBJ file.
  * The vertex array is on interleaved format. For each vertex, there
  * are 8 floats: three for the vertex coordinates (x, y, z), three
  * for the normal vector (n_x, n_y, n_z) and finally two for texture
- * coordinates (s, t). The returned arrays are allocated by malloc()
- * inside the function and should be disposed of using free() when
- * they are no longer needed, e.g. by calling soupDelete().
+ * coordinates (s, t). Each face gets three vertices of its own.
+ *
+ * The file is memory mapped and parsed in a single pass. The attribute
+ * lists and the face indices are collected in growable arrays, and the
+ * vertex array is assembled once the whole file has been read.
+ * Faces must be triangles with all three indices v/t/n present.
+ * The parse speed is reported in MB/s on the console.
+ *
+ * With OBJ_PARALLEL in 'flags', the file is split at line breaks into
+ * one chunk per CPU core. The chunks are parsed in parallel, their
+ * attribute lists are concatenated in file order, and each chunk then
+ * writes its own faces to the vertex array.
+ *
+ * With OBJ_WELD in 'flags', each unique combination of v/t/n indices
+ * becomes one vertex, shared between faces through the index array,
+ * instead of every face getting three vertices of its own.
+ * The vertex reduction is reported on the console.
+ *
+ * Unless OBJ_NOCACHE is in 'flags', the result is also written to a
+ * binary cache file next to the OBJ file, named like "mesh.obj.tsc"
+ * ("mesh.obj.weld.tsc" for welded meshes). Later calls map that file
+ * and hand its vertex and index blocks directly to OpenGL without any
+ * parsing. The cache is rewritten if the size or the modification time
+ * of the OBJ file has changed.
+ *
+ * All temporary arrays are taken from the scratch arena 'scratch', or
+ * from a pooled one if it is NULL, and each parsing thread has a pooled
+ * arena of its own. So are the vertex and index arrays if the retention
+ * policy frees them after upload. The arenas are given back when the
+ * mesh is loaded, and the peak scratch memory is reported.
  *
  * Author: Stefan Gustavson (stegu@itn.liu.se) 2014.
  * This code is in the public domain.
  */
-void TriangleSoup::readOBJ(const char* filename) {
-
-	FILE *objfile;
-
+void TriangleSoup::readOBJ(const char* filename, int flags, ScratchArena *scratch) {
+
+	MappedFile objfile;
+	std::vector<OBJChunk> chunks;
+	std::vector<ScratchArena*> chunkarenas; // Arena of each chunk, the first is 'arena'
+	ScratchArena *arena;
+	ScratchArena::Mark start;
+	size_t startused, scratchpeak, hugebytes;
+	float *verts, *normals, *texcoords;
+	const char *p, *end;
 	int numverts = 0;
 	int numnormals = 0;
 	int numtexcoords = 0;
 	int numfaces = 0;
-	int i_v = 0;
-	int i_n = 0;
-	int i_t = 0;
-	int i_f = 0;
-	float *verts, *normals, *texcoords;
+	int numchunks, c;
+	int readerror = 0;
+	std::chrono::steady_clock::time_point starttime;
+	double seconds;
+	std::string cachename;
+	long long sourcesize, sourcemtime;
+	bool cacheable;
 
-	char line[256];
-	char tag[3];
-	int v1, v2, v3, n1, n2, n3, t1, t2, t3;
-	int numargs, readerror, currentv;
+	// Delete any previous content in the TriangleSoup object
+	clean();
 
-	readerror = 0;
+	starttime = std::chrono::steady_clock::now();
+
+	// Use the binary cache file if it is up to date with the OBJ file.
+	// Welded and unwelded meshes are different, so they get one file each.
+	cachename = std::string(filename) + ((flags & OBJ_WELD) ? ".weld.tsc" : ".tsc");
+	cacheable = !(flags & OBJ_NOCACHE)
+		&& MappedFile::stat(filename, &sourcesize, &sourcemtime);
+	if(cacheable && readCache(cachename.c_str(), sourcesize, sourcemtime, flags & OBJ_WELD)) {
+		upload();
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+		printf("readOBJ(\"%s\"): loaded %d vertices, %d faces from \"%s\" in %.3f s.\n",
+			filename, nverts, ntris, cachename.c_str(), seconds);
+		return;
+	}
 
-	objfile = fopen(filename, "r");
+	if(!objfile.open(filename)) {
+		printError("File not found", filename);
+		return;
+	}
 
-	if(!objfile) {
-        printError("File not found", filename);
-		readerror = 1;
+	arena = scratch ? scratch : ScratchArena::acquire();
+	start = arena->mark();
+	startused = arena->used();
+	arena->resetPeak();
+
+	// Split the file into chunks that end at line breaks.
+	// Small chunks are not worth a thread of their own.
+	numchunks = 1;
+	if(flags & OBJ_PARALLEL) {
+		numchunks = std::thread::hardware_concurrency();
+		if(numchunks > (int)(objfile.size >> 20) + 1) numchunks = (objfile.size >> 20) + 1;
+		if(numchunks < 1) numchunks = 1;
+	}
+	chunkarenas.push_back(arena);
+	for(c=1; c<numchunks; c++) {
+		chunkarenas.push_back(ScratchArena::acquire());
+	}
+	chunks.reserve(numchunks);
+	p = objfile.data;
+	end = objfile.data + objfile.size;
+	for(c=0; c<numchunks; c++) {
+		chunks.push_back(OBJChunk(chunkarenas[c]));
+		chunks[c].begin = p;
+		if(c == numchunks-1) {
+			p = end;
+		}
+		else {
+			p = objfile.data + objfile.size/numchunks*(c+1);
+			if(p < chunks[c].begin) p = chunks[c].begin;
+			p = skipLine(p, end);
+		}
+		chunks[c].end = p;
+		chunks[c].error = OBJ_ERROR_NONE;
+		chunks[c].badface = -1;
 	}
 
-	// Scan through the file to count the number of data elements
-	while(fgets(line, 256, objfile)) {
-		sscanf(line, "%2s ", tag);
-		if(!strcmp(tag, "v")) numverts++;
-		else if(!strcmp(tag, "vn")) numnormals++;
-		else if(!strcmp(tag, "vt")) numtexcoords++;
-		else if(!strcmp(tag, "f")) numfaces++;
-		//else printf("Ignoring line starting with \"%s\"\n", tag);
+	runParallel(numchunks, [&](int c) { parseOBJChunk(&chunks[c]); });
+
+	// Find where each chunk goes in the merged lists. Stop at the first
+	// chunk with an error, because nothing after it is valid.
+	for(c=0; c<numchunks; c++) {
+		OBJChunk &chunk = chunks[c];
+		chunk.firstvert = numverts;
+		chunk.firstnormal = numnormals;
+		chunk.firsttexcoord = numtexcoords;
+		chunk.firstface = numfaces;
+		numverts += chunk.verts.size()/3;
+		numnormals += chunk.normals.size()/3;
+		numtexcoords += chunk.texcoords.size()/2;
+		numfaces += chunk.faces.size()/9;
+		if(chunk.error) {
+			readerror = 1;
+			break;
+		}
 	}
 
-	printf("loadObj(\"%s\"): found %d vertices, %d normals, %d texcoords, %d faces.\n",
+	printf("readOBJ(\"%s\"): found %d vertices, %d normals, %d texcoords, %d faces.\n",
 		filename, numverts, numnormals, numtexcoords, numfaces);
 
-	verts = new float[3*numverts];
-	normals = new float[3*numnormals];
-	texcoords = new float[2*numtexcoords];
-
-	vertexarray = new float[8*3*numfaces];
-	indexarray = new unsigned int[3*numfaces];
-	nverts = 3*numfaces;
-	ntris = numfaces;
-
-	rewind(objfile); // Start from the top again to read data
-
-	while(fgets(line, 256, objfile)) {
-		tag[0] = '\0';
-		sscanf(line, "%2s ", tag);
-		if(!strcmp(tag, "v")) {
-//			printf("Reading vertex %d\n", i_v+1);
-			numargs = sscanf(line, "v %f %f %f",
-				&verts[3*i_v], &verts[3*i_v+1], &verts[3*i_v+2]);
-			if(numargs != 3) {
-				printf("Malformed vertex data found at vertex %d.\n", i_v+1);
-				printf("Aborting.\n");
-				readerror = 1;
-				break;
+	if(readerror) {
+		switch(chunks[c].error) {
+		case OBJ_ERROR_VERTEX:
+			printf("Malformed vertex data found at vertex %d.\n", numverts+1);
+			break;
+		case OBJ_ERROR_NORMAL:
+			printf("Malformed normal data found at normal %d.\n", numnormals+1);
+			break;
+		case OBJ_ERROR_TEXCOORD:
+			printf("Malformed texcoord data found at texcoord %d.\n", numtexcoords+1);
+			break;
+		default:
+			printf("Malformed face data found at face %d.\n", numfaces+1);
+		}
+	}
+	else {
+		// Concatenate the attribute lists. With only one chunk,
+		// its lists can be used as they are.
+		if(numchunks == 1) {
+			verts = chunks[0].verts.data();
+			normals = chunks[0].normals.data();
+			texcoords = chunks[0].texcoords.data();
+		}
+		else {
+			verts = arena->allocate<float>(3*(size_t)numverts);
+			normals = arena->allocate<float>(3*(size_t)numnormals);
+			texcoords = arena->allocate<float>(2*(size_t)numtexcoords);
+			runParallel(numchunks, [&](int c) {
+				OBJChunk &chunk = chunks[c];
+				std::copy(chunk.verts.begin(), chunk.verts.end(), verts + 3*chunk.firstvert);
+				std::copy(chunk.normals.begin(), chunk.normals.end(), normals + 3*chunk.firstnormal);
+				std::copy(chunk.texcoords.begin(), chunk.texcoords.end(), texcoords + 2*chunk.firsttexcoord);
+			});
+		}
+
+		// Resolve the relative indices in each chunk and check
+		// that all indices refer to existing attributes
+		runParallel(numchunks, [&](int c) {
+			OBJChunk &chunk = chunks[c];
+			int i;
+			for(i=0; i<(int)chunk.relative.size(); i++) {
+				switch(chunk.relative[i] % 3) {
+				case 0: chunk.faces[chunk.relative[i]] += chunk.firstvert; break;
+				case 1: chunk.faces[chunk.relative[i]] += chunk.firsttexcoord; break;
+				case 2: chunk.faces[chunk.relative[i]] += chunk.firstnormal; break;
+				}
 			}
-//			printf("Read vertex coord %d: %8.2f %8.2f %8.2f\n",
-//			i_v, verts[3*i_v], verts[3*i_v+1], verts[3*i_v+2]);
-			i_v++;
-		}
-		else if(!strcmp(tag, "vn")) {
-//			printf("Reading normal %d\n", i_n+1);
-			numargs = sscanf(line, "vn %f %f %f",
-				&normals[3*i_n], &normals[3*i_n+1], &normals[3*i_n+2]);
-			if(numargs != 3) {
-				printf("Malformed normal data found at normal %d.\n", i_n+1);
-				printf("Aborting.\n");
-				readerror = 1;
-				break;
+			for(i=0; i<(int)chunk.faces.size(); i+=3) {
+				if(chunk.faces[i] < 0 || chunk.faces[i] >= numverts
+					|| chunk.faces[i+1] < 0 || chunk.faces[i+1] >= numtexcoords
+					|| chunk.faces[i+2] < 0 || chunk.faces[i+2] >= numnormals) {
+					chunk.badface = i/9;
+					break;
+				}
 			}
-			i_n++;
-		}
-		else if(!strcmp(tag, "vt"))  {
-//          printf("Reading texcoord %d\n", i_t+1);
-			numargs = sscanf(line, "vt %f %f",
-				&texcoords[2*i_t], &texcoords[2*i_t+1]);
-			if(numargs != 2) {
-				printf("Malformed texcoord data found at texcoord %d.\n", i_t+1);
-				printf("Aborting.\n");
+		});
+
+		for(c=0; c<numchunks; c++) {
+			if(chunks[c].badface >= 0) {
+				printf("Index out of range found at face %d.\n", chunks[c].firstface + chunks[c].badface + 1);
 				readerror = 1;
 				break;
 			}
-			i_t++;
-		}
-		else if(!strcmp(tag, "f")) {
-//			printf("Reading face %d\n", i_f+1);
-			numargs = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d",
-				&v1, &t1, &n1, &v2, &t2, &n2, &v3, &t3, &n3);
-			if(numargs != 9) {
-				printf("Malformed face data found at face %d.\n", i_f+1);
-				printf("Aborting.\n");
-				readerror = 1;
-				break;
+		}
+	}
+
+	if(!readerror && (flags & OBJ_WELD)) {
+		// Give each unique v/t/n combination one vertex of its own,
+		// and let the faces share them through the index array
+		OBJWelder welder(3*numfaces, arena);
+		GLuint *welded = arena->allocate<GLuint>(3*(size_t)numfaces);
+		for(c=0; c<numchunks; c++) {
+			const int *corner = chunks[c].faces.data();
+			GLuint *index = welded + 3*chunks[c].firstface;
+			for(int i=0; i<(int)chunks[c].faces.size(); i+=3) {
+				*index++ = welder.add(corner + i);
 			}
-//			printf("Read vertex data %d/%d/%d %d/%d/%d %d/%d/%d\n",
-//			v1, t1, n1, v2, t2, n2, v3, t3, n3);
-			v1--; v2--; v3--; n1--; n2--; n3--; t1--; t2--; t3--;
-			currentv = 8*3*i_f;
-			vertexarray[currentv] = verts[3*v1];
-			vertexarray[currentv+1] = verts[3*v1+1];
-			vertexarray[currentv+2] = verts[3*v1+2];
-			vertexarray[currentv+3] = normals[3*n1];
-			vertexarray[currentv+4] = normals[3*n1+1];
-			vertexarray[currentv+5] = normals[3*n1+2];
-			vertexarray[currentv+6] = texcoords[2*t1];
-			vertexarray[currentv+7] = texcoords[2*t1+1];
-			vertexarray[currentv+8] = verts[3*v2];
-			vertexarray[currentv+9] = verts[3*v2+1];
-			vertexarray[currentv+10] = verts[3*v2+2];
-			vertexarray[currentv+11] = normals[3*n2];
-			vertexarray[currentv+12] = normals[3*n2+1];
-			vertexarray[currentv+13] = normals[3*n2+2];
-			vertexarray[currentv+14] = texcoords[2*t2];
-			vertexarray[currentv+15] = texcoords[2*t2+1];
-			vertexarray[currentv+16] = verts[3*v3];
-			vertexarray[currentv+17] = verts[3*v3+1];
-			vertexarray[currentv+18] = verts[3*v3+2];
-			vertexarray[currentv+19] = normals[3*n3];
-			vertexarray[currentv+20] = normals[3*n3+1];
-			vertexarray[currentv+21] = normals[3*n3+2];
-			vertexarray[currentv+22] = texcoords[2*t3];
-			vertexarray[currentv+23] = texcoords[2*t3+1];
-			indexarray[3*i_f] = 3*i_f;
-			indexarray[3*i_f+1] = 3*i_f+1;
-			indexarray[3*i_f+2] = 3*i_f+2;
-			i_f++;
-		};
-	}
-
-	// Clean up the temporary arrays we created
-	delete[] verts; verts = NULL;
-	delete[] normals; normals = NULL;
-	delete[] texcoords; texcoords = NULL;
-	fclose(objfile);
-
-	if(readerror) { // Delete corrupt data and bail out if a read error occured
-        printError("Mesh read error","No mesh data generated");
-		clean();
-		return;
+		}
+		nverts = welder.unique.size()/3;
+		ntris = numfaces;
+		allocateArrays(arena);
+		std::copy(welded, welded + 3*(size_t)numfaces, indexarray);
+		runParallel(numchunks, [&](int c) {
+			int first = (long long)nverts*c/numchunks;
+			int last = (long long)nverts*(c+1)/numchunks;
+			for(int i=first; i<last; i++) {
+				copyOBJVertex(vertexarray + 8*i, &welder.unique[3*i], verts, normals, texcoords);
+			}
+		});
+		printf("readOBJ(\"%s\"): welded %d vertices to %d (reduction %.2f:1).\n",
+			filename, 3*numfaces, nverts, (nverts > 0) ? 3.0*numfaces/nverts : 0.0);
+	}
+	else if(!readerror) {
+		// Each chunk writes its own faces, three vertices per face
+		nverts = 3*numfaces;
+		ntris = numfaces;
+		allocateArrays(arena);
+		runParallel(numchunks, [&](int c) {
+			OBJChunk &chunk = chunks[c];
+			int first = 3*chunk.firstface;
+			int chunkverts = chunk.faces.size()/3;
+			for(int i=0; i<chunkverts; i++) {
+				copyOBJVertex(vertexarray + 8*(first + i), &chunk.faces[3*i], verts, normals, texcoords);
+				indexarray[first + i] = first + i;
+			}
+		});
 	}
 
-	// Generate one vertex array object (VAO) and bind it
-	glGenVertexArrays(1, &vao);
-	glBindVertexArray(vao);
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+	printf("readOBJ(\"%s\"): parsed %.1f MB in %.3f s (%.1f MB/s, %d thread%s).\n", filename,
+		objfile.size/1e6, seconds, (seconds > 0.0) ? objfile.size/1e6/seconds : 0.0,
+		numchunks, (numchunks > 1) ? "s" : "");
 
-	// Generate two buffer IDs
-	glGenBuffers(1, &vertexbuffer);
-	glGenBuffers(1, &indexbuffer);
+	scratchpeak = arena->peak() - startused;
+	hugebytes = arena->hugePageBytes();
+	for(c=1; c<numchunks; c++) {
+		scratchpeak += chunkarenas[c]->peak();
+		hugebytes += chunkarenas[c]->hugePageBytes();
+	}
+	printf("readOBJ(\"%s\"): peak scratch memory %.1f MB (blocks on huge pages: %.1f MB).\n",
+		filename, scratchpeak/1e6, hugebytes/1e6);
 
- 	// Activate the vertex buffer
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
- 	// Present our vertex coordinates to OpenGL
-	glBufferData(GL_ARRAY_BUFFER,
-		8*nverts * sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
+	if(readerror) { // Delete corrupt data if a read error occured
+        printError("Mesh read error","No mesh data generated");
+		clean();
+	}
+	else {
+		computeBounds();
+		if(cacheable) {
+			writeCache(cachename.c_str(), sourcesize, sourcemtime, flags & OBJ_WELD);
+		}
 
-	// Specify how many attribute arrays we have in our VAO
-	glEnableVertexAttribArray(0); // Vertex coordinates
-	glEnableVertexAttribArray(1); // Normals
-	glEnableVertexAttribArray(2); // Texture coordinates
-	// Specify how OpenGL should interpret the vertex buffer data:
-	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
-	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
-	// Type GL_FLOAT
-	// Not normalized (GL_FALSE)
-	// Stride 8 (interleaved array with 8 floats per vertex)
-	// Array buffer offset 0, 3, 6 (offset into first vertex)
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)0); // xyz coordinates
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(3*sizeof(GLfloat))); // normals
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
-		8*sizeof(GLfloat), (void*)(6*sizeof(GLfloat))); // texcoords
+		// Send the data to OpenGL
+		upload();
+	}
 
- 	// Activate the index buffer
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
- 	// Present our vertex indices to OpenGL
- 	glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-	 	3*ntris*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
+	// Give back the temporary arrays
+	for(c=1; c<numchunks; c++) {
+		ScratchArena::release(chunkarenas[c]);
+	}
+	if(scratch) scratch->rewind(start);
+	else ScratchArena::release(arena);
+};
 
-	// Deactivate (unbind) the VAO and the buffers again.
-	// Do NOT unbind the buffers while the VAO is still bound.
-	// The index buffer is an essential part of the VAO state.
-	glBindVertexArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
- 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+/*
+ * optimizeVertexCache()
+ *
+ * Reorder the triangles for better reuse of transformed vertices
+ * in the GPU's post-transform vertex cache. The mesh looks the same,
+ * but fewer vertex shader runs are needed to draw it. The ACMR
+ * (vertex shader runs per triangle) and ATVR (runs per vertex) for
+ * a 16 entry FIFO cache are reported before and after.
+ * This has no effect on meshes where no vertices are shared between
+ * triangles, like OBJ meshes read without OBJ_WELD.
+ */
+void TriangleSoup::optimizeVertexCache() {
+
+	float acmrbefore, atvrbefore, acmr, atvr;
+
+	if(ntris == 0 || !haveArrays("TriangleSoup::optimizeVertexCache()", false)) return;
+
+	acmrbefore = MeshOptimizer::cacheStats(indexarray, ntris, nverts, 16, &atvrbefore);
+	clearClusters(); // The clusters refer to the old triangle order
+	MeshOptimizer::optimizeVertexCache(indexarray, ntris, nverts);
+	acmr = MeshOptimizer::cacheStats(indexarray, ntris, nverts, 16, &atvr);
+	printf("optimizeVertexCache(): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n",
+		acmrbefore, acmr, atvrbefore, atvr);
+
+	updateIndexBuffer();
+};
+
+/*
+ * optimizeVertexFetch()
+ *
+ * Renumber the vertices in the order the triangles first use them,
+ * and sort the vertex array to match, so that vertices are fetched
+ * mostly in sequence instead of from scattered memory locations.
+ * Unused vertices are removed. Call this after optimizeVertexCache(),
+ * because that changes the order of first use.
+ */
+void TriangleSoup::optimizeVertexFetch() {
+
+	int oldcount = nverts;
+
+	if(ntris == 0 || !haveArrays("TriangleSoup::optimizeVertexFetch()", true)) return;
+
+	// Include the LOD index lists, they use a subset of the same vertices
+	nverts = MeshOptimizer::optimizeVertexFetch(vertexarray, 8, indexarray, allTris(), nverts);
+	printf("optimizeVertexFetch(): %d vertices in first-use order, %d unused removed\n",
+		nverts, oldcount - nverts);
+
+	updateVertexBuffer();
+	updateIndexBuffer();
+};
+
+/*
+ * optimizeOverdraw(float threshold)
+ *
+ * Reorder the triangles so that outward facing parts of the mesh are
+ * likely to be drawn first, which lets the depth test reject more
+ * fragments of the parts behind them before they are shaded.
+ * Call this after optimizeVertexCache(). The triangle order is only
+ * changed in ways that keep the ACMR within 'threshold' times the
+ * previous value (1.05 means at most 5% more vertex shader runs).
+ * The ACMR before and after is reported.
+ */
+void TriangleSoup::optimizeOverdraw(float threshold) {
+
+	float acmrbefore, acmr;
+	const GLfloat *positions;
+	int stride;
+
+	if(ntris == 0 || !haveArrays("TriangleSoup::optimizeOverdraw()", false)) return;
+
+	positions = positionArray(&stride);
+	acmrbefore = MeshOptimizer::cacheStats(indexarray, ntris, nverts, 16, NULL);
+	clearClusters(); // The clusters refer to the old triangle order
+	MeshOptimizer::optimizeOverdraw(indexarray, ntris, positions, stride, nverts, threshold);
+	acmr = MeshOptimizer::cacheStats(indexarray, ntris, nverts, 16, NULL);
+	printf("optimizeOverdraw(): ACMR %.3f -> %.3f\n", acmrbefore, acmr);
+
+	updateIndexBuffer();
+};
+
+/*
+ * measureOverdraw()
+ *
+ * Rasterize the mesh in software from the six axis directions, with
+ * depth testing and back face culling, and report how many fragments
+ * are shaded per covered pixel in each view. Returns the average.
+ */
+float TriangleSoup::measureOverdraw() {
 
-	return;
+	float ratios[6];
+	float average;
+	const GLfloat *positions;
+	int stride;
+
+	if(ntris == 0 || !haveArrays("TriangleSoup::measureOverdraw()", false)) return 0.0f;
+
+	positions = positionArray(&stride);
+	average = MeshOptimizer::overdrawStats(indexarray, ntris, positions, stride, nverts, ratios);
+	printf("measureOverdraw(): +x %.3f, -x %.3f, +y %.3f, -y %.3f, +z %.3f, -z %.3f, average %.3f\n",
+		ratios[0], ratios[1], ratios[2], ratios[3], ratios[4], ratios[5], average);
+	return average;
+};
+
+/*
+ * buildClusters(int maxverts, int maxtris)
+ *
+ * Split the mesh into clusters of at most 'maxverts' vertices and
+ * 'maxtris' triangles, each with a bounding sphere and a normal cone.
+ * The triangles are reordered so that every cluster is a contiguous
+ * range in the shared index buffer. Call this after the other
+ * optimize*() functions, because those reorder the triangles again
+ * and drop the clusters.
+ */
+void TriangleSoup::buildClusters(int maxverts, int maxtris) {
+
+	std::vector<MeshOptimizer::Cluster> list;
+	const GLfloat *positions;
+	int cullable = 0, stride;
+
+	if(!haveArrays("TriangleSoup::buildClusters()", false)) return;
+	clearClusters();
+	if(ntris == 0) return;
+
+	positions = positionArray(&stride);
+	MeshOptimizer::buildClusters(indexarray, ntris, positions, stride, nverts,
+		maxverts, maxtris, list);
+	nclusters = (int)list.size();
+	clusters = new MeshOptimizer::Cluster[nclusters];
+	for(int i=0; i<nclusters; i++) {
+		clusters[i] = list[i];
+		if(clusters[i].conecutoff < 1.0f) cullable++;
+	}
+	printf("buildClusters(): %d clusters, %.1f triangles each, %d with a normal cone\n",
+		nclusters, (float)ntris / nclusters, cullable);
+
+	updateIndexBuffer();
+};
+
+/*
+ * private
+ * clearClusters() - Forget the clusters, if any.
+ */
+void TriangleSoup::clearClusters() {
+
+	if(clusters) {
+		delete[] clusters;
+		clusters = NULL;
+	}
+	nclusters = 0;
+};
+
+/*
+ * buildLODs(int nlevels, float ratio)
+ *
+ * Build a chain of simplified versions of the mesh, where level i has
+ * about ratio^i of the original triangles (with the defaults 100%, 50%,
+ * 25% and 12.5%). Each level is simplified from the previous one with
+ * MeshOptimizer::simplify(), and sorted for the vertex cache. All levels
+ * use the same vertices, and their index lists are stored after the
+ * original ones in the same index buffer. Level 0 is the original mesh.
+ * The chain stops early if a level can't be simplified any further.
+ */
+void TriangleSoup::buildLODs(int nlevels, float ratio) {
+
+	std::vector<GLuint> all;
+	std::vector<GLuint> level;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// The simplifier keeps UV seams and normal creases, so it needs
+	// the whole vertex array, not just the positions
+	if(ntris == 0 || !haveArrays("TriangleSoup::buildLODs()", true)) return;
+	if(nlevels > MAX_LODS) nlevels = MAX_LODS;
+
+	all.assign(indexarray, indexarray + 3*ntris);
+	level.resize(3*ntris);
+	nlods = 1;
+	lodfirst[0] = 0;
+	lodtris[0] = ntris;
+	loderror[0] = 0.0f;
+
+	for(int i=1; i<nlevels; i++) {
+		int target = (int)(ntris * pow(ratio, i));
+		float error;
+		int count = MeshOptimizer::simplify(&level[0], &all[3*lodfirst[i-1]], lodtris[i-1],
+			vertexarray, 8, nverts, target, &error);
+		if(count == 0 || count >= lodtris[i-1]) break;
+		MeshOptimizer::optimizeVertexCache(&level[0], count, nverts);
+		lodfirst[i] = (int)all.size()/3;
+		lodtris[i] = count;
+		loderror[i] = loderror[i-1] + error; // An upper bound
+		all.insert(all.end(), level.begin(), level.begin() + 3*count);
+		nlods++;
+		printf("buildLODs(): level %d has %d triangles (%.1f%%), error %g\n",
+			i, count, 100.0f*count/ntris, loderror[i]);
+	}
+	printf("buildLODs(): %d levels in %.3f s\n", nlods, std::chrono::duration<double>(
+		std::chrono::steady_clock::now() - start).count());
+
+	if(!inCacheFile(indexarray)) {
+		delete[] indexarray;
+	}
+	indexarray = new GLuint[all.size()];
+	std::copy(all.begin(), all.end(), indexarray);
+
+	updateIndexBuffer();
+};
+
+/* Number of levels of detail, 1 if buildLODs() has not been called */
+int TriangleSoup::lodCount() {
+
+	return (nlods > 0) ? nlods : 1;
+};
+
+/*
+ * private
+ * allTris() - Number of triangles in the index array, for all levels
+ * of detail together.
+ */
+int TriangleSoup::allTris() {
+
+	return (nlods > 1) ? lodfirst[nlods-1] + lodtris[nlods-1] : ntris;
+};
+
+/*
+ * private
+ * inCacheFile() - Check if an array points into the mapped cache file,
+ * in which case it must not be deleted.
+ */
+bool TriangleSoup::inCacheFile(const void *array) {
+
+	const char *p = (const char*)array;
+	return cachefile && cachefile->data
+		&& p >= cachefile->data && p < cachefile->data + cachefile->size;
 };
 
 /* Print data from a TriangleSoup object, for debugging purposes */
 void TriangleSoup::print() {
-     int i;
+     int i, stride;
+     const GLfloat *positions = positionArray(&stride);
 
+     if(!haveArrays("TriangleSoup::print()", false)) return;
      printf("TriangleSoup vertex data:\n\n");
      for(i=0; i<nverts; i++) {
          printf("%d: %8.2f %8.2f %8.2f\n", i,
-         vertexarray[8*i], vertexarray[8*i+1], vertexarray[8*i+2]);
+         positions[stride*i], positions[stride*i+1], positions[stride*i+2]);
      }
      printf("\nTriangleSoup face index data:\n\n");
      for(i=0; i<ntris; i++) {
@@ -639,43 +1370,1721 @@ void TriangleSoup::print() {
 
 /* Print information about a TriangleSoup object (stats and extents) */
 void TriangleSoup::printInfo() {
-     int i;
-     float x, y, z, xmin, xmax, ymin, ymax, zmin, zmax;
-
      printf("TriangleSoup information:\n");
      printf("vertices : %d\n", nverts);
      printf("triangles: %d\n", ntris);
-     xmin = xmax = vertexarray[0];
-     ymin = ymax = vertexarray[1];
-     zmin = zmax = vertexarray[2];
-     for(i=1; i<nverts; i++) {
-         x = vertexarray[8*i];
-         y = vertexarray[8*i+1];
-         z = vertexarray[8*i+2];
-//         printf("x y z : %8.2f %8.2f %8.2f\n", x, y, z);
-         if(x<xmin) xmin = x;
-         if(x>xmax) xmax = x;
-         if(y<ymin) ymin = y;
-         if(y>ymax) ymax = y;
-         if(z<zmin) zmin = z;
-         if(z>zmax) zmax = z;
+     printf("vertex buffer: %d bytes per vertex, %.1f KB\n",
+         vertexBytes(), (double)nverts * vertexBytes() / 1024.0);
+     printf("index buffer : %d bytes per index, %.1f KB\n",
+         indexBytes(), 3.0 * allTris() * indexBytes() / 1024.0);
+     if(dynamicframes > 0) {
+         printf("dynamic: %d vertex buffer copies, waited for the GPU %d times\n",
+             dynamicframes, dynamicstalls);
+     }
+     if(retention != RETAIN_ALL) {
+         printf("retention: %s, %.1f KB kept in RAM\n",
+             (retention == RETAIN_NONE) ? "none" : "positions",
+             ((vertexarray ? 8.0*nverts : 0.0) + (positionarray ? 3.0*nverts : 0.0)
+             + (indexarray ? 3.0*allTris() : 0.0)) * 4 / 1024.0);
+     }
+     if(arena && arenaslot >= 0) {
+         printf("arena: base vertex %d, first index %d\n",
+             arena->baseVertex(arenaslot), (int)(arena->indexOffset(arenaslot) / sizeof(GLuint)));
      }
-     printf("xmin: %8.2f\n", xmin);
-     printf("xmax: %8.2f\n", xmax);
-     printf("ymin: %8.2f\n", ymin);
-     printf("ymax: %8.2f\n", ymax);
-     printf("zmin: %8.2f\n", zmin);
-     printf("zmax: %8.2f\n", zmax);
+     // The bounds are computed when the mesh is created
+     printf("xmin: %8.2f\n", boundsmin[0]);
+     printf("xmax: %8.2f\n", boundsmax[0]);
+     printf("ymin: %8.2f\n", boundsmin[1]);
+     printf("ymax: %8.2f\n", boundsmax[1]);
+     printf("zmin: %8.2f\n", boundsmin[2]);
+     printf("zmax: %8.2f\n", boundsmax[2]);
+     printf("bounding sphere: center (%.2f, %.2f, %.2f), radius %.2f\n",
+         spherecenter[0], spherecenter[1], spherecenter[2], sphereradius);
+};
+
+/* Get the axis aligned bounding box of the vertices */
+void TriangleSoup::bounds(float min[3], float max[3]) {
+
+	for(int k=0; k<3; k++) {
+		min[k] = boundsmin[k];
+		max[k] = boundsmax[k];
+	}
+};
+
+/* Get the bounding sphere of the vertices. Returns the radius. */
+float TriangleSoup::boundingSphere(float center[3]) {
+
+	for(int k=0; k<3; k++) {
+		center[k] = spherecenter[k];
+	}
+	return sphereradius;
+};
+
+/* Read access to the vertex and index arrays, and their sizes */
+const GLfloat *TriangleSoup::vertexArray() {
+	return vertexarray;
+};
+
+const GLuint *TriangleSoup::indexArray() {
+	return indexarray;
+};
+
+int TriangleSoup::vertexCount() {
+	return nverts;
+};
+
+int TriangleSoup::triangleCount() {
+	return ntris;
+};
+
+/* The vertex positions, from the vertex array or from RETAIN_POSITIONS */
+const GLfloat *TriangleSoup::positionArray(int *stride) {
+
+	if(vertexarray) {
+		*stride = 8;
+		return vertexarray;
+	}
+	*stride = 3;
+	return positionarray;
+};
+
+/*
+ * setRetention(int policy)
+ *
+ * Choose what to keep in CPU memory once the mesh is on the GPU, the
+ * way Texture frees its image data after glTexImage2D(). For a mesh
+ * that is already uploaded, the policy takes effect at once. Freed
+ * arrays can't be brought back without creating the mesh again.
+ * A dynamic mesh needs its vertex array, so it must use RETAIN_ALL.
+ */
+void TriangleSoup::setRetention(int policy) {
+
+	if(policy != RETAIN_ALL && policy != RETAIN_NONE && policy != RETAIN_POSITIONS) {
+		printError("TriangleSoup::setRetention()", "Unknown retention policy.");
+		return;
+	}
+	if(dynamicframes > 0 && policy != RETAIN_ALL) {
+		printError("TriangleSoup::setRetention()", "Dynamic mode needs RETAIN_ALL.");
+		return;
+	}
+	retention = policy;
+	applyRetention();
 };
 
 /* Render the geometry in a TriangleSoup object */
 void TriangleSoup::render() {
 
+	commitVertices();
+	setDequantization();
+	drawTriangles(0, ntris);
+
+};
+
+/*
+ * renderLOD(int level)
+ *
+ * Render one level of detail from buildLODs(). Levels beyond the
+ * last one draw the last one, and level 0 is the same as render().
+ */
+void TriangleSoup::renderLOD(int level) {
+
+	if(level <= 0 || nlods <= 1) {
+		render();
+		lodtrisdrawn += ntris;
+		return;
+	}
+	if(level >= nlods) level = nlods - 1;
+	lodtrisdrawn += lodtris[level];
+	lodtrissaved += ntris - lodtris[level];
+
+	commitVertices();
+	setDequantization();
+	drawTriangles(lodfirst[level], lodtris[level]);
+};
+
+/*
+ * renderInstanced(int count, GLuint instancebuffer, int level)
+ *
+ * Draw 'count' instances of the mesh with glDrawElementsInstanced().
+ * 'instancebuffer' is a buffer object with at least 'count' Instance
+ * structs. They are read as instanced attributes (with a divisor of 1)
+ * from INSTANCE_LOCATION on, see vertex_instanced.glsl. The attributes
+ * stay set in the VAO, which does no harm to shaders that don't read
+ * them. Levels of detail are clamped as in renderLOD().
+ */
+void TriangleSoup::renderInstanced(int count, GLuint instancebuffer, int level) {
+
+	int firsttri = 0, tris = ntris;
+
+	if(count <= 0) return;
+	if(level > 0 && nlods > 1) {
+		if(level >= nlods) level = nlods - 1;
+		firsttri = lodfirst[level];
+		tris = lodtris[level];
+	}
+
+	commitVertices();
+	setDequantization();
+	if(arena) {
+		if(arenaslot < 0) return;
+		arena->bind();
+		setInstancePointers(instancebuffer);
+		glDrawElementsInstancedBaseVertex(GL_TRIANGLES, 3 * tris, GL_UNSIGNED_INT,
+			(void*)(arena->indexOffset(arenaslot) + (size_t)3 * firsttri * sizeof(GLuint)),
+			count, arena->baseVertex(arenaslot));
+		clearInstancePointers();
+		return;
+	}
 	glBindVertexArray(vao);
-	glDrawElements(GL_TRIANGLES, 3 * ntris, GL_UNSIGNED_INT, (void*)0);
-	// (mode, vertex count, type, element array buffer offset)
-	glBindVertexArray(0);
+	setInstancePointers(instancebuffer);
+	glDrawElementsInstanced(GL_TRIANGLES, 3 * tris, indextype,
+		(void*)((size_t)3 * firsttri * indexBytes()), count);
+	clearInstancePointers();
+	MeshArena::unbind();
+};
+
+/*
+ * private
+ * setInstancePointers() - Point the instanced attributes of the bound
+ * VAO to an array of Instance structs in 'instancebuffer'. A mat4
+ * attribute takes four locations, one for each column.
+ */
+void TriangleSoup::setInstancePointers(GLuint instancebuffer) {
+
+	glBindBuffer(GL_ARRAY_BUFFER, instancebuffer);
+	for(int i=0; i<4; i++) {
+		glEnableVertexAttribArray(INSTANCE_LOCATION + i);
+		glVertexAttribPointer(INSTANCE_LOCATION + i, 4, GL_FLOAT, GL_FALSE,
+			sizeof(Instance), (void*)(4 * i * sizeof(GLfloat))); // Column i of M
+		glVertexAttribDivisor(INSTANCE_LOCATION + i, 1);
+	}
+	glEnableVertexAttribArray(INSTANCE_LOCATION + 4);
+	glVertexAttribPointer(INSTANCE_LOCATION + 4, 1, GL_FLOAT, GL_FALSE,
+		sizeof(Instance), (void*)(16 * sizeof(GLfloat))); // Texture layer
+	glVertexAttribDivisor(INSTANCE_LOCATION + 4, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+};
+
+/*
+ * private
+ * clearInstancePointers() - Turn the instanced attributes of the bound
+ * VAO off again after the draw. The VAO may be the shared one of an
+ * arena, and other draws from it (such as the indirect draws of a
+ * BatchRenderer, with base instances up to their number of commands)
+ * must not fetch from an instance buffer that may be gone by then.
+ */
+void TriangleSoup::clearInstancePointers() {
+
+	for(int i=0; i<5; i++) {
+		glDisableVertexAttribArray(INSTANCE_LOCATION + i);
+		glVertexAttribDivisor(INSTANCE_LOCATION + i, 0);
+	}
+};
+
+/*
+ * selectLOD(float MV[], float P[], int viewportheight, float pixelerror,
+ *           int previous, float hysteresis)
+ *
+ * Pick the coarsest level of detail whose geometric error, projected
+ * to the screen at the nearest point of the bounding sphere, is at most
+ * 'pixelerror' pixels. 'viewportheight' is in pixels. To avoid flicker
+ * when an object hovers at a switching distance, a level coarser than
+ * 'previous' is only picked if its error is also below
+ * (1 - hysteresis) * pixelerror. Finer levels are picked right away.
+ * Pass previous = -1 to disable the hysteresis.
+ */
+int TriangleSoup::selectLOD(float MV[], float P[], int viewportheight, float pixelerror,
+    int previous, float hysteresis) {
+
+	float center[3], radius, scale = 0.0f, dist, pixelsperunit;
+	int level, relaxed;
+
+	if(nlods <= 1) return 0;
+
+	// Bounding sphere in view coordinates. The radius is scaled by the
+	// largest scaling in MV, so the test stays conservative.
+	for(int k=0; k<3; k++) {
+		center[k] = MV[12+k];
+		for(int j=0; j<3; j++) {
+			center[k] += MV[4*j+k]*spherecenter[j];
+		}
+		scale = std::max(scale, MV[4*k]*MV[4*k] + MV[4*k+1]*MV[4*k+1] + MV[4*k+2]*MV[4*k+2]);
+	}
+	scale = sqrtf(scale);
+	radius = sphereradius*scale;
+
+	// P[5] is cot(vfov/2) for mat4perspective(), and 1/top for an
+	// orthographic projection (P[15] = 1), which has no perspective divide
+	pixelsperunit = 0.5f*P[5]*viewportheight;
+	if(P[15] == 0.0f) {
+		dist = sqrtf(center[0]*center[0] + center[1]*center[1] + center[2]*center[2]) - radius;
+		if(dist <= 0.0f) return 0; // The camera is inside the bounding sphere
+		pixelsperunit /= dist;
+	}
+
+	level = 0;
+	relaxed = 0;
+	for(int l=1; l<nlods; l++) {
+		float pixels = loderror[l]*scale*pixelsperunit;
+		if(pixels <= pixelerror) level = l;
+		if(pixels <= (1.0f - hysteresis)*pixelerror) relaxed = l;
+	}
+	if(previous >= 0 && level > previous) {
+		level = std::max(previous, relaxed); // Coarser only with a margin
+	}
+	return level;
+};
+
+/*
+ * renderLOD(float MV[], float P[], int viewportheight, float pixelerror)
+ *
+ * Select a level of detail with selectLOD(), with hysteresis against
+ * the level this object drew last time, and render it. Returns the
+ * level. For several copies of one mesh, call selectLOD() with the
+ * previous level of each copy and renderLOD(level) instead.
+ */
+int TriangleSoup::renderLOD(float MV[], float P[], int viewportheight, float pixelerror) {
+
+	lastlod = selectLOD(MV, P, viewportheight, pixelerror, lastlod);
+	renderLOD(lastlod);
+	return lastlod;
+};
+
+/*
+ * lodStats(long long *drawn, long long *saved)
+ *
+ * Get the number of triangles drawn by renderLOD() since the last call,
+ * and the number of triangles saved by drawing coarser levels instead
+ * of the full meshes, for all TriangleSoup objects together. The counts
+ * start over from zero, so calling this once per frame gives per frame
+ * numbers.
+ */
+void TriangleSoup::lodStats(long long *drawn, long long *saved) {
+
+	if(drawn) *drawn = lodtrisdrawn;
+	if(saved) *saved = lodtrissaved;
+	lodtrisdrawn = 0;
+	lodtrissaved = 0;
+};
+
+/*
+ * useProgram(GLuint program)
+ *
+ * Make a shader program current, and remember which one it is, so that
+ * setDequantization() does not have to ask OpenGL for every draw. That
+ * query can stall a driver that runs on a thread of its own. 0 turns
+ * the program off, and also makes the render functions ask again.
+ */
+void TriangleSoup::useProgram(GLuint program) {
+
+	glUseProgram(program);
+	currentprogram = program;
+};
+
+/*
+ * forgetProgram(GLuint program)
+ *
+ * Drop the cached uniform locations and values of a program that is
+ * deleted or linked again. If it was the program set by useProgram(),
+ * the render functions go back to asking OpenGL for the current one.
+ */
+void TriangleSoup::forgetProgram(GLuint program) {
+
+	for(size_t i=0; i<dequantstates.size(); ) {
+		if(dequantstates[i].program == program) {
+			dequantstates.erase(dequantstates.begin() + i);
+		}
+		else {
+			i++;
+		}
+	}
+	if(currentprogram == program) currentprogram = 0;
+};
+
+/*
+ * Find the camera position in object coordinates, which is where MV
+ * maps to the origin. MV is assumed to be affine (no projection).
+ */
+static bool eyePosition(const float MV[], float eye[]) {
+
+	// Solve A*eye = -t, with A the upper 3x3 part of MV and t the
+	// translation, by Cramer's rule. MV is stored by columns.
+	const float *a = &MV[0], *b = &MV[4], *c = &MV[8];
+	float t[3] = {-MV[12], -MV[13], -MV[14]};
+	float det = a[0]*(b[1]*c[2] - b[2]*c[1]) - b[0]*(a[1]*c[2] - a[2]*c[1])
+		+ c[0]*(a[1]*b[2] - a[2]*b[1]);
+
+	if(det == 0.0f) return false;
+	eye[0] = (t[0]*(b[1]*c[2] - b[2]*c[1]) - b[0]*(t[1]*c[2] - t[2]*c[1])
+		+ c[0]*(t[1]*b[2] - t[2]*b[1])) / det;
+	eye[1] = (a[0]*(t[1]*c[2] - t[2]*c[1]) - t[0]*(a[1]*c[2] - a[2]*c[1])
+		+ c[0]*(a[1]*t[2] - a[2]*t[1])) / det;
+	eye[2] = (a[0]*(b[1]*t[2] - b[2]*t[1]) - b[0]*(a[1]*t[2] - a[2]*t[1])
+		+ t[0]*(a[1]*b[2] - a[2]*b[1])) / det;
+	return true;
+}
+
+/*
+ * renderClusters(float MV[], float P[])
+ *
+ * Cull the clusters against the view frustum and by their normal
+ * cones, on the CPU and in object coordinates, then draw the
+ * remaining ones. Neighbouring visible clusters are merged into one
+ * range, and all ranges are drawn with a single glMultiDrawElements().
+ * Without clusters, this is the same as render().
+ */
+int TriangleSoup::renderClusters(float MV[], float P[]) {
+
+	float PMV[16], planes[24], eye[3] = {0.0f, 0.0f, 0.0f};
+	bool coneculling;
+	std::vector<GLsizei> counts;
+	std::vector<const GLvoid*> offsets;
+	int drawn = 0;
+	int rangestart = -1, rangeend = -1; // Triangles in the current range
+
+	if(nclusters == 0) {
+		render();
+		return ntris;
+	}
+
+	Utilities::mat4mult(P, MV, PMV);
+	Utilities::mat4frustumPlanes(PMV, planes);
+	coneculling = eyePosition(MV, eye);
+
+	for(int i=0; i<nclusters; i++) {
+		const MeshOptimizer::Cluster &cluster = clusters[i];
+		bool visible = true;
+
+		for(int k=0; k<6 && visible; k++) {
+			const float *plane = &planes[4*k];
+			if(plane[0]*cluster.center[0] + plane[1]*cluster.center[1]
+			   + plane[2]*cluster.center[2] + plane[3] < -cluster.radius) {
+				visible = false;
+			}
+		}
+		if(visible && coneculling && cluster.conecutoff < 1.0f) {
+			float d[3] = {cluster.center[0] - eye[0], cluster.center[1] - eye[1],
+				cluster.center[2] - eye[2]};
+			float dist = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+			if(d[0]*cluster.coneaxis[0] + d[1]*cluster.coneaxis[1] + d[2]*cluster.coneaxis[2]
+			   >= cluster.conecutoff*dist + cluster.radius) {
+				visible = false; // Every triangle faces away from the camera
+			}
+		}
+		if(!visible) continue;
+
+		if(cluster.firsttri != rangeend) { // Start a new range
+			if(rangestart >= 0) {
+				counts.push_back(3*(rangeend - rangestart));
+				offsets.push_back((const GLvoid*)((size_t)3*rangestart*indexBytes()));
+			}
+			rangestart = cluster.firsttri;
+		}
+		rangeend = cluster.firsttri + cluster.ntris;
+		drawn += cluster.ntris;
+	}
+	if(rangestart >= 0) {
+		counts.push_back(3*(rangeend - rangestart));
+		offsets.push_back((const GLvoid*)((size_t)3*rangestart*indexBytes()));
+	}
+	if(counts.empty()) return 0;
+
+	commitVertices();
+	setDequantization();
+	if(arena) { // Move the ranges to where the mesh is in the arena
+		if(arenaslot < 0) return 0;
+		std::vector<GLint> basevertices(counts.size(), arena->baseVertex(arenaslot));
+		for(size_t i=0; i<offsets.size(); i++) {
+			offsets[i] = (const GLvoid*)((size_t)offsets[i] + arena->indexOffset(arenaslot));
+		}
+		arena->bind();
+		glMultiDrawElementsBaseVertex(GL_TRIANGLES, &counts[0], GL_UNSIGNED_INT,
+			&offsets[0], (GLsizei)counts.size(), &basevertices[0]);
+		return drawn;
+	}
+	glBindVertexArray(vao);
+	glMultiDrawElements(GL_TRIANGLES, &counts[0], indextype, &offsets[0], (GLsizei)counts.size());
+	MeshArena::unbind();
+	return drawn;
+};
+
+/* Quantize v in [vmin, vmax] to a 16-bit unsigned normalized integer */
+static unsigned short quantizeUnorm16(float v, float vmin, float vmax) {
+	float t;
+
+	if(vmax <= vmin) return 0;
+	t = (v - vmin) / (vmax - vmin);
+	if(t < 0.0f) t = 0.0f;
+	if(t > 1.0f) t = 1.0f;
+	return (unsigned short)(t * 65535.0f + 0.5f);
+}
+
+/* Quantize v in [-1, 1] to a signed normalized integer with 'bits' bits */
+static int quantizeSnorm(float v, int bits) {
+	float scale = (float)((1 << (bits-1)) - 1);
+
+	if(v < -1.0f) v = -1.0f;
+	if(v > 1.0f) v = 1.0f;
+	return (int)floorf(v * scale + 0.5f); // Round to nearest, also below zero
+}
+
+/* Pack a normal as GL_INT_2_10_10_10_REV: x in the low bits, w = 0 */
+static unsigned int packNormal1010102(const float *n) {
+	return ((unsigned int)quantizeSnorm(n[0], 10) & 1023u)
+		| (((unsigned int)quantizeSnorm(n[1], 10) & 1023u) << 10)
+		| (((unsigned int)quantizeSnorm(n[2], 10) & 1023u) << 20);
+}
+
+/*
+ * The reverse of MeshCodec::octEncode(): unfold a point of the octahedral
+ * map back to a normal, not normalized. The function with the same name
+ * in vertex.glsl does the same.
+ */
+static void octDecode(const float *uv, float *n) {
+	n[0] = uv[0];
+	n[1] = uv[1];
+	n[2] = 1.0f - fabsf(uv[0]) - fabsf(uv[1]);
+	if(n[2] < 0.0f) {
+		n[0] = (1.0f - fabsf(uv[1])) * (uv[0] >= 0.0f ? 1.0f : -1.0f);
+		n[1] = (1.0f - fabsf(uv[0])) * (uv[1] >= 0.0f ? 1.0f : -1.0f);
+	}
+}
+
+/*
+ * Encode a normal as two 8-bit octahedral values. Plain rounding can be
+ * off by almost 3 degrees, so try both neighbours of each coordinate
+ * and keep the combination that decodes closest to the original.
+ */
+static void octEncodeSnorm8(const float *n, signed char *oct) {
+	float uv[2], q[2], best = -2.0f;
+	int i, j;
+
+	MeshCodec::octEncode(n, uv);
+	for(i=0; i<4; i++) {
+		float c[2], d[3], dot, len;
+		for(j=0; j<2; j++) {
+			float f = floorf(uv[j] * 127.0f) + (float)((i >> j) & 1);
+			if(f < -127.0f) f = -127.0f;
+			if(f > 127.0f) f = 127.0f;
+			c[j] = f;
+			q[j] = f / 127.0f;
+		}
+		octDecode(q, d);
+		len = sqrtf(d[0]*d[0] + d[1]*d[1] + d[2]*d[2]);
+		dot = (d[0]*n[0] + d[1]*n[1] + d[2]*n[2]) / len;
+		if(dot > best) {
+			best = dot;
+			oct[0] = (signed char)c[0];
+			oct[1] = (signed char)c[1];
+		}
+	}
+}
+
+/*
+ * setVertexFormat(int format)
+ *
+ * Choose the layout of the vertex buffer on the GPU. The vertex array
+ * in CPU memory stays in floats, so this can be changed at any time.
+ * If there is already a vertex buffer, it is converted and sent again.
+ */
+void TriangleSoup::setVertexFormat(int format) {
+
+	if(format != VERTEX_FLOAT && format != VERTEX_PACKED16
+	   && format != VERTEX_PACKED12) {
+		printError("TriangleSoup::setVertexFormat()", "Unknown vertex format.");
+		return;
+	}
+	if(dynamicframes > 0 && format != VERTEX_FLOAT) {
+		printError("TriangleSoup::setVertexFormat()", "Dynamic mode needs VERTEX_FLOAT.");
+		return;
+	}
+	if(arena && format != VERTEX_FLOAT) {
+		printError("TriangleSoup::setVertexFormat()", "A mesh in an arena needs VERTEX_FLOAT.");
+		return;
+	}
+	if((vao || arenaslot >= 0) && !haveArrays("TriangleSoup::setVertexFormat()", true)) {
+		return;
+	}
+	vertexformat = format;
+	if(vao || arenaslot >= 0) {
+		updateVertexBuffer();
+	}
+};
+
+/* Size of one vertex in the vertex buffer, in bytes */
+int TriangleSoup::vertexBytes() {
+
+	switch(vertexformat) {
+	case VERTEX_PACKED16: return 16;
+	case VERTEX_PACKED12: return 12;
+	default: return 8*sizeof(GLfloat);
+	}
+};
+
+/*
+ * private
+ * packVertices() - Convert the float vertex array to a packed format.
+ * Positions are quantized relative to the bounding box and texture
+ * coordinates relative to their own range, which is stored in
+ * texmin and texmax for the shader uniforms.
+ */
+void TriangleSoup::packVertices(unsigned char *packed) {
+
+	int i;
+	int stride = vertexBytes();
+
+	if(nverts > 0) {
+		texmin[0] = texmax[0] = vertexarray[6];
+		texmin[1] = texmax[1] = vertexarray[7];
+	}
+	for(i=1; i<nverts; i++) {
+		const float *st = &vertexarray[8*i+6];
+		if(st[0] < texmin[0]) texmin[0] = st[0];
+		if(st[0] > texmax[0]) texmax[0] = st[0];
+		if(st[1] < texmin[1]) texmin[1] = st[1];
+		if(st[1] > texmax[1]) texmax[1] = st[1];
+	}
+
+	for(i=0; i<nverts; i++) {
+		const float *v = &vertexarray[8*i];
+		unsigned char *out = packed + (size_t)i*stride;
+		unsigned short xyzw[4], st[2];
+		int k;
+
+		for(k=0; k<3; k++) {
+			xyzw[k] = quantizeUnorm16(v[k], boundsmin[k], boundsmax[k]);
+		}
+		xyzw[3] = 0;
+		for(k=0; k<2; k++) {
+			st[k] = quantizeUnorm16(v[6+k], texmin[k], texmax[k]);
+		}
+
+		if(vertexformat == VERTEX_PACKED16) {
+			unsigned int normal = packNormal1010102(&v[3]);
+			memcpy(out, xyzw, 8);
+			memcpy(out+8, &normal, 4);
+			memcpy(out+12, st, 4);
+		}
+		else {
+			signed char oct[2];
+			octEncodeSnorm8(&v[3], oct);
+			memcpy(out, xyzw, 6);
+			memcpy(out+6, oct, 2);
+			memcpy(out+8, st, 4);
+		}
+	}
+};
+
+/*
+ * private
+ * setDequantization() - Tell the current shader program how to map
+ * the packed vertex attributes back to their original range. The
+ * uniform locations and the values last set are kept per program, so
+ * the uniforms are only set when the program or the values change,
+ * not for every draw of a mesh with the same format and bounds. Meshes
+ * with float vertices use the identity mapping, which is then set once
+ * per program. The current program comes from useProgram() if it has
+ * been called. Programs without these uniforms are not affected.
+ * A program that is deleted or linked again must be passed to
+ * forgetProgram(), or its cached values would be taken for those of
+ * the new program.
+ */
+void TriangleSoup::setDequantization() {
+
+	GLint program = (GLint)currentprogram;
+	bool packed = (vertexformat != VERTEX_FLOAT);
+	GLfloat values[11];
+	DequantState *state = NULL;
+	int k;
+
+	if(program == 0) glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+	if(program == 0) return;
+	for(size_t i=0; i<dequantstates.size(); i++) {
+		if(dequantstates[i].program == (GLuint)program) state = &dequantstates[i];
+	}
+	if(!state && currentprogram != 0) {
+		// A program we have not seen: make sure that it is really the
+		// current one, in case glUseProgram() was called directly
+		glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+		currentprogram = (GLuint)program;
+		if(program == 0) return;
+		for(size_t i=0; i<dequantstates.size(); i++) {
+			if(dequantstates[i].program == (GLuint)program) state = &dequantstates[i];
+		}
+	}
+	if(!state) {
+		DequantState newstate;
+		newstate.program = (GLuint)program;
+		newstate.locations[0] = glGetUniformLocation(program, "posScale");
+		newstate.locations[1] = glGetUniformLocation(program, "posOffset");
+		newstate.locations[2] = glGetUniformLocation(program, "texScale");
+		newstate.locations[3] = glGetUniformLocation(program, "texOffset");
+		newstate.locations[4] = glGetUniformLocation(program, "octNormals");
+		newstate.values[0] = -1.0f; // Not a value we set, so the first call sets all
+		dequantstates.push_back(newstate);
+		state = &dequantstates.back();
+	}
+
+	for(k=0; k<3; k++) {
+		values[k] = packed ? boundsmax[k] - boundsmin[k] : 1.0f;
+		values[3+k] = packed ? boundsmin[k] : 0.0f;
+	}
+	for(k=0; k<2; k++) {
+		values[6+k] = packed ? texmax[k] - texmin[k] : 1.0f;
+		values[8+k] = packed ? texmin[k] : 0.0f;
+	}
+	values[10] = (vertexformat == VERTEX_PACKED12) ? 1.0f : 0.0f;
+	if(memcmp(values, state->values, sizeof(values)) == 0) return;
+
+	memcpy(state->values, values, sizeof(values));
+	glUniform3fv(state->locations[0], 1, &values[0]);
+	glUniform3fv(state->locations[1], 1, &values[3]);
+	glUniform2fv(state->locations[2], 1, &values[6]);
+	glUniform2fv(state->locations[3], 1, &values[8]);
+	glUniform1i(state->locations[4], vertexformat == VERTEX_PACKED12);
+};
+
+/*
+ * private
+ * upload() - Create the VAO and the buffers, and send the
+ * vertex array and the index array to OpenGL.
+ */
+void TriangleSoup::upload() {
+
+	if(arena) {
+		uploadToArena();
+		applyRetention();
+		keepScratchArrays();
+		return;
+	}
+
+	// Generate one vertex array object (VAO) and bind it
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	// Generate two buffer IDs
+	glGenBuffers(1, &vertexbuffer);
+	glGenBuffers(1, &indexbuffer);
+
+	// Present our vertex data to OpenGL, in the chosen layout
+	sendVertices();
+
+ 	// Present our vertex indices to OpenGL, 16 or 32 bits wide
+	sendIndices();
+
+	// Deactivate (unbind) the VAO and the buffers again.
+	// Do NOT unbind the buffers while the VAO is still bound.
+	// The index buffer is an essential part of the VAO state.
+	MeshArena::unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+ 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	// Free what we don't need to keep in CPU memory
+	applyRetention();
+	keepScratchArrays();
+};
+
+/*
+ * private
+ * uploadToArena() - Put the vertex array and the index array into
+ * the arena, in a new slot of the right size. The indices stay
+ * relative to the first vertex of the mesh, so they are sent as they
+ * are, in 32 bits.
+ */
+void TriangleSoup::uploadToArena() {
+
+	int nindices = 3*allTris();
+
+	if(arenaslot >= 0) {
+		arena->release(arenaslot);
+	}
+	arenaslot = arena->allocate(nverts, nindices);
+	if(arenaslot < 0) {
+		return;
+	}
+	arena->sendVertices(arenaslot, 0, nverts, vertexarray);
+	arena->sendIndices(arenaslot, 0, nindices, indexarray);
+	indextype = GL_UNSIGNED_INT;
+};
+
+/*
+ * private
+ * applyRetention() - Once the mesh is on the GPU, free the arrays that
+ * the retention policy doesn't keep. Arrays in a mapped cache file or
+ * in a scratch arena are not freed, but the file is unmapped when
+ * nothing points into it any more, so kept indices are copied out of
+ * it first. Kept arrays in a scratch arena are copied by
+ * keepScratchArrays().
+ */
+void TriangleSoup::applyRetention() {
+
+	if(retention == RETAIN_ALL || (!vao && arenaslot < 0)) return;
+
+	if(vertexarray) {
+		if(retention == RETAIN_POSITIONS) {
+			if(positionarray) delete[] positionarray;
+			positionarray = new GLfloat[3*(size_t)nverts];
+			for(size_t i=0; i<(size_t)nverts; i++) {
+				positionarray[3*i] = vertexarray[8*i];
+				positionarray[3*i+1] = vertexarray[8*i+1];
+				positionarray[3*i+2] = vertexarray[8*i+2];
+			}
+		}
+		if(!inCacheFile(vertexarray) && !inScratch(vertexarray)) delete[] vertexarray;
+		vertexarray = NULL;
+	}
+	if(retention == RETAIN_NONE) {
+		if(indexarray && !inCacheFile(indexarray) && !inScratch(indexarray)) delete[] indexarray;
+		indexarray = NULL;
+		if(positionarray) delete[] positionarray;
+		positionarray = NULL;
+	}
+	else if(inCacheFile(indexarray)) {
+		GLuint *copy = new GLuint[3*(size_t)allTris()];
+		std::copy(indexarray, indexarray + 3*(size_t)allTris(), copy);
+		indexarray = copy;
+	}
+	if(cachefile) {
+		delete cachefile;
+		cachefile = NULL;
+	}
+};
+
+/*
+ * private
+ * allocateArrays() - Allocate the vertex array and the index array for
+ * nverts and ntris. If the retention policy frees them after upload,
+ * they are borrowed from 'scratch' instead of the heap, if it is given.
+ */
+void TriangleSoup::allocateArrays(ScratchArena *scratch) {
+
+	if(scratch && retention != RETAIN_ALL) {
+		vertexarray = scratch->allocate<GLfloat>(8*(size_t)nverts);
+		indexarray = scratch->allocate<GLuint>(3*(size_t)ntris);
+		scratcharena = scratch;
+	}
+	else {
+		vertexarray = new GLfloat[8*(size_t)nverts];
+		indexarray = new GLuint[3*(size_t)ntris];
+	}
+};
+
+/*
+ * private
+ * keepScratchArrays() - Copy the arrays that are still borrowed from a
+ * scratch arena after upload to the heap, because the arena is rewound
+ * when the load is done. That is the index array for RETAIN_POSITIONS,
+ * or both arrays if nothing could be sent to OpenGL.
+ */
+void TriangleSoup::keepScratchArrays() {
+
+	if(!scratcharena) return;
+
+	if(inScratch(vertexarray)) {
+		GLfloat *copy = new GLfloat[8*(size_t)nverts];
+		std::copy(vertexarray, vertexarray + 8*(size_t)nverts, copy);
+		vertexarray = copy;
+	}
+	if(inScratch(indexarray)) {
+		GLuint *copy = new GLuint[3*(size_t)allTris()];
+		std::copy(indexarray, indexarray + 3*(size_t)allTris(), copy);
+		indexarray = copy;
+	}
+	scratcharena = NULL;
+};
+
+/*
+ * private
+ * inScratch() - Check if an array is borrowed from a scratch arena,
+ * in which case it must not be deleted.
+ */
+bool TriangleSoup::inScratch(const void *array) {
+	return array && scratcharena && scratcharena->contains(array);
+};
+
+/*
+ * private
+ * haveArrays() - Check that the arrays that 'caller' needs are still in
+ * CPU memory: the index array, and the whole vertex array if
+ * 'allvertices' is true, or else at least the positions.
+ */
+bool TriangleSoup::haveArrays(const char *caller, bool allvertices) {
+
+	int stride;
+
+	if((ntris > 0 && !indexarray)
+	   || (nverts > 0 && !(allvertices ? vertexarray : positionArray(&stride)))) {
+		printError(caller, "The arrays were freed after upload (see setRetention()).");
+		return false;
+	}
+	return true;
+};
+
+/*
+ * private
+ * releaseBuffers() - Delete the VAO and the buffers, or give
+ * back the room in the arena.
+ */
+void TriangleSoup::releaseBuffers() {
+
+	if(glIsVertexArray(vao)) {
+		glDeleteVertexArrays(1, &vao);
+	}
+	vao = 0;
+
+	if(glIsBuffer(vertexbuffer)) {
+		glDeleteBuffers(1, &vertexbuffer);
+	}
+	vertexbuffer = 0;
+
+	if(glIsBuffer(indexbuffer)) {
+		glDeleteBuffers(1, &indexbuffer);
+	}
+	indexbuffer = 0;
+
+	if(arenaslot >= 0) {
+		arena->release(arenaslot);
+		arenaslot = -1;
+	}
+};
+
+/*
+ * private
+ * drawTriangles() - Draw 'count' triangles from 'firsttri' in the
+ * index array, from the VAO of this mesh or from the arena.
+ */
+void TriangleSoup::drawTriangles(int firsttri, int count) {
+
+	if(arena) {
+		// The arena VAO stays bound, so a run of meshes
+		// in the same arena binds it only once
+		if(arenaslot < 0) return;
+		arena->bind();
+		glDrawElementsBaseVertex(GL_TRIANGLES, 3 * count, GL_UNSIGNED_INT,
+			(void*)(arena->indexOffset(arenaslot) + (size_t)3 * firsttri * sizeof(GLuint)),
+			arena->baseVertex(arenaslot));
+		return;
+	}
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, 3 * count, indextype,
+		(void*)((size_t)3 * firsttri * indexBytes()));
+	// (mode, vertex count, type, element array buffer offset)
+	MeshArena::unbind();
+};
+
+/*
+ * private
+ * updateVertexBuffer() - Send a modified vertex array to OpenGL.
+ * The attribute pointers are set again as well, in case the
+ * vertex format has changed.
+ */
+void TriangleSoup::updateVertexBuffer() {
+
+	if(arena) {
+		if(arena->vertexCount(arenaslot) != nverts) uploadToArena();
+		else arena->sendVertices(arenaslot, 0, nverts, vertexarray);
+		return;
+	}
+	glBindVertexArray(vao);
+	sendVertices();
+	MeshArena::unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+};
+
+/*
+ * private
+ * sendVertices() - Convert the vertex array to the current vertex
+ * format, present it to OpenGL and set up the attribute pointers.
+ * The VAO must be bound. The float array itself is never changed.
+ */
+void TriangleSoup::sendVertices() {
+
+	int stride;
+	unsigned char *packed;
+
+ 	// Activate the vertex buffer
+	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+
+	// Specify how many attribute arrays we have in our VAO
+	glEnableVertexAttribArray(0); // Vertex coordinates
+	glEnableVertexAttribArray(1); // Normals
+	glEnableVertexAttribArray(2); // Texture coordinates
+
+	if(dynamicframes > 0) {
+		// Dynamic mode: one copy of the float vertex array per frame in
+		// flight, all in the same buffer. The VAO reads from copy 0.
+		size_t bytes = (size_t)nverts*8*sizeof(GLfloat);
+		glBufferData(GL_ARRAY_BUFFER, dynamicframes*bytes, NULL, GL_DYNAMIC_DRAW);
+		for(int f=0; f<dynamicframes; f++) {
+			glBufferSubData(GL_ARRAY_BUFFER, f*bytes, bytes, vertexarray);
+			if(dynamicfences[f]) {
+				glDeleteSync(dynamicfences[f]); // The old buffer is gone
+				dynamicfences[f] = 0;
+			}
+			dirtyfirst[f] = nverts;
+			dirtyend[f] = 0;
+		}
+		dynamicslot = 0;
+		dynamicpending = false;
+		setFloatPointers(0);
+		return;
+	}
+
+	if(vertexformat == VERTEX_FLOAT) {
+	 	// Present our vertex coordinates to OpenGL
+		glBufferData(GL_ARRAY_BUFFER,
+			(size_t)nverts*8*sizeof(GLfloat), vertexarray, GL_STATIC_DRAW);
+		setFloatPointers(0);
+		return;
+	}
+
+	// Packed formats store integers that OpenGL normalizes to [0,1]
+	// or [-1,1] (GL_TRUE below). The vertex shader maps them back to
+	// the original range with the uniforms that render() sets.
+	stride = vertexBytes();
+	packed = new unsigned char[(size_t)nverts*stride];
+	packVertices(packed);
+	glBufferData(GL_ARRAY_BUFFER, (size_t)nverts*stride, packed, GL_STATIC_DRAW);
+	delete[] packed;
+
+	if(vertexformat == VERTEX_PACKED16) {
+		// 8 bytes xyz (w unused), 4 bytes normal, 4 bytes st
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+			stride, (void*)0); // xyz coordinates
+		glVertexAttribPointer(1, 4, GL_INT_2_10_10_10_REV, GL_TRUE,
+			stride, (void*)8); // normals (w unused)
+		glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+			stride, (void*)12); // texcoords
+	}
+	else {
+		// 6 bytes xyz, 2 bytes octahedral normal, 4 bytes st
+		glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+			stride, (void*)0); // xyz coordinates
+		glVertexAttribPointer(1, 2, GL_BYTE, GL_TRUE,
+			stride, (void*)6); // normals, decoded in the shader
+		glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE,
+			stride, (void*)8); // texcoords
+	}
+};
+
+/*
+ * private
+ * setFloatPointers() - Point the attributes of the bound VAO to float
+ * vertices in the bound GL_ARRAY_BUFFER, starting 'offset' bytes in.
+ */
+void TriangleSoup::setFloatPointers(size_t offset) {
+
+	// Specify how OpenGL should interpret the vertex buffer data:
+	// Attributes 0, 1, 2 (must match the lines above and the layout in the shader)
+	// Number of dimensions (3 means vec3 in the shader, 2 means vec2)
+	// Type GL_FLOAT
+	// Not normalized (GL_FALSE)
+	// Stride 8 (interleaved array with 8 floats per vertex)
+	// Array buffer offset 0, 3, 6 (offset into first vertex)
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE,
+		8*sizeof(GLfloat), (void*)offset); // xyz coordinates
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE,
+		8*sizeof(GLfloat), (void*)(offset + 3*sizeof(GLfloat))); // normals
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE,
+		8*sizeof(GLfloat), (void*)(offset + 6*sizeof(GLfloat))); // texcoords
+};
+
+/*
+ * setArena(MeshArena *newarena)
+ *
+ * Keep the vertices and indices in a shared MeshArena instead of in
+ * buffers of our own, or go back to our own buffers with NULL. A mesh
+ * in an arena uses the VERTEX_FLOAT format and can't be dynamic. If the
+ * mesh is already on the GPU, it is moved. The arena must outlive the
+ * mesh, or the mesh must be cleaned or moved out of it first.
+ */
+void TriangleSoup::setArena(MeshArena *newarena) {
+
+	bool uploaded = vao || arenaslot >= 0;
+
+	if(newarena == arena) return;
+	if(newarena && dynamicframes > 0) {
+		printError("TriangleSoup::setArena()", "A dynamic mesh can't be in an arena.");
+		return;
+	}
+	if(uploaded && !haveArrays("TriangleSoup::setArena()", true)) {
+		return;
+	}
+	releaseBuffers();
+	arena = newarena;
+	if(arena) {
+		vertexformat = VERTEX_FLOAT;
+	}
+	if(uploaded) {
+		upload();
+	}
+};
+
+/*
+ * arenaDraw(int level, GLsizei *count, GLuint *firstindex, GLint *basevertex)
+ *
+ * Get what glDrawElementsBaseVertex() or an indirect draw command
+ * needs to draw one level of detail from the arena: the number of
+ * indices, the first index in the arena and the base vertex. Levels
+ * are clamped as in renderLOD(). Pending vertex changes are sent first.
+ */
+MeshArena *TriangleSoup::arenaDraw(int level, GLsizei *count, GLuint *firstindex,
+	GLint *basevertex) {
+
+	int firsttri = 0, tris = ntris;
+
+	if(!arena || arenaslot < 0) {
+		return NULL;
+	}
+	if(level > 0 && nlods > 1) {
+		if(level >= nlods) level = nlods - 1;
+		firsttri = lodfirst[level];
+		tris = lodtris[level];
+	}
+	commitVertices();
+	*count = 3 * tris;
+	*firstindex = (GLuint)(arena->indexOffset(arenaslot) / sizeof(GLuint)) + 3 * firsttri;
+	*basevertex = arena->baseVertex(arenaslot);
+	return arena;
+};
+
+/*
+ * setDynamic(int frames)
+ *
+ * Switch to dynamic mode, for meshes that change every frame. The
+ * vertex buffer then holds 'frames' copies of the vertices (2 to
+ * MAX_DYNAMIC_FRAMES), used in turn like a ring. Changes from
+ * mapVertices() or updateVertices() go into the next copy, which the
+ * GPU has most likely finished with, so it is mapped without waiting
+ * for the GPU. A fence per copy makes sure of it. Only the vertices
+ * that changed since a copy was last written are sent. Dynamic mode
+ * uses the VERTEX_FLOAT format. setDynamic(0) goes back to a static
+ * buffer. The index array can't be changed in dynamic mode.
+ */
+void TriangleSoup::setDynamic(int frames) {
+
+	if(arena && frames != 0) {
+		printError("TriangleSoup::setDynamic()", "A mesh in an arena can't be dynamic.");
+		return;
+	}
+	if(retention != RETAIN_ALL && frames != 0) {
+		printError("TriangleSoup::setDynamic()", "Dynamic mode needs RETAIN_ALL.");
+		return;
+	}
+	if(frames != 0) {
+		if(frames < 2) frames = 2;
+		if(frames > MAX_DYNAMIC_FRAMES) frames = MAX_DYNAMIC_FRAMES;
+		vertexformat = VERTEX_FLOAT; // Quantized positions would go out of bounds
+	}
+	if(frames == dynamicframes) return;
+	clearFences();
+	dynamicframes = frames;
+	if(vao) {
+		updateVertexBuffer();
+	}
+};
+
+/*
+ * mapVertices(int first, int count)
+ *
+ * Get write access to 'count' vertices from 'first' in the vertex array
+ * (8 floats per vertex, as in vertexarray). The changes are sent to
+ * OpenGL at the next render, in dynamic mode or in static mode alike.
+ * Don't keep the pointer past the next call to this object.
+ */
+GLfloat *TriangleSoup::mapVertices(int first, int count) {
+
+	if(first < 0 || count < 0 || first + count > nverts) {
+		printError("TriangleSoup::mapVertices()", "Vertex range out of bounds.");
+		return NULL;
+	}
+	if(!haveArrays("TriangleSoup::mapVertices()", true)) {
+		return NULL;
+	}
+	for(int f=0; f<dynamicframes; f++) {
+		dirtyfirst[f] = std::min(dirtyfirst[f], first);
+		dirtyend[f] = std::max(dirtyend[f], first + count);
+	}
+	dynamicpending = true;
+	return &vertexarray[8*(size_t)first];
+};
+
+/*
+ * updateVertices(int first, int count, const GLfloat *vertices)
+ *
+ * Replace 'count' vertices from 'first' with new ones (8 floats each).
+ */
+void TriangleSoup::updateVertices(int first, int count, const GLfloat *vertices) {
+
+	GLfloat *destination = mapVertices(first, count);
+	if(destination) {
+		memcpy(destination, vertices, (size_t)count*8*sizeof(GLfloat));
+	}
+};
+
+/*
+ * private
+ * commitVertices() - Send the vertices that changed since the last
+ * render. In dynamic mode, they go to the next copy in the ring, and
+ * the VAO is switched over to read from it.
+ */
+void TriangleSoup::commitVertices() {
+
+	size_t bytes = (size_t)nverts*8*sizeof(GLfloat);
+	int first, end;
+	void *destination;
+
+	if(!dynamicpending || (!vao && arenaslot < 0)) return;
+	dynamicpending = false;
+	if(dynamicframes == 0) { // Static mode: just send everything again
+		updateVertexBuffer();
+		return;
+	}
+
+	// The GPU may still read the current copy, so fence it and move on
+	dynamicfences[dynamicslot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	dynamicslot = (dynamicslot + 1) % dynamicframes;
+	if(dynamicfences[dynamicslot]) {
+		// This copy was last used 'dynamicframes' renders ago, so the
+		// fence is normally signaled already and we don't wait at all
+		GLenum status = glClientWaitSync(dynamicfences[dynamicslot],
+			GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+		if(status == GL_TIMEOUT_EXPIRED) {
+			dynamicstalls++;
+			do {
+				status = glClientWaitSync(dynamicfences[dynamicslot],
+					GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000); // 1 s
+			} while(status == GL_TIMEOUT_EXPIRED);
+		}
+		glDeleteSync(dynamicfences[dynamicslot]);
+		dynamicfences[dynamicslot] = 0;
+	}
+
+	first = dirtyfirst[dynamicslot];
+	end = dirtyend[dynamicslot];
+	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+	if(first < end) {
+		size_t offset = dynamicslot*bytes + (size_t)first*8*sizeof(GLfloat);
+		size_t length = (size_t)(end - first)*8*sizeof(GLfloat);
+		destination = glMapBufferRange(GL_ARRAY_BUFFER, offset, length,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if(destination) {
+			memcpy(destination, &vertexarray[8*(size_t)first], length);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		}
+		else {
+			glBufferSubData(GL_ARRAY_BUFFER, offset, length, &vertexarray[8*(size_t)first]);
+		}
+	}
+	dirtyfirst[dynamicslot] = nverts;
+	dirtyend[dynamicslot] = 0;
+
+	glBindVertexArray(vao);
+	setFloatPointers(dynamicslot*bytes);
+	MeshArena::unbind();
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+};
+
+/*
+ * private
+ * clearFences() - Delete the fences of dynamic mode.
+ */
+void TriangleSoup::clearFences() {
+
+	for(int f=0; f<MAX_DYNAMIC_FRAMES; f++) {
+		if(dynamicfences[f]) {
+			glDeleteSync(dynamicfences[f]);
+			dynamicfences[f] = 0;
+		}
+	}
+};
+
+/*
+ * private
+ * updateIndexBuffer() - Send a modified index array to OpenGL.
+ * The index buffer is part of the VAO state, so bind the VAO first.
+ */
+void TriangleSoup::updateIndexBuffer() {
+
+	if(arena) {
+		if(arena->indexCount(arenaslot) != 3*allTris()) uploadToArena();
+		else arena->sendIndices(arenaslot, 0, 3*allTris(), indexarray);
+		return;
+	}
+	glBindVertexArray(vao);
+	sendIndices();
+	MeshArena::unbind();
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+};
+
+/*
+ * private
+ * sendIndices() - Present the index array to OpenGL, including the
+ * index lists of the simplified levels of detail. If every vertex
+ * can be addressed with 16 bits, the indices are converted to
+ * GL_UNSIGNED_SHORT, which halves the size of the index buffer.
+ * The VAO must be bound. The index array itself is never changed.
+ */
+void TriangleSoup::sendIndices() {
+
+	int nindices = 3*allTris();
+
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexbuffer);
+	if(nverts <= 65536) {
+		GLushort *shortarray = new GLushort[nindices];
+		for(int i=0; i<nindices; i++) {
+			shortarray[i] = (GLushort)indexarray[i];
+		}
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			nindices*sizeof(GLushort), shortarray, GL_STATIC_DRAW);
+		delete[] shortarray;
+		indextype = GL_UNSIGNED_SHORT;
+	}
+	else {
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			nindices*sizeof(GLuint), indexarray, GL_STATIC_DRAW);
+		indextype = GL_UNSIGNED_INT;
+	}
+};
+
+/* Size of one index in the index buffer, in bytes */
+int TriangleSoup::indexBytes() {
+
+	return (indextype == GL_UNSIGNED_SHORT) ? sizeof(GLushort) : sizeof(GLuint);
+};
+
+/*
+ * private
+ * computeBounds() - Find the axis aligned bounding box of the vertices,
+ * and a bounding sphere around the center of the box. That sphere is
+ * at most a few percent larger than the smallest one for typical
+ * meshes, and it is the same every time, unlike iterative methods.
+ */
+void TriangleSoup::computeBounds() {
+	int i, j;
+
+	for(j=0; j<3; j++) {
+		boundsmin[j] = (nverts > 0) ? vertexarray[j] : 0.0f;
+		boundsmax[j] = boundsmin[j];
+	}
+	for(i=1; i<nverts; i++) {
+		const GLfloat *v = &vertexarray[8*(size_t)i];
+		for(j=0; j<3; j++) {
+			if(v[j] < boundsmin[j]) boundsmin[j] = v[j];
+			if(v[j] > boundsmax[j]) boundsmax[j] = v[j];
+		}
+	}
+	computeSphere();
+};
+
+/*
+ * private
+ * computeSphere() - Find the smallest sphere around the center of
+ * the bounding box that contains all vertices.
+ */
+void TriangleSoup::computeSphere() {
+
+	float radius2 = 0.0f;
+
+	for(int j=0; j<3; j++) {
+		spherecenter[j] = 0.5f*(boundsmin[j] + boundsmax[j]);
+	}
+	for(size_t i=0; i<(size_t)nverts; i++) {
+		const GLfloat *v = &vertexarray[8*i];
+		float dx = v[0] - spherecenter[0];
+		float dy = v[1] - spherecenter[1];
+		float dz = v[2] - spherecenter[2];
+		radius2 = std::max(radius2, dx*dx + dy*dy + dz*dz);
+	}
+	sphereradius = sqrtf(radius2);
+};
+
+/*
+ * The header of a binary mesh cache file written by readOBJ().
+ * It is followed by the vertex block (8 floats per vertex, as in
+ * vertexarray) and the index block (3 GLuints per triangle) at
+ * the given offsets. Both blocks start on a 64-byte boundary.
+ * The data is stored in the native byte order of the machine.
+ */
+struct MeshCacheHeader {
+	char magic[4];                   // "TSC" and a terminating zero
+	unsigned int version;            // MESHCACHE_VERSION
+	unsigned int byteorder;          // 0x01020304 in the byte order of the writer
+	unsigned int flags;              // The readOBJ() flags that affect the mesh
+	unsigned int nverts;             // Number of vertices in the vertex block
+	unsigned int ntris;              // Number of triangles in the index block
+	long long sourcesize;            // Size of the OBJ file, in bytes
+	long long sourcemtime;           // Modification time of the OBJ file
+	float boundsmin[3];              // Bounding box of the vertices
+	float boundsmax[3];
+	float spherecenter[3];           // Bounding sphere of the vertices
+	float sphereradius;
+	unsigned long long vertexoffset; // File offset of the vertex block
+	unsigned long long indexoffset;  // File offset of the index block
+};
+
+#define MESHCACHE_VERSION 2
+#define MESHCACHE_ALIGN 64
+
+/*
+ * private
+ * readCache() - Use an up-to-date binary mesh cache file as the
+ * vertex array and the index array. The file is mapped copy-on-write,
+ * so the arrays can be modified like any others. Returns false if
+ * the cache file is missing, stale or broken. Every index is checked
+ * against the number of vertices, so a damaged file makes readOBJ()
+ * parse the OBJ file again instead of sending bad indices to OpenGL.
+ */
+bool TriangleSoup::readCache(const char *cachename, long long sourcesize,
+	long long sourcemtime, unsigned int flags) {
+
+	MappedFile *file = new MappedFile;
+	const MeshCacheHeader *header;
+	const GLuint *indices;
+	GLuint largest = 0;
+
+	if(!file->open(cachename, true) || file->size < sizeof(MeshCacheHeader)) {
+		delete file;
+		return false;
+	}
+	header = (const MeshCacheHeader*)file->data;
+	if(memcmp(header->magic, "TSC", 4) != 0
+		|| header->version != MESHCACHE_VERSION
+		|| header->byteorder != 0x01020304
+		|| header->flags != flags
+		|| header->sourcesize != sourcesize
+		|| header->sourcemtime != sourcemtime
+		|| header->vertexoffset % MESHCACHE_ALIGN != 0
+		|| header->indexoffset % MESHCACHE_ALIGN != 0
+		|| header->ntris > 715827882 // 3*ntris must fit in a GLsizei
+		|| header->nverts > 715827882
+		// Written so that a huge offset cannot wrap the sum around
+		|| header->vertexoffset > file->size
+		|| 8ULL*sizeof(GLfloat)*header->nverts > file->size - header->vertexoffset
+		|| header->indexoffset > file->size
+		|| 3ULL*sizeof(GLuint)*header->ntris > file->size - header->indexoffset) {
+		delete file;
+		return false;
+	}
+	indices = (const GLuint*)(file->data + header->indexoffset);
+	for(size_t i=0; i<3*(size_t)header->ntris; i++) {
+		largest = (indices[i] > largest) ? indices[i] : largest;
+	}
+	if(header->ntris > 0 && largest >= header->nverts) {
+		delete file;
+		return false;
+	}
+
+	cachefile = file;
+	nverts = header->nverts;
+	ntris = header->ntris;
+	vertexarray = (GLfloat*)(file->data + header->vertexoffset);
+	indexarray = (GLuint*)(file->data + header->indexoffset);
+	for(int i=0; i<3; i++) {
+		boundsmin[i] = header->boundsmin[i];
+		boundsmax[i] = header->boundsmax[i];
+		spherecenter[i] = header->spherecenter[i];
+	}
+	sphereradius = header->sphereradius;
+	return true;
+};
+
+/*
+ * private
+ * writeCache() - Write the vertex array and the index array to a
+ * binary mesh cache file. The file is written under a temporary name
+ * and renamed when it is complete, so a half-written cache is never
+ * picked up by readCache(). Failure is reported, but not fatal.
+ */
+void TriangleSoup::writeCache(const char *cachename, long long sourcesize,
+	long long sourcemtime, unsigned int flags) {
+
+	MeshCacheHeader header;
+	char padding[MESHCACHE_ALIGN];
+	std::string tempname = std::string(cachename) + ".tmp";
+	size_t vertexbytes = 8*sizeof(GLfloat)*(size_t)nverts;
+	size_t indexbytes = 3*sizeof(GLuint)*(size_t)ntris;
+	size_t headerbytes = (sizeof(header) + MESHCACHE_ALIGN-1) / MESHCACHE_ALIGN * MESHCACHE_ALIGN;
+	FILE *file;
+	bool ok;
+
+	if(nverts == 0 || ntris == 0) return; // Nothing worth caching
+
+	memset(&header, 0, sizeof(header));
+	memset(padding, 0, sizeof(padding));
+	memcpy(header.magic, "TSC", 4);
+	header.version = MESHCACHE_VERSION;
+	header.byteorder = 0x01020304;
+	header.flags = flags;
+	header.nverts = nverts;
+	header.ntris = ntris;
+	header.sourcesize = sourcesize;
+	header.sourcemtime = sourcemtime;
+	for(int i=0; i<3; i++) {
+		header.boundsmin[i] = boundsmin[i];
+		header.boundsmax[i] = boundsmax[i];
+		header.spherecenter[i] = spherecenter[i];
+	}
+	header.sphereradius = sphereradius;
+	header.vertexoffset = headerbytes;
+	header.indexoffset = headerbytes + vertexbytes;
+	header.indexoffset = (header.indexoffset + MESHCACHE_ALIGN-1) / MESHCACHE_ALIGN * MESHCACHE_ALIGN;
+
+	file = fopen(tempname.c_str(), "wb");
+	if(!file) {
+		printError("Could not write mesh cache", cachename);
+		return;
+	}
+	ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(padding, 1, headerbytes - sizeof(header), file) == headerbytes - sizeof(header)
+		&& fwrite(vertexarray, 1, vertexbytes, file) == vertexbytes
+		&& fwrite(padding, 1, header.indexoffset - headerbytes - vertexbytes, file)
+			== header.indexoffset - headerbytes - vertexbytes
+		&& fwrite(indexarray, 1, indexbytes, file) == indexbytes;
+	ok = (fclose(file) == 0) && ok;
+	remove(cachename); // rename() does not replace existing files on Windows
+	if(!ok || rename(tempname.c_str(), cachename) != 0) {
+		remove(tempname.c_str());
+		printError("Could not write mesh cache", cachename);
+	}
+};
+
+/*
+ * The header of a compressed mesh file written by writeMesh(). It is
+ * followed by the payload: the index stream and the vertex stream of
+ * MeshCodec, one after the other, and entropy coded as a whole if
+ * MESH_ENTROPY is in the flags. The bounding box of the mesh is the
+ * quantization range of the positions. Like the cache files, mesh
+ * files are in the native byte order of the machine.
+ */
+struct MeshFileHeader {
+	char magic[4];                    // "TSM" and a terminating zero
+	unsigned int version;             // MESHFILE_VERSION
+	unsigned int byteorder;           // 0x01020304 in the byte order of the writer
+	unsigned int flags;               // The writeMesh() flags
+	unsigned int nverts;              // Number of vertices
+	unsigned int ntris;               // Number of triangles
+	MeshCodec::Quantization quantization; // Bit sizes and ranges of the vertex attributes
+	float spherecenter[3];            // Bounding sphere of the decoded vertices
+	float sphereradius;
+	unsigned long long indexbytes;    // Size of the index stream
+	unsigned long long vertexbytes;   // Size of the vertex stream
+	unsigned long long payloadbytes;  // Size of the payload in the file
+};
+
+#define MESHFILE_VERSION 1
+
+/*
+ * writeMesh(const char *filename, int flags, int positionbits,
+ *     int normalbits, int texcoordbits)
+ *
+ * Save the mesh (without any levels of detail) in a compressed binary
+ * file that readMesh() can load. The indices are delta coded, and the
+ * vertex attributes are quantized and bit-packed with MeshCodec, to
+ * about 13 bytes per vertex with the default bit sizes, instead of 32.
+ * Run optimizeVertexFetch() first to make the index deltas small.
+ * With MESH_ENTROPY, the result is entropy coded too. The bounding
+ * sphere is made larger by the quantization error, so it still holds
+ * all the decoded vertices. Like the cache files, the mesh file is
+ * written under a temporary name and renamed when it is complete.
+ */
+bool TriangleSoup::writeMesh(const char *filename, int flags, int positionbits,
+	int normalbits, int texcoordbits) {
+
+	MeshFileHeader header;
+	MeshCodec::Quantization &q = header.quantization;
+	std::vector<unsigned char> streams, packed;
+	const std::vector<unsigned char> *payload = &streams;
+	std::string tempname = std::string(filename) + ".tmp";
+	float error = 0.0f;
+	FILE *file;
+	bool ok;
+
+	if(!haveArrays("TriangleSoup::writeMesh()", true)) {
+		return false;
+	}
+	if(positionbits < 1 || positionbits > 24 || normalbits < 1 || normalbits > 24
+		|| texcoordbits < 1 || texcoordbits > 24) {
+		printError("TriangleSoup::writeMesh()", "The bit sizes must be from 1 to 24.");
+		return false;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, "TSM", 4);
+	header.version = MESHFILE_VERSION;
+	header.byteorder = 0x01020304;
+	header.flags = flags & MESH_ENTROPY;
+	header.nverts = nverts;
+	header.ntris = ntris;
+	q.positionbits = positionbits;
+	q.normalbits = normalbits;
+	q.texcoordbits = texcoordbits;
+	MeshCodec::findRanges(vertexarray, nverts, &q);
+	for(int k=0; k<3; k++) {
+		float step = (q.posmax[k] - q.posmin[k]) / ((1u << positionbits) - 1);
+		error += 0.25f*step*step;
+		header.spherecenter[k] = spherecenter[k];
+	}
+	header.sphereradius = sphereradius + sqrtf(error);
+
+	header.indexbytes = MeshCodec::encodeIndices(indexarray, 3*(size_t)ntris, streams);
+	MeshCodec::encodeVertices(vertexarray, nverts, q, streams);
+	header.vertexbytes = streams.size() - header.indexbytes;
+	if(header.flags & MESH_ENTROPY) {
+		MeshCodec::compress(streams.data(), streams.size(), packed);
+		payload = &packed;
+	}
+	header.payloadbytes = payload->size();
+
+	file = fopen(tempname.c_str(), "wb");
+	if(!file) {
+		printError("Could not write mesh file", filename);
+		return false;
+	}
+	ok = fwrite(&header, sizeof(header), 1, file) == 1
+		&& fwrite(payload->data(), 1, payload->size(), file) == payload->size();
+	ok = (fclose(file) == 0) && ok;
+	remove(filename); // rename() does not replace existing files on Windows
+	if(!ok || rename(tempname.c_str(), filename) != 0) {
+		remove(tempname.c_str());
+		printError("Could not write mesh file", filename);
+		return false;
+	}
+	printf("writeMesh(\"%s\"): %d vertices, %d faces in %.2f MB (%.1f bytes per face).\n",
+		filename, nverts, ntris, (sizeof(header) + payload->size())/1e6,
+		(ntris > 0) ? (double)(sizeof(header) + payload->size())/ntris : 0.0);
+	return true;
+};
+
+/*
+ * Check the header of a mesh file of 'filesize' bytes. Every size is
+ * checked on its own against limits from the vertex and triangle
+ * counts before any of them are added, and the sums are done in 64 bits,
+ * so no crafted size can wrap. The arrays and the unpacked payload must
+ * also fit in a size_t, which matters for 32-bit builds.
+ */
+static bool validMeshHeader(const MeshFileHeader *header, size_t filesize) {
+
+	const MeshCodec::Quantization &q = header->quantization;
+	unsigned long long count, mincount, maxcount;
+	unsigned long long sizelimit = (size_t)-1;
+
+	if(filesize < sizeof(MeshFileHeader)
+		|| memcmp(header->magic, "TSM", 4) != 0
+		|| header->version != MESHFILE_VERSION
+		|| header->byteorder != 0x01020304
+		|| header->payloadbytes != filesize - sizeof(MeshFileHeader)
+		|| header->ntris > 715827882 // 3*ntris must fit in a GLsizei
+		|| header->nverts > 715827882
+		|| 8ULL*sizeof(GLfloat)*header->nverts > sizelimit
+		|| 3ULL*sizeof(GLuint)*header->ntris > sizelimit
+		|| q.positionbits < 1 || q.positionbits > 24
+		|| q.normalbits < 1 || q.normalbits > 24
+		|| q.texcoordbits < 1 || q.texcoordbits > 24) {
+		return false;
+	}
+
+	// The index stream has a control byte per four indices, 1 to 4 bytes
+	// per index, and 3 bytes of padding. The vertex stream has a fixed size.
+	count = 3ULL*header->ntris;
+	mincount = (count + 3)/4 + count + 3;
+	maxcount = (count + 3)/4 + 4*count + 3;
+	if(header->indexbytes < mincount || header->indexbytes > maxcount
+		|| header->vertexbytes != MeshCodec::vertexStreamBytes(header->nverts, q)
+		|| header->indexbytes + header->vertexbytes > sizelimit) {
+		return false;
+	}
+	if(!(header->flags & TriangleSoup::MESH_ENTROPY)) {
+		return header->payloadbytes == header->indexbytes + header->vertexbytes;
+	}
+	return true;
+}
+
+/*
+ * readMesh(const char *filename, ScratchArena *scratch)
+ *
+ * Load a mesh file written by writeMesh(). The file is memory mapped
+ * and decoded straight into the vertex array and the index array.
+ * An entropy coded payload is first decoded to a buffer in the scratch
+ * arena. As for readOBJ(), the arrays are taken from the arena too if
+ * the retention policy frees them after upload. The decoding speed, in
+ * GB/s of vertex and index arrays, is reported on the console.
+ */
+void TriangleSoup::readMesh(const char *filename, ScratchArena *scratch) {
+
+	MappedFile file;
+	const MeshFileHeader *header;
+	ScratchArena *arena;
+	ScratchArena::Mark start;
+	size_t startused;
+	const unsigned char *payload;
+	unsigned char *unpacked;
+	std::chrono::steady_clock::time_point starttime;
+	double seconds;
+	bool ok;
+
+	// Delete any previous content in the TriangleSoup object
+	clean();
+
+	if(!file.open(filename)) {
+		printError("File not found", filename);
+		return;
+	}
+	header = (const MeshFileHeader*)file.data;
+	if(!validMeshHeader(header, file.size)) {
+		printError("Not a valid mesh file", filename);
+		return;
+	}
+
+	arena = scratch ? scratch : ScratchArena::acquire();
+	start = arena->mark();
+	startused = arena->used();
+	arena->resetPeak();
+	starttime = std::chrono::steady_clock::now();
+
+	payload = (const unsigned char*)file.data + sizeof(MeshFileHeader);
+	ok = true;
+	if(header->flags & MESH_ENTROPY) {
+		unpacked = arena->allocate<unsigned char>(header->indexbytes + header->vertexbytes);
+		ok = unpacked && MeshCodec::decompress(payload, header->payloadbytes, unpacked,
+			header->indexbytes + header->vertexbytes);
+		payload = unpacked;
+	}
+
+	nverts = header->nverts;
+	ntris = header->ntris;
+	allocateArrays(arena);
+	ok = ok && vertexarray && indexarray
+		&& MeshCodec::decodeIndices(payload, header->indexbytes, indexarray,
+			3*(size_t)ntris, nverts)
+		&& MeshCodec::decodeVertices(payload + header->indexbytes, header->vertexbytes,
+			vertexarray, nverts, header->quantization);
+	seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - starttime).count();
+
+	if(!ok) { // Delete corrupt data if a read error occured
+		printError("Mesh read error", filename);
+		clean();
+	}
+	else {
+		for(int k=0; k<3; k++) {
+			boundsmin[k] = header->quantization.posmin[k];
+			boundsmax[k] = header->quantization.posmax[k];
+			spherecenter[k] = header->spherecenter[k];
+		}
+		sphereradius = header->sphereradius;
+		printf("readMesh(\"%s\"): decoded %d vertices, %d faces from %.2f MB in %.3f s (%.2f GB/s).\n",
+			filename, nverts, ntris, file.size/1e6, seconds,
+			(seconds > 0.0) ? (32.0*nverts + 12.0*ntris)/1e9/seconds : 0.0);
+		printf("readMesh(\"%s\"): peak scratch memory %.1f MB.\n",
+			filename, (arena->peak() - startused)/1e6);
+
+		// Send the data to OpenGL
+		upload();
+	}
 
+	// Give back the temporary arrays
+	if(scratch) scratch->rewind(start);
+	else ScratchArena::release(arena);
 };
 
 /*
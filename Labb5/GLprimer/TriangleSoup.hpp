@@ -4,7 +4,8 @@
  * in an OpenGL vertex array object. */
 /* Usage: The methods createXXX() create geometry from fixed
  * arrays or procedural descriptions.
- * The method loadOBJ() loads geometry from an OBJ file.
+ * The method readOBJ() loads geometry from an OBJ file, and keeps
+ * a binary cache of the result next to it for faster loading.
  * Only the mesh is loaded. Material information is ignored.
  * Only triangles are supported. OBJ files with quads are rejected.
  * Call render() to draw the mesh in OpenGL. */
@@ -21,6 +22,15 @@
 
 #include <GLFW/glfw3.h>   // To use OpenGL datatypes
 
+#ifdef __WIN32__
+#include <GL/glext.h> // For GLsync, which is newer than OpenGL 1.1
+#endif
+
+class MappedFile;
+class MeshArena;
+class ScratchArena;
+namespace MeshOptimizer { struct Cluster; }
+
 /* A struct to hold geometry data and send it off for rendering */
 class TriangleSoup {
 
@@ -34,6 +44,36 @@ private:
     GLuint indexbuffer;  // Buffer ID to bind to GL_ELEMENT_ARRAY_BUFFER
     GLfloat *vertexarray; // Vertex array on interleaved format: x y z nx ny nz s t
     GLuint *indexarray;   // Element index array
+    GLfloat boundsmin[3]; // Axis aligned bounding box of the vertices
+    GLfloat boundsmax[3];
+    GLfloat spherecenter[3]; // Bounding sphere of the vertices
+    GLfloat sphereradius;
+    MappedFile *cachefile; // Mesh cache that the arrays point into, if any
+    int vertexformat;     // Layout of the vertex buffer, one of VERTEX_*
+    GLenum indextype;     // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, chosen at upload
+    GLfloat texmin[2];    // Range of the texture coordinates in a packed buffer
+    GLfloat texmax[2];
+    MeshOptimizer::Cluster *clusters; // Culling data for ranges of triangles, if any
+    int nclusters;
+    int nlods;            // Number of levels of detail (0 or 1 if there are none)
+    int lodfirst[8];      // First triangle of each level (up to MAX_LODS) in the index array
+    int lodtris[8];       // Number of triangles in each level
+    float loderror[8];    // Geometric error of each level, in object coordinates
+    int lastlod;          // Level drawn by the last renderLOD(MV, P, ...), or -1
+    static long long lodtrisdrawn; // Counters for lodStats()
+    static long long lodtrissaved;
+    int dynamicframes;    // Copies of the vertices in dynamic mode, 0 for static mode
+    int dynamicslot;      // Copy that the VAO reads from
+    bool dynamicpending;  // Vertices have changed since the last render
+    int dynamicstalls;    // Times we had to wait for the GPU
+    GLsync dynamicfences[4];  // Fence for each copy (up to MAX_DYNAMIC_FRAMES)
+    int dirtyfirst[4];    // Range of changed vertices not yet in each copy
+    int dirtyend[4];
+    MeshArena *arena;     // Shared buffers that hold the mesh, or NULL for our own
+    int arenaslot;        // Slot of the mesh in the arena, or -1
+    int retention;        // What to keep in CPU memory after upload, one of RETAIN_*
+    GLfloat *positionarray; // Positions only (x y z), for RETAIN_POSITIONS after upload
+    ScratchArena *scratcharena; // Arena that the arrays are borrowed from during a load, or NULL
 
 public:
 
@@ -43,6 +83,11 @@ TriangleSoup();
 /* Destructor: clean up allocated data in a triangleSoup object */
 ~TriangleSoup();
 
+/* Move constructor and move assignment: take over the arrays and the
+ * OpenGL objects of another TriangleSoup, which is left empty */
+TriangleSoup(TriangleSoup &&other);
+TriangleSoup &operator=(TriangleSoup &&other);
+
 /* Clean up allocated data in a triangleSoup object */
 void clean();
 
@@ -52,11 +97,129 @@ void createTriangle();
 /* Create a simple box geometry */
 void createBox(float xsize, float ysize, float zsize);
 
-/* Create a sphere (approximated by polygon segments) */
-void createSphere(float radius, int segments);
+/* Create a sphere (approximated by polygon segments). Temporary arrays
+ * are taken from 'scratch', or from a pooled arena if it is NULL. */
+void createSphere(float radius, int segments, ScratchArena *scratch = NULL);
+
+/* Flags for readOBJ(), to be combined with bitwise or */
+enum {
+    OBJ_PARALLEL = 1, // Parse the file with one thread per CPU core
+    OBJ_WELD = 2,     // Share vertices between faces through the index array
+    OBJ_NOCACHE = 4   // Neither read nor write a binary cache file
+};
+
+/* Load geometry from an OBJ file. Temporary arrays are taken from
+ * 'scratch', or from a pooled arena if it is NULL, and given back when
+ * the mesh is loaded. */
+void readOBJ(const char* filename, int flags = 0, ScratchArena *scratch = NULL);
+
+/* Flags for writeMesh() */
+enum {
+    MESH_ENTROPY = 1 // Entropy code the file as well, which makes it smaller but slower to read
+};
+
+/* Save the mesh in a compact binary file, with the vertex attributes
+ * quantized to the given number of bits (1 to 24). Returns false if
+ * the file could not be written. */
+bool writeMesh(const char *filename, int flags = 0, int positionbits = 16,
+    int normalbits = 12, int texcoordbits = 16);
 
-/* Load geometry from an OBJ file */
-void readOBJ(const char* filename);
+/* Load a mesh saved by writeMesh(). Temporary arrays are taken from
+ * 'scratch', as for readOBJ(). */
+void readMesh(const char *filename, ScratchArena *scratch = NULL);
+
+/* Reorder the triangles for better GPU vertex cache reuse */
+void optimizeVertexCache();
+
+/* Sort the vertices in the order they are first used by the triangles */
+void optimizeVertexFetch();
+
+/* Draw outward facing triangles first, to reduce overdraw */
+void optimizeOverdraw(float threshold = 1.05f);
+
+/* Report the overdraw ratio from the six axis directions */
+float measureOverdraw();
+
+/* Split the mesh into small clusters that renderClusters() can cull */
+void buildClusters(int maxverts = 64, int maxtris = 124);
+
+/* Maximum number of levels of detail, including the full mesh */
+enum { MAX_LODS = 8 };
+
+/* Build simplified levels of detail with ratio^i of the triangles */
+void buildLODs(int nlevels = 4, float ratio = 0.5f);
+
+/* Number of levels of detail, 1 if buildLODs() has not been called */
+int lodCount();
+
+/* Vertex buffer layouts for setVertexFormat() */
+enum {
+    VERTEX_FLOAT = 0,    // 32 bytes: float position, normal and texcoords
+    VERTEX_PACKED16 = 1, // 16 bytes: 16-bit position, 10-bit normal, 16-bit texcoords
+    VERTEX_PACKED12 = 2  // 12 bytes: 16-bit position, 8-bit octahedral normal, 16-bit texcoords
+};
+
+/* Choose the layout of the vertex buffer (the default is VERTEX_FLOAT) */
+void setVertexFormat(int format);
+
+/* Size of one vertex in the vertex buffer, in bytes */
+int vertexBytes();
+
+/* Size of one index in the index buffer, in bytes (2 if nverts <= 65536) */
+int indexBytes();
+
+/* Keep the mesh in a shared MeshArena, drawn without binding
+ * a VAO of its own (NULL goes back to separate buffers) */
+void setArena(MeshArena *newarena);
+
+/* Get the arena and the draw parameters of one level of detail, for
+ * BatchRenderer. Returns NULL if the mesh is not in an arena. */
+MeshArena *arenaDraw(int level, GLsizei *count, GLuint *firstindex, GLint *basevertex);
+
+/* Maximum number of vertex buffer copies for setDynamic() */
+enum { MAX_DYNAMIC_FRAMES = 4 };
+
+/* Keep several copies of the vertices on the GPU, for meshes that
+ * change every frame (0 switches back to a single static copy) */
+void setDynamic(int frames = 3);
+
+/* Get write access to a range of vertices, which are sent to
+ * OpenGL at the next render */
+GLfloat *mapVertices(int first, int count);
+
+/* Replace a range of vertices, which are sent to OpenGL at the next render */
+void updateVertices(int first, int count, const GLfloat *vertices);
+
+/* Get the axis aligned bounding box of the vertices */
+void bounds(float min[3], float max[3]);
+
+/* Get the bounding sphere of the vertices. Returns the radius. */
+float boundingSphere(float center[3]);
+
+/* What to keep in CPU memory once the mesh is sent to OpenGL */
+enum {
+    RETAIN_ALL = 0,      // The vertex and index arrays (the default)
+    RETAIN_NONE = 1,     // Nothing, the mesh can only be drawn
+    RETAIN_POSITIONS = 2 // Positions and indices, for picking and culling
+};
+
+/* Choose what stays in CPU memory after upload. Set it before createXXX()
+ * or readOBJ(), or after buildLODs() and optimizeVertexFetch(), which
+ * need the whole vertex array. */
+void setRetention(int policy);
+
+/* Read access to the vertex array (8 floats per vertex, as for
+ * mapVertices()) and the index array (3 indices per triangle),
+ * for CPU work like SoftwareOcclusion. They are NULL if they were
+ * dropped by setRetention(). */
+const GLfloat *vertexArray();
+const GLuint *indexArray();
+int vertexCount();
+int triangleCount();
+
+/* The vertex positions, 'stride' floats apart: the vertex array,
+ * or the positions kept by RETAIN_POSITIONS, or NULL */
+const GLfloat *positionArray(int *stride);
 
 /* Print data from a triangleSoup object, for debugging purposes */
 void print();
@@ -67,10 +230,114 @@ void printInfo();
 /* Render the geometry in a triangleSoup object */
 void render();
 
+/* Render one level of detail (0 is the full mesh) */
+void renderLOD(int level);
+
+/* Layout of one instance in the buffer for renderInstanced():
+ * a model matrix, column-major as in Utilities, and a layer
+ * of a texture array */
+struct Instance {
+    GLfloat M[16];
+    GLfloat layer;
+};
+
+/* First attribute location of the instance data in the shader
+ * (the matrix uses four locations, then comes the layer) */
+enum { INSTANCE_LOCATION = 4 };
+
+/* Render 'count' copies of the mesh (or of one level of detail) with
+ * one draw call, each with its own Instance from 'instancebuffer' */
+void renderInstanced(int count, GLuint instancebuffer, int level = 0);
+
+/* Pick the coarsest level of detail with a screen space error of at most
+ * 'pixelerror' pixels, with hysteresis against the 'previous' level */
+int selectLOD(float MV[], float P[], int viewportheight, float pixelerror,
+    int previous = -1, float hysteresis = 0.25f);
+
+/* Select a level of detail as above and render it. Returns the level. */
+int renderLOD(float MV[], float P[], int viewportheight, float pixelerror);
+
+/* Triangles drawn and saved by renderLOD() since the last call */
+static void lodStats(long long *drawn, long long *saved);
+
+/* Make 'program' current with glUseProgram(), and remember it so the
+ * render functions need not ask OpenGL which program is in use. If this
+ * is used, every change of program must go through it. */
+static void useProgram(GLuint program);
+
+/* Forget what is known about the uniforms of 'program'. Call this when
+ * a program is deleted or linked again, since OpenGL may give its name
+ * to a new program. Shader::createShader() does it. */
+static void forgetProgram(GLuint program);
+
+/* Render only the clusters that are in view and facing the camera.
+ * MV and P must be the matrices that the shader uses.
+ * Returns the number of triangles drawn. */
+int renderClusters(float MV[], float P[]);
+
 private:
 
+void initialize();
+
+void moveFrom(TriangleSoup &other);
+
+void upload();
+
+void applyRetention();
+void allocateArrays(ScratchArena *scratch);
+void keepScratchArrays();
+bool inScratch(const void *array);
+
+bool haveArrays(const char *caller, bool allvertices);
+
+void uploadToArena();
+
+void releaseBuffers();
+
+void drawTriangles(int firsttri, int count);
+
+void setInstancePointers(GLuint instancebuffer);
+
+void clearInstancePointers();
+
+void updateVertexBuffer();
+
+void sendVertices();
+
+void setFloatPointers(size_t offset);
+
+void commitVertices();
+
+void clearFences();
+
+void packVertices(unsigned char *packed);
+
+void setDequantization();
+
+void sendIndices();
+
+void clearClusters();
+
+int allTris();
+
+bool inCacheFile(const void *array);
+
+void updateIndexBuffer();
+
+void computeBounds();
+
+void computeSphere();
+
+bool readCache(const char *cachename, long long sourcesize, long long sourcemtime, unsigned int flags);
+
+void writeCache(const char *cachename, long long sourcesize, long long sourcemtime, unsigned int flags);
+
 void printError(const char *errtype, const char *errmsg);
 
+// The buffers are a unique resource, so copying is not allowed
+TriangleSoup(const TriangleSoup&);
+TriangleSoup& operator=(const TriangleSoup&);
+
 };
 
 #endif // TRIANGLESOUP_HPP
@@ -39,12 +39,20 @@ PFNGLGETUNIFORMLOCATIONPROC       glGetUniformLocation = NULL;
 PFNGLUNIFORM1FPROC                glUniform1f          = NULL;
 PFNGLUNIFORM1FVPROC               glUniform1fv         = NULL;
 PFNGLUNIFORM1IPROC                glUniform1i          = NULL;
+PFNGLUNIFORM2FVPROC               glUniform2fv         = NULL;
+PFNGLUNIFORM3FVPROC               glUniform3fv         = NULL;
 PFNGLUNIFORMMATRIX4FVPROC         glUniformMatrix4fv   = NULL;
 PFNGLGENBUFFERSPROC               glGenBuffers         = NULL;
 PFNGLISBUFFERPROC                 glIsBuffer           = NULL;
 PFNGLBINDBUFFERPROC               glBindBuffer         = NULL;
 PFNGLBUFFERDATAPROC               glBufferData         = NULL;
 PFNGLDELETEBUFFERSPROC            glDeleteBuffers      = NULL;
+PFNGLBUFFERSUBDATAPROC            glBufferSubData            = NULL;
+PFNGLMAPBUFFERRANGEPROC           glMapBufferRange           = NULL;
+PFNGLUNMAPBUFFERPROC              glUnmapBuffer              = NULL;
+PFNGLFENCESYNCPROC                glFenceSync                = NULL;
+PFNGLCLIENTWAITSYNCPROC           glClientWaitSync           = NULL;
+PFNGLDELETESYNCPROC               glDeleteSync               = NULL;
 PFNGLGENVERTEXARRAYSPROC          glGenVertexArrays    = NULL;
 PFNGLISVERTEXARRAYPROC            glIsVertexArray      = NULL;
 PFNGLBINDVERTEXARRAYPROC          glBindVertexArray    = NULL;
@@ -52,6 +60,26 @@ PFNGLDELETEVERTEXARRAYSPROC       glDeleteVertexArrays = NULL;
 PFNGLENABLEVERTEXATTRIBARRAYPROC  glEnableVertexAttribArray  = NULL;
 PFNGLVERTEXATTRIBPOINTERPROC      glVertexAttribPointer      = NULL;
 PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray = NULL;
+PFNGLMULTIDRAWELEMENTSPROC        glMultiDrawElements        = NULL;
+PFNGLCOPYBUFFERSUBDATAPROC        glCopyBufferSubData        = NULL;
+PFNGLDRAWELEMENTSBASEVERTEXPROC   glDrawElementsBaseVertex   = NULL;
+PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC glMultiDrawElementsBaseVertex = NULL;
+PFNGLACTIVETEXTUREPROC            glActiveTexture            = NULL;
+PFNGLTEXBUFFERPROC                glTexBuffer                = NULL;
+PFNGLVERTEXATTRIBDIVISORPROC      glVertexAttribDivisor      = NULL;
+PFNGLDRAWELEMENTSINSTANCEDPROC    glDrawElementsInstanced    = NULL;
+PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC glDrawElementsInstancedBaseVertex = NULL;
+PFNGLGENQUERIESPROC               glGenQueries               = NULL;
+PFNGLISQUERYPROC                  glIsQuery                  = NULL;
+PFNGLDELETEQUERIESPROC            glDeleteQueries            = NULL;
+PFNGLBEGINQUERYPROC               glBeginQuery               = NULL;
+PFNGLENDQUERYPROC                 glEndQuery                 = NULL;
+PFNGLGETQUERYOBJECTUIVPROC        glGetQueryObjectuiv        = NULL;
+PFNGLBEGINCONDITIONALRENDERPROC   glBeginConditionalRender   = NULL;
+PFNGLENDCONDITIONALRENDERPROC     glEndConditionalRender     = NULL;
+#ifdef GL_VERSION_4_3
+PFNGLMULTIDRAWELEMENTSINDIRECTPROC glMultiDrawElementsIndirect = NULL;
+#endif
 PFNGLGENERATEMIPMAPPROC           glGenerateMipmap           = NULL;
 #endif
 
@@ -91,13 +119,16 @@ void Utilities::loadExtensions() {
     glUniform1f          = (PFNGLUNIFORM1FPROC)glfwGetProcAddress("glUniform1f");
     glUniform1fv         = (PFNGLUNIFORM1FVPROC)glfwGetProcAddress("glUniform1fv");
     glUniform1i          = (PFNGLUNIFORM1IPROC)glfwGetProcAddress("glUniform1i");
+    glUniform2fv         = (PFNGLUNIFORM2FVPROC)glfwGetProcAddress("glUniform2fv");
+    glUniform3fv         = (PFNGLUNIFORM3FVPROC)glfwGetProcAddress("glUniform3fv");
 	glUniformMatrix4fv   = (PFNGLUNIFORMMATRIX4FVPROC)glfwGetProcAddress("glUniformMatrix4fv");
 
     if( !glCreateProgram || !glDeleteProgram || !glUseProgram ||
         !glCreateShader || !glDeleteShader || !glShaderSource || !glCompileShader ||
         !glGetShaderiv || !glGetShaderInfoLog || !glAttachShader || !glLinkProgram ||
         !glGetProgramiv || !glGetProgramInfoLog || !glGetUniformLocation ||
-        !glUniform1fv || !glUniform1f || !glUniform1i || !glUniformMatrix4fv )
+        !glUniform1fv || !glUniform1f || !glUniform1i || !glUniform2fv || !glUniform3fv ||
+        !glUniformMatrix4fv )
     {
         printError("GL init error", "One or more required OpenGL shader-related functions were not found");
         return;
@@ -115,16 +146,75 @@ void Utilities::loadExtensions() {
 	glEnableVertexAttribArray  = (PFNGLENABLEVERTEXATTRIBARRAYPROC)glfwGetProcAddress("glEnableVertexAttribArray");
 	glVertexAttribPointer      = (PFNGLVERTEXATTRIBPOINTERPROC)glfwGetProcAddress("glVertexAttribPointer");
 	glDisableVertexAttribArray = (PFNGLDISABLEVERTEXATTRIBARRAYPROC)glfwGetProcAddress("glDisableVertexAttribArray");
+	glMultiDrawElements        = (PFNGLMULTIDRAWELEMENTSPROC)glfwGetProcAddress("glMultiDrawElements");
 
 	if( !glGenBuffers || !glIsBuffer || !glBindBuffer || !glBufferData || !glDeleteBuffers ||
 	    !glGenVertexArrays || !glIsVertexArray || !glBindVertexArray || !glDeleteVertexArrays ||
 		!glEnableVertexAttribArray || !glVertexAttribPointer ||
-		!glDisableVertexAttribArray )
+		!glDisableVertexAttribArray || !glMultiDrawElements )
     	{
 	   		printError("GL init error", "One or more required OpenGL vertex array functions were not found");
             return;
         }
 
+	glBufferSubData  = (PFNGLBUFFERSUBDATAPROC)glfwGetProcAddress("glBufferSubData");
+	glMapBufferRange = (PFNGLMAPBUFFERRANGEPROC)glfwGetProcAddress("glMapBufferRange");
+	glUnmapBuffer    = (PFNGLUNMAPBUFFERPROC)glfwGetProcAddress("glUnmapBuffer");
+	glFenceSync      = (PFNGLFENCESYNCPROC)glfwGetProcAddress("glFenceSync");
+	glClientWaitSync = (PFNGLCLIENTWAITSYNCPROC)glfwGetProcAddress("glClientWaitSync");
+	glDeleteSync     = (PFNGLDELETESYNCPROC)glfwGetProcAddress("glDeleteSync");
+
+	if( !glBufferSubData || !glMapBufferRange || !glUnmapBuffer ||
+	    !glFenceSync || !glClientWaitSync || !glDeleteSync )
+    	{
+	   		printError("GL init error", "One or more required OpenGL buffer mapping and sync functions were not found");
+            return;
+        }
+
+	glCopyBufferSubData           = (PFNGLCOPYBUFFERSUBDATAPROC)glfwGetProcAddress("glCopyBufferSubData");
+	glDrawElementsBaseVertex      = (PFNGLDRAWELEMENTSBASEVERTEXPROC)glfwGetProcAddress("glDrawElementsBaseVertex");
+	glMultiDrawElementsBaseVertex = (PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC)glfwGetProcAddress("glMultiDrawElementsBaseVertex");
+
+	if( !glCopyBufferSubData || !glDrawElementsBaseVertex || !glMultiDrawElementsBaseVertex )
+    	{
+	   		printError("GL init error", "One or more required OpenGL buffer copy and base vertex functions were not found");
+            return;
+        }
+
+	glActiveTexture       = (PFNGLACTIVETEXTUREPROC)glfwGetProcAddress("glActiveTexture");
+	glTexBuffer           = (PFNGLTEXBUFFERPROC)glfwGetProcAddress("glTexBuffer");
+	glVertexAttribDivisor = (PFNGLVERTEXATTRIBDIVISORPROC)glfwGetProcAddress("glVertexAttribDivisor");
+	glDrawElementsInstanced = (PFNGLDRAWELEMENTSINSTANCEDPROC)glfwGetProcAddress("glDrawElementsInstanced");
+	glDrawElementsInstancedBaseVertex = (PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC)glfwGetProcAddress("glDrawElementsInstancedBaseVertex");
+
+	if( !glActiveTexture || !glTexBuffer || !glVertexAttribDivisor ||
+	    !glDrawElementsInstanced || !glDrawElementsInstancedBaseVertex )
+    	{
+	   		printError("GL init error", "One or more required OpenGL texture buffer and instancing functions were not found");
+            return;
+        }
+
+	glGenQueries             = (PFNGLGENQUERIESPROC)glfwGetProcAddress("glGenQueries");
+	glIsQuery                = (PFNGLISQUERYPROC)glfwGetProcAddress("glIsQuery");
+	glDeleteQueries          = (PFNGLDELETEQUERIESPROC)glfwGetProcAddress("glDeleteQueries");
+	glBeginQuery             = (PFNGLBEGINQUERYPROC)glfwGetProcAddress("glBeginQuery");
+	glEndQuery               = (PFNGLENDQUERYPROC)glfwGetProcAddress("glEndQuery");
+	glGetQueryObjectuiv      = (PFNGLGETQUERYOBJECTUIVPROC)glfwGetProcAddress("glGetQueryObjectuiv");
+	glBeginConditionalRender = (PFNGLBEGINCONDITIONALRENDERPROC)glfwGetProcAddress("glBeginConditionalRender");
+	glEndConditionalRender   = (PFNGLENDCONDITIONALRENDERPROC)glfwGetProcAddress("glEndConditionalRender");
+
+	if( !glGenQueries || !glIsQuery || !glDeleteQueries || !glBeginQuery || !glEndQuery ||
+	    !glGetQueryObjectuiv || !glBeginConditionalRender || !glEndConditionalRender )
+    	{
+	   		printError("GL init error", "One or more required OpenGL query and conditional rendering functions were not found");
+            return;
+        }
+
+#ifdef GL_VERSION_4_3
+	// OpenGL 4.3, not required. BatchRenderer falls back to other draw calls.
+	glMultiDrawElementsIndirect = (PFNGLMULTIDRAWELEMENTSINDIRECTPROC)glfwGetProcAddress("glMultiDrawElementsIndirect");
+#endif
+
 	glGenerateMipmap = (PFNGLGENERATEMIPMAPPROC)glfwGetProcAddress("glGenerateMipmap");
 	if( !glGenerateMipmap)
     	{
@@ -248,6 +338,15 @@ void Utilities::mat4scale(float M[], float scale) {
     M[10] = scale;
 }
 
+void Utilities::mat4scale(float M[], float sx, float sy, float sz) {
+
+    mat4identity(M);
+
+    M[0] = sx;
+    M[5] = sy;
+    M[10] = sz;
+}
+
 void Utilities::mat4translate(float M[], float x, float y, float z) {
 
     mat4identity(M);
@@ -277,4 +376,22 @@ void Utilities::mat4perspective(float M[], float vfov, float aspect, float znear
 }
 
 
+void Utilities::mat4frustumPlanes(float M[], float planes[]) {
 
+    // Each plane is the sum or difference of the last row and one
+    // of the other rows (Gribb & Hartmann). M is stored by columns.
+    for(int i = 0; i < 6; i++){
+        int row = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        for(int j = 0; j < 4; j++){
+            planes[4*i+j] = M[4*j+3] + sign * M[4*j+row];
+        }
+        float len = sqrt(planes[4*i]*planes[4*i] + planes[4*i+1]*planes[4*i+1]
+                         + planes[4*i+2]*planes[4*i+2]);
+        if(len > 0.0f){
+            for(int j = 0; j < 4; j++){
+                planes[4*i+j] /= len;
+            }
+        }
+    }
+}
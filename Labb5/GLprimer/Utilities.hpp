@@ -42,12 +42,20 @@ extern PFNGLGETUNIFORMLOCATIONPROC       glGetUniformLocation;
 extern PFNGLUNIFORM1FPROC                glUniform1f;
 extern PFNGLUNIFORM1FVPROC               glUniform1fv;
 extern PFNGLUNIFORM1IPROC                glUniform1i;
+extern PFNGLUNIFORM2FVPROC               glUniform2fv;
+extern PFNGLUNIFORM3FVPROC               glUniform3fv;
 extern PFNGLUNIFORMMATRIX4FVPROC         glUniformMatrix4fv;
 extern PFNGLGENBUFFERSPROC               glGenBuffers;
 extern PFNGLISBUFFERPROC                 glIsBuffer;
 extern PFNGLBINDBUFFERPROC               glBindBuffer;
 extern PFNGLBUFFERDATAPROC               glBufferData;
 extern PFNGLDELETEBUFFERSPROC            glDeleteBuffers;
+extern PFNGLBUFFERSUBDATAPROC            glBufferSubData;
+extern PFNGLMAPBUFFERRANGEPROC           glMapBufferRange;
+extern PFNGLUNMAPBUFFERPROC              glUnmapBuffer;
+extern PFNGLFENCESYNCPROC                glFenceSync;
+extern PFNGLCLIENTWAITSYNCPROC           glClientWaitSync;
+extern PFNGLDELETESYNCPROC               glDeleteSync;
 extern PFNGLGENVERTEXARRAYSPROC          glGenVertexArrays;
 extern PFNGLISVERTEXARRAYPROC            glIsVertexArray;
 extern PFNGLBINDVERTEXARRAYPROC          glBindVertexArray;
@@ -55,6 +63,26 @@ extern PFNGLDELETEVERTEXARRAYSPROC       glDeleteVertexArrays;
 extern PFNGLENABLEVERTEXATTRIBARRAYPROC  glEnableVertexAttribArray;
 extern PFNGLVERTEXATTRIBPOINTERPROC      glVertexAttribPointer;
 extern PFNGLDISABLEVERTEXATTRIBARRAYPROC glDisableVertexAttribArray;
+extern PFNGLMULTIDRAWELEMENTSPROC        glMultiDrawElements;
+extern PFNGLCOPYBUFFERSUBDATAPROC        glCopyBufferSubData;
+extern PFNGLDRAWELEMENTSBASEVERTEXPROC   glDrawElementsBaseVertex;
+extern PFNGLMULTIDRAWELEMENTSBASEVERTEXPROC glMultiDrawElementsBaseVertex;
+extern PFNGLACTIVETEXTUREPROC            glActiveTexture;
+extern PFNGLTEXBUFFERPROC                glTexBuffer;
+extern PFNGLVERTEXATTRIBDIVISORPROC      glVertexAttribDivisor;
+extern PFNGLDRAWELEMENTSINSTANCEDPROC    glDrawElementsInstanced;
+extern PFNGLDRAWELEMENTSINSTANCEDBASEVERTEXPROC glDrawElementsInstancedBaseVertex;
+extern PFNGLGENQUERIESPROC               glGenQueries;
+extern PFNGLISQUERYPROC                  glIsQuery;
+extern PFNGLDELETEQUERIESPROC            glDeleteQueries;
+extern PFNGLBEGINQUERYPROC               glBeginQuery;
+extern PFNGLENDQUERYPROC                 glEndQuery;
+extern PFNGLGETQUERYOBJECTUIVPROC        glGetQueryObjectuiv;
+extern PFNGLBEGINCONDITIONALRENDERPROC   glBeginConditionalRender;
+extern PFNGLENDCONDITIONALRENDERPROC     glEndConditionalRender;
+#ifdef GL_VERSION_4_3
+extern PFNGLMULTIDRAWELEMENTSINDIRECTPROC glMultiDrawElementsIndirect; // Optional, may be NULL
+#endif
 extern PFNGLGENERATEMIPMAPPROC           glGenerateMipmap;
 
 #endif
@@ -96,10 +124,21 @@ void mat4rotz(float M[], float angle);
 
 void mat4scale(float M[], float scale);
 
+void mat4scale(float M[], float sx, float sy, float sz);
+
 void mat4translate(float M[], float x, float y, float z);
 
 void mat4perspective(float M[], float vfov, float aspect, float znear, float zfar);
 
+/*
+ * mat4frustumPlanes() - Extract the six clipping planes of the transform M
+ * (left, right, bottom, top, near, far) as a, b, c, d in planes[4*i..4*i+3].
+ * A point (x, y, z) is inside plane i if a*x + b*y + c*z + d >= 0, and
+ * (a, b, c) is of unit length, so the value is a distance. With M = P*MV,
+ * the planes are in object coordinates.
+ */
+void mat4frustumPlanes(float M[], float planes[]);
+
 
 }
 
@@ -4,6 +4,14 @@ uniform float time;
 uniform mat4 MV;
 uniform mat4 P;
 
+// Dequantization of packed vertex formats, set by TriangleSoup::render().
+// For float vertices the scales are 1 and the offsets 0, which are also
+// the initial values, so a new program draws float meshes correctly.
+uniform vec3 posScale = vec3(1.0);
+uniform vec3 posOffset = vec3(0.0);
+uniform vec2 texScale = vec2(1.0);
+uniform vec2 texOffset = vec2(0.0);
+uniform bool octNormals = false; // Normal.xy holds an octahedral encoded normal
 
 layout(location = 0) in vec3 Position;
 layout(location = 1) in vec3 Normal;
@@ -12,15 +20,24 @@ layout(location = 2) in vec2 TexCoord;
 out vec2 st;
 out vec3 interpolatedNormal;
 
+// Undo the octahedral mapping (see MeshCodec::octEncode())
+vec3 octDecode(vec2 e) {
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    if(n.z < 0.0) {
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return n;
+}
+
 void main() {
 
-    st = TexCoord;
+    st = texOffset + texScale * TexCoord;
 
-    vec3 transformedNormal = mat3(MV) * Normal;
+    vec3 normal = octNormals ? octDecode(Normal.xy) : Normal;
+    vec3 transformedNormal = mat3(MV) * normal;
     interpolatedNormal = normalize(transformedNormal);
 
-    gl_Position = P*MV*vec4(Position, 1.0);
+    vec3 position = posOffset + posScale * Position;
+    gl_Position = P*MV*vec4(position, 1.0);
 
 }
-
-
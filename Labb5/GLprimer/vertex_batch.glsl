@@ -0,0 +1,35 @@
+#version 330 core
+
+uniform float time;
+uniform mat4 P;
+
+// Modelview matrices from BatchRenderer, 4 texels (columns) per draw
+uniform samplerBuffer drawMatrices;
+// Index of the matrix for separate draws, 0 for indirect draws
+uniform int drawBase;
+
+layout(location = 0) in vec3 Position;
+layout(location = 1) in vec3 Normal;
+layout(location = 2) in vec2 TexCoord;
+// Index of the matrix for indirect draws, through the base instance
+layout(location = 3) in float DrawID;
+
+out vec2 st;
+out vec3 interpolatedNormal;
+
+void main() {
+
+    int column = 4 * (drawBase + int(DrawID));
+    mat4 MV = mat4(texelFetch(drawMatrices, column),
+                   texelFetch(drawMatrices, column + 1),
+                   texelFetch(drawMatrices, column + 2),
+                   texelFetch(drawMatrices, column + 3));
+
+    st = TexCoord;
+
+    vec3 transformedNormal = mat3(MV) * Normal;
+    interpolatedNormal = normalize(transformedNormal);
+
+    gl_Position = P*MV*vec4(Position, 1.0);
+
+}